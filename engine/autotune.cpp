@@ -0,0 +1,398 @@
+#include <getopt.h>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+#include "engine.hpp"
+#include "cachesim.hpp"
+using namespace Tiling;
+
+// A legal combination of tiling parameters and its modeled cost.
+struct Candidate
+{
+	std::array<size_t, 3> tileSize;
+	std::array<char, 3>   tileType;
+	size_t tileHalfTs;
+
+	// DRAM traffic of all timesteps, the same model as utils/speedup
+	size_t bytesTransferred;
+
+	// bytes of the largest subtile, and the smallest number of tiles
+	// in a stage, i.e. how many threads can be kept busy
+	size_t workingSet;
+	size_t minStageTiles;
+
+	// measured with the real kernels, if benchmarked
+	double seconds;
+};
+
+std::array<size_t, 3> gridSize = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
+size_t timesteps = 100;
+size_t numThreads = 1;
+size_t numBenchmarks = 0;
+size_t cacheLevel = 0;
+size_t cacheSize = 0;
+
+int main(int argc, char** argv);
+void parseArgs(int argc, char** argv);
+size_t cacheSizePerThread(void);
+std::vector<Candidate> enumerateCandidates(size_t cacheBytes);
+bool evaluateCandidate(Candidate& candidate, size_t cacheBytes);
+double benchmark(const Candidate& candidate, Engine::Fields& fields);
+std::string formatArgs(const Candidate& candidate);
+
+int main(int argc, char** argv)
+{
+	parseArgs(argc, argv);
+
+	fprintf(stderr, "grid\t\t" "%04zu x %04zu x %04zu\n",
+					gridSize[0], gridSize[1], gridSize[2]);
+	fprintf(stderr, "timesteps\t"  "%zu\n", timesteps);
+	fprintf(stderr, "threads\t\t"  "%zu\n", numThreads);
+
+	size_t cacheBytes = cacheSizePerThread();
+	fprintf(stderr, "cache\t\t"    "%zu KiB per thread\n", cacheBytes / 1024);
+
+	std::vector<Candidate> candidates = enumerateCandidates(cacheBytes);
+	if (candidates.empty()) {
+		throw std::invalid_argument(
+			"no tile size fits in cache, grid too small or too few tiles "
+			"for all threads"
+		);
+	}
+	fprintf(stderr, "candidates\t" "%zu\n", candidates.size());
+
+	// Least traffic first. For equal traffic, prefer more parallelism,
+	// then the smaller working set.
+	std::sort(candidates.begin(), candidates.end(),
+		[](const Candidate& a, const Candidate& b) {
+			if (a.bytesTransferred != b.bytesTransferred) {
+				return a.bytesTransferred < b.bytesTransferred;
+			}
+			if (a.minStageTiles != b.minStageTiles) {
+				return a.minStageTiles > b.minStageTiles;
+			}
+			return a.workingSet < b.workingSet;
+		}
+	);
+
+	// Show the top 10, or all benchmarked candidates.
+	size_t numRanked = std::max<size_t>(numBenchmarks, 10);
+	numRanked = std::min(numRanked, candidates.size());
+	candidates.resize(numRanked);
+	numBenchmarks = std::min(numBenchmarks, numRanked);
+
+	size_t best = 0;
+	if (numBenchmarks > 0) {
+		Engine::Fields fields(gridSize);
+
+		for (size_t idx = 0; idx < numBenchmarks; idx++) {
+			candidates[idx].seconds = benchmark(candidates[idx], fields);
+			if (candidates[idx].seconds < candidates[best].seconds) {
+				best = idx;
+			}
+		}
+	}
+
+	fprintf(stderr, "\nrank\tparameters\t\ttraffic\t\t"
+					"working set\ttiles\ttime\n");
+	for (size_t idx = 0; idx < numRanked; idx++) {
+		const Candidate& candidate = candidates[idx];
+		fprintf(stderr, "%zu\t%-24s" "%.0f MBytes\t" "%.0f KiB\t" "%zu\t",
+						idx + 1, formatArgs(candidate).c_str(),
+						candidate.bytesTransferred / 1e6,
+						candidate.workingSet / 1024.0,
+						candidate.minStageTiles);
+		if (idx < numBenchmarks) {
+			fprintf(stderr, "%.3f s\n", candidate.seconds);
+		}
+		else {
+			fprintf(stderr, "-\n");
+		}
+	}
+	fprintf(stderr, "\n");
+
+	// Only the arguments go to stdout, so they can be passed to the other
+	// tools directly, e.g. ./compare -g 400,400,400 $(./autotune ...)
+	printf("%s\n", formatArgs(candidates[best]).c_str());
+}
+
+void parseArgs(int argc, char** argv)
+{
+	static struct option longopts[] = {
+		{"grid-size",			required_argument, 0, 'g'},
+		{"total-timesteps",		required_argument, 0, 'n'},
+		{"threads",				required_argument, 0, 'j'},
+		{"benchmark",			required_argument, 0, 'b'},
+		{"cache-level",			required_argument, 0, 'l'},
+		{"cache-size",			required_argument, 0, 'm'},
+	};
+
+	const char* progname = "autotune";
+	if (argc > 0) {
+		// argc == 0 is possible. The author is pedantic enough to worry about
+		// such a theoretical security exploit in demo code...
+		progname = argv[0];
+	}
+
+	char* gridArg = NULL;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "g:n:j:b:l:m:", longopts, NULL)) != -1) {
+		switch (opt) {
+			case 'g':
+				gridArg = optarg;
+				break;
+			case 'n':
+				timesteps = atoi(optarg);
+				break;
+			case 'j':
+				numThreads = atoi(optarg);
+				break;
+			case 'b':
+				numBenchmarks = atoi(optarg);
+				break;
+			case 'l':
+				cacheLevel = atoi(optarg);
+				break;
+			case 'm':
+				cacheSize = atoll(optarg);
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (!gridArg) {
+		printf("%s: Find the best tile size and tile height.\n\n", progname);
+		printf("Usage: %s [OPTION]\n", progname);
+		printf("   --grid-size\t\t-g\ti,j,k\t\t\t(e.g: 400,400,400)\n");
+		printf("   --total-timesteps\t-n\ttimesteps\t\t(defafult: 100)\n");
+		printf("   --threads\t\t-j\tthreads\t\t\t(default: 1)\n");
+		printf("   --benchmark\t\t-b\ttime top candidates\t(default: 0)\n");
+		printf("   --cache-level\t-l\tlevel\t\t\t(default: last level)\n");
+		printf("   --cache-size\t\t-m\tbytes\t\t\t(default: from sysfs)\n");
+		printf("\nNote: Trapezoid-Trapezoid-Trapezoid and "
+			   "Trapezoid-Trapezoid-Parallelogram tilings\n      are ranked "
+			   "by their DRAM traffic (see speedup), the working set of a\n"
+			   "      subtile must fit in the thread's share of the cache.\n");
+		printf("Note: The best parameters are printed to stdout, e.g. "
+			   "\"-t 20t,20t,20p -h 18\".\n");
+		std::exit(1);
+	}
+
+	gridSize[0] = atoi(strtok(gridArg, ","));
+	gridSize[1] = atoi(strtok(NULL, ","));
+	gridSize[2] = atoi(strtok(NULL, ","));
+
+	if (numThreads == 0) {
+		throw std::invalid_argument("threads must be at least 1");
+	}
+	if (timesteps == 0) {
+		throw std::invalid_argument("timesteps must be at least 1");
+	}
+}
+
+// The cache a subtile must fit in. Threads running on CPUs that share
+// the cache also share its capacity.
+size_t cacheSizePerThread(void)
+{
+	if (cacheSize > 0) {
+		return cacheSize;
+	}
+
+	std::vector<CacheSim::LevelConfig> caches = CacheSim::readSysfsConfig();
+	if (caches.empty()) {
+		throw std::invalid_argument(
+			"cache hierarchy not found in sysfs, use --cache-size"
+		);
+	}
+
+	const CacheSim::LevelConfig* selected = NULL;
+	for (const CacheSim::LevelConfig& cache : caches) {
+		if (cacheLevel == 0 && (!selected || cache.level > selected->level)) {
+			selected = &cache;
+		}
+		else if (cache.level == cacheLevel) {
+			selected = &cache;
+		}
+	}
+	if (!selected) {
+		throw std::invalid_argument(
+			std::format("cache level {} not found in sysfs", cacheLevel)
+		);
+	}
+
+	fprintf(stderr, "cache level\t" "L%zu, %zu KiB shared by %zu CPUs\n",
+					selected->level, selected->bytes / 1024,
+					selected->sharedCpus);
+
+	return selected->bytes / std::min(numThreads, selected->sharedCpus);
+}
+
+std::vector<Candidate> enumerateCandidates(size_t cacheBytes)
+{
+	const size_t widths[] = {
+		8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256
+	};
+	const size_t halfTimesteps[] = {
+		2, 4, 6, 8, 12, 16, 20, 24, 32, 48, 64
+	};
+
+	// volt, curr, vv, vi, ii, iv, each a float vec3
+	const size_t bytesPerCell = 6 * 3 * sizeof(float);
+
+	std::vector<Candidate> candidates;
+
+	for (char typeK : {'t', 'p'}) {
+		for (size_t widthIJ : widths) {
+			if (widthIJ > gridSize[0] || widthIJ > gridSize[1]) {
+				continue;
+			}
+
+			for (size_t widthK : widths) {
+				if (widthK > gridSize[2]) {
+					continue;
+				}
+
+				// A subtile is at least as large as the tile, skip the
+				// candidates that can't fit without building the plan.
+				if (widthIJ * widthIJ * widthK * bytesPerCell > cacheBytes) {
+					continue;
+				}
+
+				for (size_t tileHalfTs : halfTimesteps) {
+					if (tileHalfTs + 1 >= widthIJ ||
+						(typeK == 't' && tileHalfTs + 1 >= widthK) ||
+						(typeK == 'p' && tileHalfTs / 2 >= widthK) ||
+						tileHalfTs > timesteps * 2
+					) {
+						continue;
+					}
+
+					Candidate candidate;
+					candidate.tileSize = {widthIJ, widthIJ, widthK};
+					candidate.tileType = {'t', 't', typeK};
+					candidate.tileHalfTs = tileHalfTs;
+					candidate.seconds = 0;
+
+					if (evaluateCandidate(candidate, cacheBytes)) {
+						candidates.push_back(candidate);
+					}
+				}
+			}
+		}
+	}
+
+	return candidates;
+}
+
+// Build the plans of a candidate and apply the traffic model, return
+// false if it's illegal, doesn't fit in cache, or can't keep all threads
+// busy.
+bool evaluateCandidate(Candidate& candidate, size_t cacheBytes)
+{
+	const size_t bytesPerCell = 6 * 3 * sizeof(float);
+
+	size_t numBatches = timesteps * 2 / candidate.tileHalfTs;
+	size_t remHalfTs = timesteps * 2 - numBatches * candidate.tileHalfTs;
+
+	Plan3D mainPlan, remPlan;
+	try {
+		mainPlan = Engine::makePlan(
+			gridSize, candidate.tileSize, candidate.tileType,
+			candidate.tileHalfTs, numThreads
+		);
+		if (remHalfTs > 0) {
+			remPlan = Engine::makePlan(
+				gridSize, candidate.tileSize, candidate.tileType,
+				remHalfTs, numThreads
+			);
+		}
+	}
+	catch (const std::invalid_argument&) {
+		return false;
+	}
+
+	candidate.workingSet = 0;
+	candidate.minStageTiles = SIZE_MAX;
+
+	for (const TileList3D& tileList : mainPlan) {
+		candidate.minStageTiles = std::min(
+			candidate.minStageTiles, tileList.size()
+		);
+
+		for (const Tile3D& tile : tileList) {
+			for (const Subtile3D& subtile : tile) {
+				std::array<size_t, 3> size = subtile.boxSize();
+				size_t cells = size[0] * size[1] * size[2];
+				candidate.workingSet = std::max(
+					candidate.workingSet, cells * bytesPerCell
+				);
+			}
+		}
+	}
+
+	if (candidate.workingSet > cacheBytes ||
+		candidate.minStageTiles < numThreads
+	) {
+		return false;
+	}
+
+	// the traffic model of utils/speedup, without sliding window
+	candidate.bytesTransferred = estimateTraffic(mainPlan) * numBatches;
+	if (remHalfTs > 0) {
+		candidate.bytesTransferred += estimateTraffic(remPlan);
+	}
+	return true;
+}
+
+// Run all timesteps of a candidate with the real kernels. The field
+// values don't matter for timing, so the same fields are reused.
+double benchmark(const Candidate& candidate, Engine::Fields& fields)
+{
+	size_t numBatches = timesteps * 2 / candidate.tileHalfTs;
+	size_t remHalfTs = timesteps * 2 - numBatches * candidate.tileHalfTs;
+
+	Plan3D mainPlan = Engine::makePlan(
+		gridSize, candidate.tileSize, candidate.tileType,
+		candidate.tileHalfTs, numThreads
+	);
+	Plan3D remPlan;
+	if (remHalfTs > 0) {
+		remPlan = Engine::makePlan(
+			gridSize, candidate.tileSize, candidate.tileType,
+			remHalfTs, numThreads
+		);
+	}
+
+	ThreadPool pool(numThreads);
+
+	auto start = std::chrono::steady_clock::now();
+	if (numThreads > 1) {
+		Engine::tiled(fields, mainPlan, numBatches, remPlan, pool);
+	}
+	else {
+		Engine::tiled(fields, mainPlan, numBatches, remPlan);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	std::chrono::duration<double> time = end - start;
+	return time.count();
+}
+
+std::string formatArgs(const Candidate& candidate)
+{
+	return std::format(
+		"-t {}{},{}{},{}{} -h {}",
+		candidate.tileSize[0], candidate.tileType[0],
+		candidate.tileSize[1], candidate.tileType[1],
+		candidate.tileSize[2], candidate.tileType[2],
+		candidate.tileHalfTs
+	);
+}
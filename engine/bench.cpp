@@ -0,0 +1,758 @@
+#include <getopt.h>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <cinttypes>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+#include "engine.hpp"
+#include "kernel.hpp"
+using namespace Tiling;
+
+// One tile shape of the benchmark matrix, as given on the command line.
+struct TileConfig
+{
+	std::string name;
+	std::array<size_t, 3> tileSize;
+	std::array<char, 3>   tileType;
+};
+
+// Hardware counters of the main or remainder plan.
+struct PlanCounters
+{
+	std::string name;
+	size_t batches;
+	Engine::PlanProfile profile;
+};
+
+// Timing of all repetitions of a single configuration.
+struct Result
+{
+	std::array<size_t, 3> gridSize;
+	bool tiled;
+	std::string tile;
+	size_t tileHalfTs;
+	size_t numThreads;
+	double planSeconds;
+	std::vector<double> seconds;
+
+	// of the cell updates of the main plan, see Engine::maskedFraction()
+	double maskedFraction;
+
+	// modeled DRAM traffic of a run, the naive model of utils/speedup for
+	// the naive engine, Tiling::estimateTraffic() of the plans if tiled
+	size_t trafficBytes;
+
+	// whether the tiled result is bit-exact with the naive one
+	bool passed;
+
+	// hardware counters of an extra, untimed run with -c, the main
+	// plan comes first
+	std::vector<PlanCounters> counters;
+	bool hasLlcMisses = false;
+	bool hasMemReadBytes = false;
+};
+
+std::vector<std::array<size_t, 3>> gridSizes;
+std::vector<TileConfig> tiles;
+std::vector<size_t> tileHeights;
+std::vector<size_t> threadCounts;
+size_t timesteps = 100;
+size_t repetitions = 5;
+const char* outputPath = NULL;
+bool recordCounters = false;
+const char* kernelIsaArg = NULL;
+size_t alignK = 1;
+
+int main(int argc, char** argv);
+void parseArgs(int argc, char** argv);
+TileConfig parseTile(const char* arg);
+void checkTile(const TileConfig& tile, size_t tileHalfTs);
+void initializeArray(NArray3D<float>& array, float min, float max, size_t seed);
+void initializeFields(Engine::Fields& fields);
+bool identical(const Engine::Fields& a, const Engine::Fields& b);
+Result benchNaive(const Engine::Fields& init, Engine::Fields& ref);
+Result benchTiled(
+	const Engine::Fields& init, const Engine::Fields& ref,
+	const TileConfig& tile, size_t tileHalfTs, size_t numThreads
+);
+double mcellsPerSec(const Result& result, double seconds);
+size_t naiveTrafficBytes(std::array<size_t, 3> gridSize);
+double gbPerSec(const Result& result, double seconds);
+void printCounterSummary(const Result& result);
+void printCounters(FILE* file, const Result& result);
+void printResult(FILE* file, const Result& result, const Result& naive);
+
+int main(int argc, char** argv)
+{
+	parseArgs(argc, argv);
+
+	FILE* file = stdout;
+	if (outputPath) {
+		file = fopen(outputPath, "w");
+		if (!file) {
+			throw std::invalid_argument(
+				std::format("can't open {}", outputPath)
+			);
+		}
+	}
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"timesteps\": %zu,\n", timesteps);
+	fprintf(file, "  \"repetitions\": %zu,\n", repetitions);
+	fprintf(file, "  \"hardwareThreads\": %u,\n",
+				  std::thread::hardware_concurrency());
+	fprintf(file, "  \"kernelIsa\": \"%s\",\n", kernelIsa());
+	fprintf(file, "  \"alignK\": %zu,\n", alignK);
+	fprintf(file, "  \"results\": [");
+
+	bool success = true;
+	bool first = true;
+	for (std::array<size_t, 3> gridSize : gridSizes) {
+		Engine::Fields init(gridSize);
+		Engine::Fields ref(gridSize);
+		initializeFields(init);
+
+		Result naive = benchNaive(init, ref);
+		fprintf(file, "%s\n", first ? "" : ",");
+		printResult(file, naive, naive);
+		first = false;
+
+		for (const TileConfig& tile : tiles) {
+			for (size_t tileHalfTs : tileHeights) {
+				for (size_t numThreads : threadCounts) {
+					Result tiled = benchTiled(
+						init, ref, tile, tileHalfTs, numThreads
+					);
+					fprintf(file, ",\n");
+					printResult(file, tiled, naive);
+					success &= tiled.passed;
+				}
+			}
+		}
+	}
+
+	fprintf(file, "\n  ]\n");
+	fprintf(file, "}\n");
+
+	if (outputPath) {
+		fclose(file);
+	}
+
+	if (!success) {
+		fprintf(stderr, "comparison failed!\n");
+	}
+	return !success;
+}
+
+void parseArgs(int argc, char** argv)
+{
+	static struct option longopts[] = {
+		{"grid-size",			required_argument, 0, 'g'},
+		{"tile-size",			required_argument, 0, 't'},
+		{"tile-height",			required_argument, 0, 'h'},
+		{"total-timesteps",		required_argument, 0, 'n'},
+		{"threads",				required_argument, 0, 'j'},
+		{"repetitions",			required_argument, 0, 'r'},
+		{"output",				required_argument, 0, 'o'},
+		{"counters",			no_argument,       0, 'c'},
+		{"isa",					required_argument, 0, 'I'},
+		{"align-k",				optional_argument, 0, 'a'},
+	};
+
+	const char* progname = "bench";
+	if (argc > 0) {
+		// argc == 0 is possible. The author is pedantic enough to worry about
+		// such a theoretical security exploit in demo code...
+		progname = argv[0];
+	}
+
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "g:t:h:n:j:r:o:cI:a::", longopts, NULL)) != -1) {
+		switch (opt) {
+			case 'g':
+				gridSizes.push_back({
+					(size_t) atoi(strtok(optarg, ",")),
+					(size_t) atoi(strtok(NULL, ",")),
+					(size_t) atoi(strtok(NULL, ","))
+				});
+				break;
+			case 't':
+				tiles.push_back(parseTile(optarg));
+				break;
+			case 'h':
+				tileHeights.push_back(atoi(optarg));
+				break;
+			case 'n':
+				timesteps = atoi(optarg);
+				break;
+			case 'j':
+				threadCounts.push_back(atoi(optarg));
+				break;
+			case 'r':
+				repetitions = atoi(optarg);
+				break;
+			case 'o':
+				outputPath = optarg;
+				break;
+			case 'c':
+				recordCounters = true;
+				break;
+			case 'I':
+				kernelIsaArg = optarg;
+				break;
+			case 'a':
+				// without a width, the vector width of the kernels,
+				// which is only known after the ISA is selected
+				alignK = optarg ? atoi(optarg) : 0;
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (gridSizes.empty() || tiles.empty() || tileHeights.empty()) {
+		printf("%s: Benchmark the naive and tiled FP32 engine.\n\n",
+			   progname);
+		printf("Usage: %s [OPTION]\n", progname);
+		printf("   --grid-size\t\t-g\ti,j,k\t\t\t(e.g: 400,400,400)\n");
+		printf("   --tile-size\t\t-t\tit/id,jt/jd,kt/kd/kp\t"
+			   "(e.g: 20t,20t,20t, 20t,20t,20p or 20d,20d,20p)\n");
+		printf("   \t\t\tid,jp,f\t\t\t(DiamondTorre, e.g: 20d,20p,f)\n");
+		printf("   \t\t\tic,jc,kc\t\t(DiamondCandy, e.g: 20c,20c,20c)\n");
+		printf("   \t\t\tir,jr,kr\t\t(recursive, e.g: 16r,16r,64r)\n");
+		printf("   --tile-height\t-h\thalfTimesteps\t\t(e.g: 18)\n");
+		printf("   --total-timesteps\t-n\ttimesteps\t\t(default: 100)\n");
+		printf("   --threads\t\t-j\tthreads\t\t\t(default: 1)\n");
+		printf("   --repetitions\t-r\trepetitions\t\t(default: 5)\n");
+		printf("   --output\t\t-o\tJSON file\t\t(default: stdout)\n");
+		printf("   --counters\t\t-c\thardware counters\t(default: no)\n");
+		printf("   --isa\t\t-I\tsse4.2/avx2/avx512\t(default: best "
+			   "supported)\n");
+		printf("   --align-k[=width]\t-a\talign tile edges in k\t(default: "
+			   "no, width: vector width)\n");
+		printf("\nNote: -g, -t, -h and -j can be repeated, all combinations "
+			   "are benchmarked.\n");
+		printf("Note: -c records cycles, LLC misses and memory reads of "
+			   "every tile in an extra,\n      untimed run of each tiled "
+			   "configuration, using perf_event_open().\n");
+		printf("Note: Parallelogram tiling uses suffix \"p\", "
+			   "trapezoid tiling uses suffix \"t\", "
+			   "diamond tiling uses suffix \"d\".\n");
+		printf("Note: DiamondTorre uses diamond tiling in dimension i, "
+			   "parallelogram tiling\n      in dimension j, and column "
+			   "tiling (suffix \"f\", not tiled) in dimension k.\n");
+		printf("Note: DiamondCandy uses diamond tiling in all dimensions, "
+			   "grouped into levels\n      of candies that can run "
+			   "concurrently.\n");
+		printf("Note: Recursive tiling cuts the whole grid in space and time "
+			   "until the pieces\n      are no larger than the given base "
+			   "size, without tuning for cache size.\n");
+		std::exit(1);
+	}
+
+	if (threadCounts.empty()) {
+		threadCounts.push_back(1);
+	}
+
+	for (size_t numThreads : threadCounts) {
+		if (numThreads == 0) {
+			throw std::invalid_argument("threads must be at least 1");
+		}
+	}
+	if (repetitions == 0) {
+		throw std::invalid_argument("repetitions must be at least 1");
+	}
+
+	if (kernelIsaArg) {
+		setKernelIsa(kernelIsaArg);
+	}
+	if (alignK == 0) {
+		alignK = kernelVectorWidth();
+	}
+
+	if (recordCounters) {
+		// throws if the counters are unavailable
+		Engine::Profiler profiler;
+	}
+
+	// fail early, not after benchmarking the valid combinations
+	for (const TileConfig& tile : tiles) {
+		for (size_t tileHalfTs : tileHeights) {
+			checkTile(tile, tileHalfTs);
+		}
+	}
+}
+
+TileConfig parseTile(const char* arg)
+{
+	TileConfig tile;
+	tile.name = arg;
+
+	std::string tileArg = arg;
+	std::array<std::string, 3> tileArgString;
+	tileArgString[0] = strtok(tileArg.data(), ",");
+	tileArgString[1] = strtok(NULL, ",");
+	tileArgString[2] = strtok(NULL, ",");
+
+	for (size_t dim = 0; dim < 3; dim++) {
+		std::string& arg = tileArgString[dim];
+
+		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p' &&
+			arg[arg.size() - 1] != 'd' && arg[arg.size() - 1] != 'f' &&
+			arg[arg.size() - 1] != 'c' && arg[arg.size() - 1] != 'r'
+		) {
+			throw std::invalid_argument(
+				std::format("tile suffix must be 't', 'p', 'd', 'f', 'c' or "
+							"'r', got {}", arg[arg.size() - 1])
+			);
+		}
+
+		tile.tileType[dim] = arg[arg.size() - 1];
+		arg[arg.size() - 1] = '\0';
+		tile.tileSize[dim] = atoi(arg.c_str());
+	}
+
+	return tile;
+}
+
+void checkTile(const TileConfig& tile, size_t tileHalfTs)
+{
+	const std::array<char, 3>& tileType = tile.tileType;
+
+	if (tileType[0] == 'r' || tileType[1] == 'r' || tileType[2] == 'r') {
+		if (tileType[0] != 'r' || tileType[1] != 'r' || tileType[2] != 'r') {
+			throw std::invalid_argument(
+				"recursive tiling (suffix r) must be used in all dimensions"
+			);
+		}
+	}
+	else if (tileType[1] == 'p' || tileType[2] == 'f') {
+		// DiamondTorre
+		if (tileType[0] != 'd' || tileType[1] != 'p' || tileType[2] != 'f') {
+			throw std::invalid_argument(
+				"DiamondTorre must use diamond tiling (suffix d) in "
+				"dimension i, parallelogram tiling (suffix p) in dimension "
+				"j, and column tiling (suffix f) in dimension k"
+			);
+		}
+	}
+	else {
+		if (tileType[0] != tileType[1] ||
+			(tileType[0] != 't' && tileType[0] != 'd' && tileType[0] != 'c')
+		) {
+			throw std::invalid_argument(
+				"dimension i and j only support trapezoid (suffix t), "
+				"diamond (suffix d) or DiamondCandy (suffix c) tiling"
+			);
+		}
+		if (tileType[2] != 'p' && tileType[2] != tileType[0]) {
+			throw std::invalid_argument(
+				"dimension k must use parallelogram tiling (suffix p), or "
+				"the same tiling as dimension i and j"
+			);
+		}
+		if (tileType[0] == 'c' && tileType[2] != 'c') {
+			throw std::invalid_argument(
+				"DiamondCandy (suffix c) must be used in all dimensions"
+			);
+		}
+	}
+	if ((tileType[0] == 'd' || tileType[0] == 'c') && tileHalfTs % 4 != 0) {
+		throw std::invalid_argument(
+			"diamond tiling requires tile height to be a multiple of 4"
+		);
+	}
+}
+
+void initializeArray(NArray3D<float>& array, float min, float max, size_t seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> dist(min, max);
+
+	for (size_t idx = 0; idx < array.elems(); idx++) {
+		array.data()[idx] = dist(rng);
+	}
+}
+
+void initializeFields(Engine::Fields& fields)
+{
+	// Same values as compare, so the timing isn't affected by denormals
+	// or infinities after many timesteps.
+	initializeArray(fields.volt, -1.0, 1.0, 1);
+	initializeArray(fields.curr, -1.0, 1.0, 2);
+	initializeArray(fields.vv,    0.9, 1.0, 3);
+	initializeArray(fields.vi,    0.0, 0.1, 4);
+	initializeArray(fields.ii,    0.9, 1.0, 5);
+	initializeArray(fields.iv,    0.0, 0.1, 6);
+}
+
+bool identical(const Engine::Fields& a, const Engine::Fields& b)
+{
+	// Both schedules perform identical operations on each cell in
+	// an identical order, so the results must be bit-exact.
+	size_t bytes = a.volt.elems() * sizeof(float);
+	return std::memcmp(a.volt.data(), b.volt.data(), bytes) == 0 &&
+		   std::memcmp(a.curr.data(), b.curr.data(), bytes) == 0;
+}
+
+// Every repetition starts from the same initial fields, the result of
+// the last one is kept in ref as the reference of the tiled engine.
+Result benchNaive(const Engine::Fields& init, Engine::Fields& ref)
+{
+	Result result;
+	result.gridSize = init.size;
+	result.tiled = false;
+	result.tileHalfTs = 0;
+	result.numThreads = 1;
+	result.planSeconds = 0;
+	result.maskedFraction = 0;
+	result.trafficBytes = naiveTrafficBytes(init.size);
+	result.passed = true;
+
+	for (size_t rep = 0; rep < repetitions; rep++) {
+		ref.copyFrom(init);
+
+		auto start = std::chrono::steady_clock::now();
+		Engine::naive(ref, timesteps);
+		auto end = std::chrono::steady_clock::now();
+
+		std::chrono::duration<double> time = end - start;
+		result.seconds.push_back(time.count());
+	}
+
+	fprintf(stderr, "naive\t" "%04zu x %04zu x %04zu\t" "%.1f Mcells/s\n",
+					init.size[0], init.size[1], init.size[2],
+					mcellsPerSec(result, result.seconds.back()));
+	return result;
+}
+
+Result benchTiled(
+	const Engine::Fields& init, const Engine::Fields& ref,
+	const TileConfig& tile, size_t tileHalfTs, size_t numThreads
+)
+{
+	std::array<size_t, 3> gridSize = init.size;
+	std::array<size_t, 3> tileSize = tile.tileSize;
+	if (tile.tileType[2] == 'f') {
+		// dimension k is not tiled
+		tileSize[2] = gridSize[2];
+	}
+
+	Result result;
+	result.gridSize = gridSize;
+	result.tiled = true;
+	result.tile = tile.name;
+	result.tileHalfTs = tileHalfTs;
+	result.numThreads = numThreads;
+	result.passed = true;
+
+	size_t numBatches = timesteps * 2 / tileHalfTs;
+	size_t remHalfTs = (timesteps - (numBatches * tileHalfTs) / 2) * 2;
+
+	// Plans are owned by the cache, an unused remainder plan stays empty.
+	auto planStart = std::chrono::steady_clock::now();
+	PlanCache planCache;
+	Plan3D emptyPlan;
+	const Plan3D* mainPlan = &Engine::makePlan(
+		gridSize, tileSize, tile.tileType, tileHalfTs,
+		planCache, numThreads, {}, alignK
+	);
+	const Plan3D* remPlan = &emptyPlan;
+	if (remHalfTs > 0) {
+		remPlan = &Engine::makePlan(
+			gridSize, tileSize, tile.tileType, remHalfTs,
+			planCache, numThreads, {}, alignK
+		);
+	}
+	auto planEnd = std::chrono::steady_clock::now();
+
+	std::chrono::duration<double> planTime = planEnd - planStart;
+	result.planSeconds = planTime.count();
+	result.maskedFraction = Engine::maskedFraction(*mainPlan);
+	result.trafficBytes = estimateTraffic(*mainPlan) * numBatches +
+						  estimateTraffic(*remPlan);
+
+	ThreadPool pool(numThreads);
+	Engine::Fields tiled(gridSize);
+
+	for (size_t rep = 0; rep < repetitions; rep++) {
+		tiled.copyFrom(init);
+
+		auto start = std::chrono::steady_clock::now();
+		if (numThreads > 1) {
+			Engine::tiled(tiled, *mainPlan, numBatches, *remPlan, pool);
+		}
+		else {
+			Engine::tiled(tiled, *mainPlan, numBatches, *remPlan);
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		std::chrono::duration<double> time = end - start;
+		result.seconds.push_back(time.count());
+		result.passed &= identical(ref, tiled);
+	}
+
+	if (recordCounters) {
+		// Not timed, reading the counters after every subtile is a
+		// system call.
+		Engine::Profiler profiler(numThreads);
+		tiled.copyFrom(init);
+
+		Engine::setProfiler(&profiler);
+		if (numThreads > 1) {
+			Engine::tiled(tiled, *mainPlan, numBatches, *remPlan, pool);
+		}
+		else {
+			Engine::tiled(tiled, *mainPlan, numBatches, *remPlan);
+		}
+		Engine::setProfiler(NULL);
+
+		result.passed &= identical(ref, tiled);
+		for (Engine::PlanProfile& profile : profiler.profiles()) {
+			if (profile.plan == mainPlan) {
+				result.counters.push_back({"main", numBatches, profile});
+			}
+			else {
+				result.counters.push_back({"remainder", 1, profile});
+			}
+		}
+		result.hasLlcMisses = profiler.hasLlcMisses();
+		result.hasMemReadBytes = profiler.hasMemReadBytes();
+	}
+
+	fprintf(stderr, "tiled\t" "%04zu x %04zu x %04zu\t" "%s -h %zu -j %zu\t"
+					"%.1f Mcells/s%s\n",
+					gridSize[0], gridSize[1], gridSize[2],
+					tile.name.c_str(), tileHalfTs, numThreads,
+					mcellsPerSec(result, result.seconds.back()),
+					result.passed ? "" : " (comparison failed!)");
+	if (!result.counters.empty()) {
+		printCounterSummary(result);
+	}
+	return result;
+}
+
+double mcellsPerSec(const Result& result, double seconds)
+{
+	double cells = result.gridSize[0] * result.gridSize[1] * result.gridSize[2];
+	return cells * timesteps / seconds / 1e6;
+}
+
+// DRAM traffic of all timesteps of the naive engine, the same model as
+// utils/speedup: every array is streamed once per half timestep.
+size_t naiveTrafficBytes(std::array<size_t, 3> gridSize)
+{
+	size_t bytes = gridSize[0] * gridSize[1] * gridSize[2];
+	bytes *= 3;  // vec3
+	bytes *= 4;  // sizeof(float)
+	bytes *= 10; // volt r/w, curr r, vv r, vi r
+				 // curr r/w, volt r, ii r, iv r
+	return bytes * timesteps;
+}
+
+// Achieved bandwidth, i.e. the modeled DRAM traffic of the run divided
+// by the time.
+double gbPerSec(const Result& result, double seconds)
+{
+	return result.trafficBytes / seconds / 1e9;
+}
+
+// Mean, sample standard deviation, min and max of a metric of all
+// repetitions.
+static void
+printStats(FILE* file, const char* name, const std::vector<double>& values)
+{
+	double mean = 0;
+	for (double value : values) {
+		mean += value;
+	}
+	mean /= values.size();
+
+	double variance = 0;
+	for (double value : values) {
+		variance += (value - mean) * (value - mean);
+	}
+	if (values.size() > 1) {
+		variance /= values.size() - 1;
+	}
+
+	fprintf(file, "      \"%s\": {\"mean\": %.6g, \"stddev\": %.6g, "
+				  "\"min\": %.6g, \"max\": %.6g}",
+				  name, mean, std::sqrt(variance),
+				  *std::min_element(values.begin(), values.end()),
+				  *std::max_element(values.begin(), values.end()));
+}
+
+void printResult(FILE* file, const Result& result, const Result& naive)
+{
+	std::vector<double> mcells, gbytes;
+	for (double seconds : result.seconds) {
+		mcells.push_back(mcellsPerSec(result, seconds));
+		gbytes.push_back(gbPerSec(result, seconds));
+	}
+
+	fprintf(file, "    {\n");
+	fprintf(file, "      \"grid\": [%zu, %zu, %zu],\n",
+				  result.gridSize[0], result.gridSize[1], result.gridSize[2]);
+	fprintf(file, "      \"engine\": \"%s\",\n",
+				  result.tiled ? "tiled" : "naive");
+	if (result.tiled) {
+		fprintf(file, "      \"tile\": \"%s\",\n", result.tile.c_str());
+		fprintf(file, "      \"halfTimesteps\": %zu,\n", result.tileHalfTs);
+	}
+	fprintf(file, "      \"threads\": %zu,\n", result.numThreads);
+	if (result.tiled) {
+		fprintf(file, "      \"planSeconds\": %.6g,\n", result.planSeconds);
+		fprintf(file, "      \"maskedFraction\": %.4f,\n",
+					  result.maskedFraction);
+	}
+
+	printStats(file, "seconds", result.seconds);
+	fprintf(file, ",\n");
+	printStats(file, "mcellsPerSec", mcells);
+	fprintf(file, ",\n");
+	printStats(file, "gbPerSec", gbytes);
+	fprintf(file, ",\n");
+	fprintf(file, "      \"trafficBytes\": %zu,\n", result.trafficBytes);
+	fprintf(file, "      \"trafficModel\": \"%s\"",
+				  result.tiled ? "plan" : "naive");
+
+	if (result.tiled) {
+		double naiveMin = *std::min_element(
+			naive.seconds.begin(), naive.seconds.end()
+		);
+		double tiledMin = *std::min_element(
+			result.seconds.begin(), result.seconds.end()
+		);
+		fprintf(file, ",\n");
+		fprintf(file, "      \"speedup\": %.4f,\n", naiveMin / tiledMin);
+		fprintf(file, "      \"passed\": %s", result.passed ? "true" : "false");
+	}
+	if (!result.counters.empty()) {
+		fprintf(file, ",\n");
+		printCounters(file, result);
+	}
+	fprintf(file, "\n    }");
+}
+
+// Totals of all plans, and the shape with the most cycles per cell,
+// usually a boundary shape with poor cache reuse.
+void printCounterSummary(const Result& result)
+{
+	Engine::Counters total;
+	std::array<size_t, 3> worstShape = {0, 0, 0};
+	double worstCycles = 0;
+
+	for (const PlanCounters& plan : result.counters) {
+		for (const Engine::Counters& stage : plan.profile.stages) {
+			total += stage;
+		}
+		for (const auto& [shape, counters] : plan.profile.shapes) {
+			if (counters.cells == 0) {
+				continue;
+			}
+
+			double cycles = (double) counters.cycles / counters.cells;
+			if (cycles > worstCycles) {
+				worstShape = shape;
+				worstCycles = cycles;
+			}
+		}
+	}
+
+	double cells = std::max(total.cells, (size_t) 1);
+	fprintf(stderr, "counters\t" "%.1f cycles/cell, ", total.cycles / cells);
+	if (result.hasLlcMisses) {
+		fprintf(stderr, "%.3f LLC misses/cell, ", total.llcMisses / cells);
+	}
+	if (result.hasMemReadBytes) {
+		fprintf(stderr, "%.2f GB read, ", total.memReadBytes / 1e9);
+	}
+	fprintf(stderr, "worst shape %zu x %zu x %zu (%.1f cycles/cell)\n",
+					worstShape[0], worstShape[1], worstShape[2], worstCycles);
+}
+
+static void
+printCounterValues(FILE* file, const Result& result, const Engine::Counters& c)
+{
+	fprintf(file, "\"subtiles\": %zu, \"cells\": %zu, \"cycles\": %" PRIu64,
+				  c.subtiles, c.cells, c.cycles);
+	if (result.hasLlcMisses) {
+		fprintf(file, ", \"llcMisses\": %" PRIu64, c.llcMisses);
+	}
+	else {
+		fprintf(file, ", \"llcMisses\": null");
+	}
+	if (result.hasMemReadBytes) {
+		fprintf(file, ", \"memReadBytes\": %" PRIu64, c.memReadBytes);
+	}
+	else {
+		fprintf(file, ", \"memReadBytes\": null");
+	}
+}
+
+// Counters of every stage, subtile shape and tile, summed over all
+// batches and threads. Unsupported events are null.
+void printCounters(FILE* file, const Result& result)
+{
+	fprintf(file, "      \"counters\": [");
+
+	for (size_t planIdx = 0; planIdx < result.counters.size(); planIdx++) {
+		const PlanCounters& plan = result.counters[planIdx];
+		const Engine::PlanProfile& profile = plan.profile;
+
+		fprintf(file, "%s\n", planIdx > 0 ? "," : "");
+		fprintf(file, "        {\n");
+		fprintf(file, "          \"plan\": \"%s\",\n", plan.name.c_str());
+		fprintf(file, "          \"batches\": %zu,\n", plan.batches);
+
+		fprintf(file, "          \"stages\": [");
+		for (size_t stage = 0; stage < profile.stages.size(); stage++) {
+			fprintf(file, "%s\n            {\"stage\": %zu, ",
+						  stage > 0 ? "," : "", stage);
+			printCounterValues(file, result, profile.stages[stage]);
+			fprintf(file, "}");
+		}
+		fprintf(file, "\n          ],\n");
+
+		fprintf(file, "          \"shapes\": [");
+		bool first = true;
+		for (const auto& [shape, counters] : profile.shapes) {
+			fprintf(file, "%s\n            {\"shape\": [%zu, %zu, %zu], ",
+						  first ? "" : ",", shape[0], shape[1], shape[2]);
+			printCounterValues(file, result, counters);
+			fprintf(file, "}");
+			first = false;
+		}
+		fprintf(file, "\n          ],\n");
+
+		fprintf(file, "          \"tiles\": [");
+		first = true;
+		for (size_t stage = 0; stage < profile.tiles.size(); stage++) {
+			for (size_t tile = 0; tile < profile.tiles[stage].size(); tile++) {
+				const Engine::TileProfile& tileProfile = profile.tiles[stage][tile];
+				fprintf(file, "%s\n            {\"stage\": %zu, \"tile\": %zu, "
+							  "\"id\": [%zu, %zu, %zu], ",
+							  first ? "" : ",", stage, tile,
+							  tileProfile.id[0], tileProfile.id[1],
+							  tileProfile.id[2]);
+				printCounterValues(file, result, tileProfile.counters);
+				fprintf(file, "}");
+				first = false;
+			}
+		}
+		fprintf(file, "\n          ]\n");
+		fprintf(file, "        }");
+	}
+
+	fprintf(file, "\n      ]");
+}
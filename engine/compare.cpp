@@ -0,0 +1,506 @@
+#include <getopt.h>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <format>
+#include <stdexcept>
+
+#include "engine.hpp"
+#include "kernel.hpp"
+using namespace Tiling;
+
+std::array<size_t, 3> gridSize = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
+std::array<size_t, 3> tileSize = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
+std::array<char, 3>   tileType = {'-', '-', '-'};
+size_t tileHalfTs = SIZE_MAX;
+size_t timesteps = 100;
+size_t numThreads = 1;
+bool dagScheduler = false;
+bool lazyPlan = false;
+bool flatPlan = false;
+std::string planCacheDir;
+std::vector<std::array<size_t, 3>> innerTileSizes;
+const char* tracePath = NULL;
+const char* kernelIsaArg = NULL;
+size_t alignK = 1;
+
+int main(int argc, char** argv);
+void parseArgs(int argc, char** argv);
+void initializeArray(NArray3D<float>& array, float min, float max, size_t seed);
+void initializeFields(Engine::Fields& fields);
+bool compareArrays(
+	const char* name,
+	const NArray3D<float>& arrayRef,
+	const NArray3D<float>& arrayTiled
+);
+double mcellsPerSec(double seconds);
+
+int main(int argc, char** argv)
+{
+	parseArgs(argc, argv);
+
+	size_t numBatches = timesteps * 2 / tileHalfTs;
+	size_t remHalfTs = (timesteps - (numBatches * tileHalfTs) / 2) * 2;
+
+	fprintf(stderr, "grid\t\t" "%04zu x %04zu x %04zu\n",
+					gridSize[0], gridSize[1], gridSize[2]);
+	fprintf(stderr, "tile\t\t" "%04zu x %04zu x %04zu\n",
+					tileSize[0], tileSize[1], tileSize[2]);
+	for (std::array<size_t, 3> innerTileSize : innerTileSizes) {
+		fprintf(stderr, "inner tile\t" "%04zu x %04zu x %04zu\n",
+						innerTileSize[0], innerTileSize[1], innerTileSize[2]);
+	}
+
+	fprintf(stderr, "timesteps\t"  "%zu\n", timesteps);
+	fprintf(stderr, "kernel isa\t" "%s\n", kernelIsa());
+	fprintf(stderr, "align k\t\t"  "%zu\n", alignK);
+	fprintf(stderr, "threads\t\t"  "%zu\n", numThreads);
+	fprintf(stderr, "scheduler\t"  "%s\n", dagScheduler ? "dag" : "barrier");
+	fprintf(stderr, "plan\t\t"     "%s\n",
+					lazyPlan ? "lazy" : flatPlan ? "flat" : "materialized");
+	fprintf(stderr, "main batch\t" "%04zu x %04zu = %04zu timesteps\n",
+					tileHalfTs / 2, numBatches, (numBatches * tileHalfTs) / 2);
+
+	if (remHalfTs > 0) {
+		fprintf(stderr, "rem batch\t" "%04zu x 0001 = %04zu timesteps\n",
+						remHalfTs / 2, remHalfTs / 2);
+	}
+	else {
+		fprintf(stderr, "rem batch\t" "0000 x 0000 = 0000 timesteps\n");
+	}
+
+	Engine::Fields ref(gridSize);
+	Engine::Fields tiled(gridSize);
+	initializeFields(ref);
+	tiled.copyFrom(ref);
+
+	// Plans are owned by the cache, unused ones stay empty.
+	auto planStart = std::chrono::steady_clock::now();
+	PlanCache planCache(planCacheDir);
+	Plan3D emptyPlan;
+	const Plan3D* mainPlan = &emptyPlan;
+	const Plan3D* remPlan = &emptyPlan;
+	LazyPlan3D lazyMainPlan, lazyRemPlan;
+	FlatPlan3D flatMainPlan, flatRemPlan;
+	if (lazyPlan) {
+		lazyMainPlan = Engine::makeLazyPlan(
+			gridSize, tileSize, tileType, tileHalfTs, alignK
+		);
+		if (remHalfTs > 0) {
+			lazyRemPlan = Engine::makeLazyPlan(
+				gridSize, tileSize, tileType, remHalfTs, alignK
+			);
+		}
+	}
+	else if (flatPlan) {
+		flatMainPlan = Engine::makeFlatPlan(
+			gridSize, tileSize, tileType, tileHalfTs,
+			planCache, numThreads, innerTileSizes, alignK
+		);
+		if (remHalfTs > 0) {
+			flatRemPlan = Engine::makeFlatPlan(
+				gridSize, tileSize, tileType, remHalfTs,
+				planCache, numThreads, innerTileSizes, alignK
+			);
+		}
+	}
+	else {
+		mainPlan = &Engine::makePlan(
+			gridSize, tileSize, tileType, tileHalfTs,
+			planCache, numThreads, innerTileSizes, alignK
+		);
+		if (remHalfTs > 0) {
+			remPlan = &Engine::makePlan(
+				gridSize, tileSize, tileType, remHalfTs,
+				planCache, numThreads, innerTileSizes, alignK
+			);
+		}
+	}
+	auto planEnd = std::chrono::steady_clock::now();
+
+	if (flatPlan) {
+		fprintf(stderr, "plan size\t" "%.1f KiB\n",
+						(flatMainPlan.bytes() + flatRemPlan.bytes()) / 1024.0);
+	}
+
+	// of the main plan, the remainder batch runs only once
+	double maskedFraction =
+		lazyPlan ? Engine::maskedFraction(lazyMainPlan) :
+		flatPlan ? Engine::maskedFraction(flatMainPlan) :
+				   Engine::maskedFraction(*mainPlan);
+	fprintf(stderr, "masked cells\t" "%.1f%%\n", 100.0 * maskedFraction);
+
+	auto naiveStart = std::chrono::steady_clock::now();
+	Engine::naive(ref, timesteps);
+	auto naiveEnd = std::chrono::steady_clock::now();
+
+	ThreadPool pool(numThreads);
+
+	// The trace is recorded during the timed run, its overhead is two
+	// clock reads per tile.
+	Engine::Tracer tracer(numThreads);
+	if (tracePath) {
+		Engine::setTracer(&tracer);
+	}
+
+	auto tiledStart = std::chrono::steady_clock::now();
+	if (dagScheduler && flatPlan) {
+		TileGraph3D mainGraph = computeTileGraph(flatMainPlan);
+		TileGraph3D remGraph = computeTileGraph(flatRemPlan);
+		Engine::tiled(
+			tiled,
+			flatMainPlan, mainGraph, numBatches,
+			flatRemPlan, remGraph,
+			pool
+		);
+	}
+	else if (dagScheduler) {
+		TileGraph3D mainGraph = computeTileGraph(*mainPlan);
+		TileGraph3D remGraph = computeTileGraph(*remPlan);
+		Engine::tiled(
+			tiled,
+			*mainPlan, mainGraph, numBatches,
+			*remPlan, remGraph,
+			pool
+		);
+	}
+	else if (lazyPlan && numThreads > 1) {
+		Engine::tiled(tiled, lazyMainPlan, numBatches, lazyRemPlan, pool);
+	}
+	else if (lazyPlan) {
+		Engine::tiled(tiled, lazyMainPlan, numBatches, lazyRemPlan);
+	}
+	else if (flatPlan && numThreads > 1) {
+		Engine::tiled(tiled, flatMainPlan, numBatches, flatRemPlan, pool);
+	}
+	else if (flatPlan) {
+		Engine::tiled(tiled, flatMainPlan, numBatches, flatRemPlan);
+	}
+	else if (numThreads > 1) {
+		Engine::tiled(tiled, *mainPlan, numBatches, *remPlan, pool);
+	}
+	else {
+		Engine::tiled(tiled, *mainPlan, numBatches, *remPlan);
+	}
+	auto tiledEnd = std::chrono::steady_clock::now();
+
+	if (tracePath) {
+		Engine::setTracer(NULL);
+		tracer.write(tracePath);
+	}
+
+	std::chrono::duration<double> planTime = planEnd - planStart;
+	std::chrono::duration<double> naiveTime = naiveEnd - naiveStart;
+	std::chrono::duration<double> tiledTime = tiledEnd - tiledStart;
+
+	printf("planning\t" "%.3f s\n", planTime.count());
+	printf("naive\t\t" "%.3f s\t" "%.1f Mcells/s\n",
+		   naiveTime.count(), mcellsPerSec(naiveTime.count()));
+	printf("tiled\t\t" "%.3f s\t" "%.1f Mcells/s\n",
+		   tiledTime.count(), mcellsPerSec(tiledTime.count()));
+	printf("speedup\t\t" "%.1f%%\n",
+		   100.0 * naiveTime.count() / tiledTime.count());
+
+	bool success = true;
+	success &= compareArrays("volt", ref.volt, tiled.volt);
+	success &= compareArrays("curr", ref.curr, tiled.curr);
+
+	if (success) {
+		printf("comparison passed.\n");
+	}
+
+	return !success;
+}
+
+void initializeArray(NArray3D<float>& array, float min, float max, size_t seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> dist(min, max);
+
+	for (size_t idx = 0; idx < array.elems(); idx++) {
+		array.data()[idx] = dist(rng);
+	}
+}
+
+void initializeFields(Engine::Fields& fields)
+{
+	// Arbitrary but deterministic values. The operators are chosen to
+	// keep the field bounded, so that results are not dominated by
+	// denormals or infinities after many timesteps.
+	initializeArray(fields.volt, -1.0, 1.0, 1);
+	initializeArray(fields.curr, -1.0, 1.0, 2);
+	initializeArray(fields.vv,    0.9, 1.0, 3);
+	initializeArray(fields.vi,    0.0, 0.1, 4);
+	initializeArray(fields.ii,    0.9, 1.0, 5);
+	initializeArray(fields.iv,    0.0, 0.1, 6);
+}
+
+bool compareArrays(
+	const char* name,
+	const NArray3D<float>& arrayRef,
+	const NArray3D<float>& arrayTiled
+)
+{
+	// Both schedules perform identical operations on each cell in
+	// an identical order, so the results must be bit-exact.
+	for (size_t i = 0; i < gridSize[0]; i++) {
+		for (size_t j = 0; j < gridSize[1]; j++) {
+			for (size_t k = 0; k < gridSize[2]; k++) {
+				for (size_t n = 0; n < 3; n++) {
+					float refVal = arrayRef(i, j, k, n);
+					float tiledVal = arrayTiled(i, j, k, n);
+
+					if (std::memcmp(&refVal, &tiledVal, sizeof(float)) != 0) {
+						fprintf(stderr,
+							"%s(i=%zu,j=%zu,k=%zu,n=%zu) comparison failed!\n"
+							"expected %.9g, got %.9g\n",
+							name, i, j, k, n, refVal, tiledVal
+						);
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+double mcellsPerSec(double seconds)
+{
+	double cells = gridSize[0] * gridSize[1] * gridSize[2];
+	return cells * timesteps / seconds / 1e6;
+}
+
+void parseArgs(int argc, char** argv)
+{
+	static struct option longopts[] = {
+		{"grid-size",			required_argument, 0, 'g'},
+		{"tile-size",			required_argument, 0, 't'},
+		{"tile-height",			required_argument, 0, 'h'},
+		{"total-timesteps",		optional_argument, 0, 'n'},
+		{"threads",				required_argument, 0, 'j'},
+		{"scheduler",			required_argument, 0, 's'},
+		{"lazy",				no_argument,       0, 'l'},
+		{"flat",				no_argument,       0, 'f'},
+		{"plan-cache",			required_argument, 0, 'c'},
+		{"refine",				required_argument, 0, 'r'},
+		{"trace",				required_argument, 0, 'T'},
+		{"isa",					required_argument, 0, 'I'},
+		{"align-k",				optional_argument, 0, 'a'},
+	};
+
+	const char* progname = "compare";
+	if (argc > 0) {
+		// argc == 0 is possible. The author is pedantic enough to worry about
+		// such a theoretical security exploit in demo code...
+		progname = argv[0];
+	}
+
+	char* gridArg = NULL;
+	char* tileArg = NULL;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "lfc:r:g:t:h:n:j:s:T:I:a::", longopts, NULL)) != -1) {
+		switch (opt) {
+			case 'g':
+				gridArg = optarg;
+				break;
+			case 't':
+				tileArg = optarg;
+				break;
+			case 'h':
+				tileHalfTs = atoi(optarg);
+				break;
+			case 'n':
+				timesteps = atoi(optarg);
+				break;
+			case 'j':
+				numThreads = atoi(optarg);
+				break;
+			case 'l':
+				lazyPlan = true;
+				break;
+			case 'f':
+				flatPlan = true;
+				break;
+			case 'c':
+				planCacheDir = optarg;
+				break;
+			case 'r':
+				innerTileSizes.push_back({
+					(size_t) atoi(strtok(optarg, ",")),
+					(size_t) atoi(strtok(NULL, ",")),
+					(size_t) atoi(strtok(NULL, ","))
+				});
+				break;
+			case 'T':
+				tracePath = optarg;
+				break;
+			case 'I':
+				kernelIsaArg = optarg;
+				break;
+			case 'a':
+				// without a width, the vector width of the kernels,
+				// which is only known after the ISA is selected
+				alignK = optarg ? atoi(optarg) : 0;
+				break;
+			case 's':
+				if (strcmp(optarg, "dag") == 0) {
+					dagScheduler = true;
+				}
+				else if (strcmp(optarg, "barrier") == 0) {
+					dagScheduler = false;
+				}
+				else {
+					throw std::invalid_argument(
+						std::format("unknown scheduler {}", optarg)
+					);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (!gridArg || !tileArg || tileHalfTs == SIZE_MAX) {
+		printf("%s: Run and compare the naive and tiled FP32 engine.\n\n",
+			   progname);
+		printf("Usage: %s [OPTION]\n", progname);
+		printf("   --grid-size\t\t-g\ti,j,k\t\t\t(e.g: 400,400,400)\n");
+		printf("   --tile-size\t\t-t\tit/id,jt/jd,kt/kd/kp\t"
+			   "(e.g: 20t,20t,20t, 20t,20t,20p or 20d,20d,20p)\n");
+		printf("   \t\t\tid,jp,f\t\t\t(DiamondTorre, e.g: 20d,20p,f)\n");
+		printf("   \t\t\tic,jc,kc\t\t(DiamondCandy, e.g: 20c,20c,20c)\n");
+		printf("   \t\t\tir,jr,kr\t\t(recursive, e.g: 16r,16r,64r)\n");
+		printf("   --tile-height\t-h\thalfTimesteps\t\t(e.g: 18)\n");
+		printf("   --total-timesteps\t-n\ttimesteps\t\t(defafult: 100)\n");
+		printf("   --threads\t\t-j\tthreads\t\t\t(default: 1)\n");
+		printf("   --scheduler\t\t-s\tbarrier/dag\t\t(default: barrier)\n");
+		printf("   --lazy\t\t-l\tcompute plan on the fly\t(default: no)\n");
+		printf("   --flat\t\t-f\tuse compact flat plan\t(default: no)\n");
+		printf("   --plan-cache\t-c\tdirectory\t\t(default: none)\n");
+		printf("   --refine\t\t-r\ti,j,k\t\t\t(e.g: 8,8,8, repeat for "
+			   "each cache level)\n");
+		printf("   --trace\t\t-T\tChrome trace file\t(default: none)\n");
+		printf("   --isa\t\t-I\tsse4.2/avx2/avx512\t(default: best "
+			   "supported)\n");
+		printf("   --align-k[=width]\t-a\talign tile edges in k\t(default: "
+			   "no, width: vector width)\n");
+		printf("\nNote: Parallelogram tiling uses suffix \"p\", "
+			   "trapezoid tiling uses suffix \"t\", "
+			   "diamond tiling uses suffix \"d\".\n");
+		printf("Note: DiamondTorre uses diamond tiling in dimension i, "
+			   "parallelogram tiling\n      in dimension j, and column "
+			   "tiling (suffix \"f\", not tiled) in dimension k.\n");
+		printf("Note: DiamondCandy uses diamond tiling in all dimensions, "
+			   "grouped into levels\n      of candies that can run "
+			   "concurrently.\n");
+		printf("Note: Recursive tiling cuts the whole grid in space and time "
+			   "until the pieces\n      are no larger than the given base "
+			   "size, without tuning for cache size.\n");
+		std::exit(1);
+	}
+
+	if (kernelIsaArg) {
+		setKernelIsa(kernelIsaArg);
+	}
+	if (alignK == 0) {
+		alignK = kernelVectorWidth();
+	}
+
+	gridSize[0] = atoi(strtok(gridArg, ","));
+	gridSize[1] = atoi(strtok(NULL, ","));
+	gridSize[2] = atoi(strtok(NULL, ","));
+
+	std::array<std::string, 3> tileArgString;
+	tileArgString[0] = strtok(tileArg, ",");
+	tileArgString[1] = strtok(NULL, ",");
+	tileArgString[2] = strtok(NULL, ",");
+
+	for (size_t dim = 0; dim < 3; dim++) {
+		std::string& arg = tileArgString[dim];
+
+		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p' &&
+			arg[arg.size() - 1] != 'd' && arg[arg.size() - 1] != 'f' &&
+			arg[arg.size() - 1] != 'c' && arg[arg.size() - 1] != 'r'
+		) {
+			throw std::invalid_argument(
+				std::format("tile suffix must be 't', 'p', 'd', 'f', 'c' or "
+							"'r', got {}", arg[arg.size() - 1])
+			);
+		}
+
+		tileType[dim] = arg[arg.size() - 1];
+		arg[arg.size() - 1] = '\0';
+		tileSize[dim] = atoi(arg.c_str());
+	}
+
+	if (tileType[0] == 'r' || tileType[1] == 'r' || tileType[2] == 'r') {
+		if (tileType[0] != 'r' || tileType[1] != 'r' || tileType[2] != 'r') {
+			throw std::invalid_argument(
+				"recursive tiling (suffix r) must be used in all dimensions"
+			);
+		}
+	}
+	else if (tileType[1] == 'p' || tileType[2] == 'f') {
+		// DiamondTorre
+		if (tileType[0] != 'd' || tileType[1] != 'p' || tileType[2] != 'f') {
+			throw std::invalid_argument(
+				"DiamondTorre must use diamond tiling (suffix d) in "
+				"dimension i, parallelogram tiling (suffix p) in dimension "
+				"j, and column tiling (suffix f) in dimension k"
+			);
+		}
+
+		// dimension k is not tiled
+		tileSize[2] = gridSize[2];
+	}
+	else {
+		if (tileType[0] != tileType[1] ||
+			(tileType[0] != 't' && tileType[0] != 'd' && tileType[0] != 'c')
+		) {
+			throw std::invalid_argument(
+				"dimension i and j only support trapezoid (suffix t), "
+				"diamond (suffix d) or DiamondCandy (suffix c) tiling"
+			);
+		}
+		if (tileType[2] != 'p' && tileType[2] != tileType[0]) {
+			throw std::invalid_argument(
+				"dimension k must use parallelogram tiling (suffix p), or "
+				"the same tiling as dimension i and j"
+			);
+		}
+		if (tileType[0] == 'c' && tileType[2] != 'c') {
+			throw std::invalid_argument(
+				"DiamondCandy (suffix c) must be used in all dimensions"
+			);
+		}
+	}
+	if ((tileType[0] == 'd' || tileType[0] == 'c') && tileHalfTs % 4 != 0) {
+		throw std::invalid_argument(
+			"diamond tiling requires tile height to be a multiple of 4"
+		);
+	}
+	if (lazyPlan && flatPlan) {
+		throw std::invalid_argument("a plan can't be both lazy and flat");
+	}
+	if (lazyPlan && tileType[0] == 'r') {
+		throw std::invalid_argument("recursive tiling has no lazy plan");
+	}
+	if (lazyPlan && !innerTileSizes.empty()) {
+		throw std::invalid_argument("lazy plans can't be refined");
+	}
+	if (lazyPlan && !planCacheDir.empty()) {
+		throw std::invalid_argument("lazy plans can't be cached");
+	}
+	if (lazyPlan && dagScheduler) {
+		throw std::invalid_argument(
+			"lazy plans only support the barrier scheduler"
+		);
+	}
+	if (numThreads == 0) {
+		throw std::invalid_argument("threads must be at least 1");
+	}
+}
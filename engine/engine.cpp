@@ -0,0 +1,830 @@
+// BSD Zero Clause License
+// 
+// Copyright (C) 2024 Yifeng Li
+// 
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <stdexcept>
+#include <format>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <tuple>
+
+#include "engine.hpp"
+#include "kernel.hpp"
+using namespace Tiling;
+
+Engine::Fields::Fields(std::array<size_t, 3> size) :
+	size(size),
+	volt(size), curr(size),
+	vv(size), vi(size), ii(size), iv(size)
+{
+}
+
+void
+Engine::Fields::copyFrom(const Fields& src)
+{
+	if (src.size != size) {
+		throw std::invalid_argument("field sizes must be identical.");
+	}
+
+	std::copy(src.volt.data(), src.volt.data() + src.volt.elems(), volt.data());
+	std::copy(src.curr.data(), src.curr.data() + src.curr.elems(), curr.data());
+	std::copy(src.vv.data(),   src.vv.data()   + src.vv.elems(),   vv.data());
+	std::copy(src.vi.data(),   src.vi.data()   + src.vi.elems(),   vi.data());
+	std::copy(src.ii.data(),   src.ii.data()   + src.ii.elems(),   ii.data());
+	std::copy(src.iv.data(),   src.iv.data()   + src.iv.elems(),   iv.data());
+}
+
+// How the 1D plans are combined into a 3D plan.
+enum class Combination
+{
+	TTT, TTP, DDD, DDP, DiamondTorre, DiamondCandy
+};
+
+// Build the 1D plans of all dimensions, using the same combination of
+// plan generators as the sanity and verify tools. The plans are owned
+// by the cache. Only the tile edges in dimension k are aligned, since
+// it's the only one vectorized by the kernels.
+static Combination
+make1DPlans(
+	std::array<size_t, 3> gridSize,
+	std::array<size_t, 3> tileSize,
+	std::array<char, 3>   tileType,
+	size_t tileHalfTs,
+	size_t alignK,
+	PlanCache& cache,
+	const Plan1D*& i, const Plan1D*& j, const Plan1D*& k
+)
+{
+	if (tileType[2] == 'f') {
+		// DiamondTorre, the remainder batch may be too short for diamond
+		// tiling, in this case, fall back to trapezoid tiling.
+		if (tileHalfTs % 4 == 0) {
+			i = &cache.plan1D('d', gridSize[0], tileSize[0], tileHalfTs);
+		}
+		else {
+			i = &cache.plan1D('t', gridSize[0], tileSize[0], tileHalfTs);
+		}
+		j = &cache.plan1D('p', gridSize[1], tileSize[1], tileHalfTs);
+		k = &cache.plan1D('f', gridSize[2], tileSize[2], tileHalfTs);
+		return Combination::DiamondTorre;
+	}
+
+	if ((tileType[0] == 'd' || tileType[0] == 'c') && tileHalfTs % 4 == 0) {
+		i = &cache.plan1D('d', gridSize[0], tileSize[0], tileHalfTs);
+		j = &cache.plan1D('d', gridSize[1], tileSize[1], tileHalfTs);
+
+		if (tileType[2] == 'p') {
+			k = &cache.plan1D(
+				'p', gridSize[2], tileSize[2], tileHalfTs, alignK
+			);
+			return Combination::DDP;
+		}
+
+		k = &cache.plan1D(
+			'd', gridSize[2], tileSize[2], tileHalfTs, alignK
+		);
+		if (tileType[0] == 'c') {
+			return Combination::DiamondCandy;
+		}
+		return Combination::DDD;
+	}
+
+	// The remainder batch may be too short for diamond tiling, in this
+	// case, fall back to trapezoid tiling.
+	i = &cache.plan1D('t', gridSize[0], tileSize[0], tileHalfTs);
+	j = &cache.plan1D('t', gridSize[1], tileSize[1], tileHalfTs);
+
+	if (tileType[2] == 'p') {
+		k = &cache.plan1D(
+			'p', gridSize[2], tileSize[2], tileHalfTs, alignK
+		);
+		return Combination::TTP;
+	}
+	else if (tileType[2] == 't' || tileType[2] == 'd' || tileType[2] == 'c') {
+		k = &cache.plan1D(
+			't', gridSize[2], tileSize[2], tileHalfTs, alignK
+		);
+		return Combination::TTT;
+	}
+	else {
+		throw std::invalid_argument(
+			std::format("tile suffix must be 't' or 'p', got {}",
+						tileType[2])
+		);
+	}
+}
+
+static Plan3D
+buildPlan(
+	std::array<size_t, 3> gridSize,
+	std::array<size_t, 3> tileSize,
+	std::array<char, 3>   tileType,
+	size_t tileHalfTs,
+	size_t alignK,
+	PlanCache& cache,
+	size_t numThreads
+)
+{
+	if (tileType[0] == 'r') {
+		return computeRecursiveTiles(gridSize, tileSize, tileHalfTs);
+	}
+
+	const Plan1D *i, *j, *k;
+	Combination combination = make1DPlans(
+		gridSize, tileSize, tileType, tileHalfTs, alignK, cache, i, j, k
+	);
+
+	switch (combination) {
+	case Combination::TTT:
+		return combineTilesTTT(*i, *j, *k, numThreads);
+	case Combination::TTP:
+		return combineTilesTTP(*i, *j, *k, numThreads);
+	case Combination::DDD:
+		return combineTilesDDD(*i, *j, *k);
+	case Combination::DDP:
+		return combineTilesDDP(*i, *j, *k);
+	case Combination::DiamondTorre:
+		return combineTilesDiamondTorre(*i, *j, *k);
+	case Combination::DiamondCandy:
+		return combineTilesDiamondCandy(*i, *j, *k);
+	}
+	throw std::invalid_argument("unknown tile combination");
+}
+
+Plan3D
+Engine::makePlan(
+	std::array<size_t, 3> gridSize,
+	std::array<size_t, 3> tileSize,
+	std::array<char, 3>   tileType,
+	size_t tileHalfTs,
+	size_t numThreads,
+	size_t alignK
+)
+{
+	PlanCache cache;
+	return buildPlan(
+		gridSize, tileSize, tileType, tileHalfTs, alignK, cache, numThreads
+	);
+}
+
+const Plan3D&
+Engine::makePlan(
+	std::array<size_t, 3> gridSize,
+	std::array<size_t, 3> tileSize,
+	std::array<char, 3>   tileType,
+	size_t tileHalfTs,
+	PlanCache& cache,
+	size_t numThreads,
+	const std::vector<std::array<size_t, 3>>& innerTileSizes,
+	size_t alignK
+)
+{
+	return cache.plan3D(
+		gridSize, tileSize, tileType, tileHalfTs,
+		[&]() {
+			Plan3D plan = buildPlan(
+				gridSize, tileSize, tileType, tileHalfTs, alignK,
+				cache, numThreads
+			);
+			return refineTiles(std::move(plan), innerTileSizes);
+		},
+		innerTileSizes, alignK
+	);
+}
+
+const FlatPlan3D&
+Engine::makeFlatPlan(
+	std::array<size_t, 3> gridSize,
+	std::array<size_t, 3> tileSize,
+	std::array<char, 3>   tileType,
+	size_t tileHalfTs,
+	PlanCache& cache,
+	size_t numThreads,
+	const std::vector<std::array<size_t, 3>>& innerTileSizes,
+	size_t alignK
+)
+{
+	return cache.flatPlan3D(
+		gridSize, tileSize, tileType, tileHalfTs,
+		[&]() {
+			Plan3D plan = buildPlan(
+				gridSize, tileSize, tileType, tileHalfTs, alignK,
+				cache, numThreads
+			);
+			return refineTiles(std::move(plan), innerTileSizes);
+		},
+		innerTileSizes, alignK
+	);
+}
+
+LazyPlan3D
+Engine::makeLazyPlan(
+	std::array<size_t, 3> gridSize,
+	std::array<size_t, 3> tileSize,
+	std::array<char, 3>   tileType,
+	size_t tileHalfTs,
+	size_t alignK
+)
+{
+	if (tileType[0] == 'r') {
+		throw std::invalid_argument("recursive tiling has no lazy plan");
+	}
+
+	PlanCache cache;
+	const Plan1D *i, *j, *k;
+	Combination combination = make1DPlans(
+		gridSize, tileSize, tileType, tileHalfTs, alignK, cache, i, j, k
+	);
+
+	switch (combination) {
+	case Combination::TTT:
+	case Combination::DDD:
+		return LazyPlan3D(*i, *j, *k, 3);
+	case Combination::TTP:
+	case Combination::DDP:
+		return LazyPlan3D(*i, *j, *k, 2);
+	case Combination::DiamondTorre:
+		return LazyPlan3D(*i, *j, *k, 1);
+	case Combination::DiamondCandy:
+		return LazyPlan3D(*i, *j, *k, 3, true);
+	}
+	throw std::invalid_argument("unknown tile combination");
+}
+
+template <typename Plan>
+static double
+maskedFractionOf(const Plan& plan)
+{
+	size_t cells = 0, maskedCells = 0;
+
+	for (const auto& tileList : plan) {
+		for (const auto& tile : tileList) {
+			for (const auto& subtile : tile) {
+				for (size_t halfTs = 0; halfTs < subtile.size(); halfTs++) {
+					const Range3D<size_t>& range = subtile[halfTs];
+					if (range.empty()) {
+						continue;
+					}
+
+					size_t rows =
+						(range.last[0] - range.first[0] + 1) *
+						(range.last[1] - range.first[1] + 1);
+
+					cells += rows * (range.last[2] - range.first[2] + 1);
+					maskedCells += rows * kernelMaskedCells(
+						range.first[2], range.last[2]
+					);
+				}
+			}
+		}
+	}
+
+	if (cells == 0) {
+		return 0;
+	}
+	return (double) maskedCells / cells;
+}
+
+double
+Engine::maskedFraction(const Plan3D& plan)
+{
+	return maskedFractionOf(plan);
+}
+
+double
+Engine::maskedFraction(const LazyPlan3D& plan)
+{
+	return maskedFractionOf(plan);
+}
+
+double
+Engine::maskedFraction(const FlatPlan3D& plan)
+{
+	return maskedFractionOf(plan);
+}
+
+void
+Engine::naive(Fields& fields, size_t timesteps)
+{
+	std::array<size_t, 3> rangeFirst = {0, 0, 0};
+
+	std::array<size_t, 3> voltRangeLast = {
+		fields.size[0] - 1, fields.size[1] - 1, fields.size[2] - 1
+	};
+
+	std::array<size_t, 3> currRangeLast = {
+		fields.size[0] - 2, fields.size[1] - 2, fields.size[2] - 2
+	};
+
+	for (size_t t = 0; t < timesteps; t++) {
+		updateVoltageRange(
+			fields.volt, fields.curr, fields.vv, fields.vi,
+			rangeFirst, voltRangeLast
+		);
+
+		updateCurrentRange(
+			fields.curr, fields.volt, fields.ii, fields.iv,
+			rangeFirst, currRangeLast
+		);
+	}
+}
+
+// Set by Engine::setProfiler() and Engine::setTracer(), NULL if disabled.
+static Engine::Profiler* profiler = NULL;
+static Engine::Tracer* tracer = NULL;
+
+void
+Engine::setProfiler(Profiler* newProfiler)
+{
+	profiler = newProfiler;
+}
+
+void
+Engine::setTracer(Tracer* newTracer)
+{
+	tracer = newTracer;
+}
+
+// Marks a batch, or a range of batches run by the dependency-driven
+// scheduler, in the tracer during its lifetime.
+struct TracedBatch
+{
+	TracedBatch(size_t first, size_t count = 1)
+	{
+		if (tracer) {
+			tracer->beginBatch(first, count);
+		}
+	}
+
+	~TracedBatch()
+	{
+		if (tracer) {
+			tracer->endBatch();
+		}
+	}
+};
+
+// All overloads of Engine::tiled() share these, so batch tracing and the
+// remainder are handled in one place. Plan is a Plan3D, LazyPlan3D or
+// FlatPlan3D, without a pool the batches run on the calling thread.
+template <typename Plan>
+static void
+runBatches(
+	const Plan& mainPlan, size_t numBatches, const Plan& remPlan,
+	Engine::Fields& fields, ThreadPool* pool
+)
+{
+	auto runBody = [&](const Plan& plan) {
+		if (pool) {
+			Engine::tiledBody(plan, fields, *pool);
+		}
+		else {
+			Engine::tiledBody(plan, fields);
+		}
+	};
+
+	for (size_t batchId = 0; batchId < numBatches; batchId++) {
+		TracedBatch batch(batchId);
+		runBody(mainPlan);
+	}
+	TracedBatch batch(numBatches);
+	runBody(remPlan);
+}
+
+template <typename Plan>
+static void runGraph(
+	const Plan& plan, const TileGraph3D& graph,
+	size_t numBatches,
+	Engine::Fields& fields, ThreadPool& pool
+);
+
+// The main batches are a single traced range, since the dependency-driven
+// scheduler overlaps them.
+template <typename Plan>
+static void
+runGraphBatches(
+	const Plan& mainPlan, const TileGraph3D& mainGraph, size_t numBatches,
+	const Plan& remPlan, const TileGraph3D& remGraph,
+	Engine::Fields& fields, ThreadPool& pool
+)
+{
+	{
+		TracedBatch batches(0, numBatches);
+		runGraph(mainPlan, mainGraph, numBatches, fields, pool);
+	}
+	TracedBatch batch(numBatches);
+	runGraph(remPlan, remGraph, 1, fields, pool);
+}
+
+void
+Engine::tiled(
+	Fields& fields,
+	const Plan3D& mainPlan, size_t numBatches,
+	const Plan3D& remPlan
+)
+{
+	runBatches(mainPlan, numBatches, remPlan, fields, NULL);
+}
+
+void
+Engine::tiled(
+	Fields& fields,
+	const Plan3D& mainPlan, size_t numBatches,
+	const Plan3D& remPlan,
+	ThreadPool& pool
+)
+{
+	runBatches(mainPlan, numBatches, remPlan, fields, &pool);
+}
+
+void
+Engine::tiled(
+	Fields& fields,
+	const LazyPlan3D& mainPlan, size_t numBatches,
+	const LazyPlan3D& remPlan
+)
+{
+	runBatches(mainPlan, numBatches, remPlan, fields, NULL);
+}
+
+void
+Engine::tiled(
+	Fields& fields,
+	const LazyPlan3D& mainPlan, size_t numBatches,
+	const LazyPlan3D& remPlan,
+	ThreadPool& pool
+)
+{
+	runBatches(mainPlan, numBatches, remPlan, fields, &pool);
+}
+
+void
+Engine::tiled(
+	Fields& fields,
+	const Plan3D& mainPlan, const TileGraph3D& mainGraph,
+	size_t numBatches,
+	const Plan3D& remPlan, const TileGraph3D& remGraph,
+	ThreadPool& pool
+)
+{
+	runGraphBatches(
+		mainPlan, mainGraph, numBatches, remPlan, remGraph, fields, pool
+	);
+}
+
+void
+Engine::tiled(
+	Fields& fields,
+	const FlatPlan3D& mainPlan, size_t numBatches,
+	const FlatPlan3D& remPlan
+)
+{
+	runBatches(mainPlan, numBatches, remPlan, fields, NULL);
+}
+
+void
+Engine::tiled(
+	Fields& fields,
+	const FlatPlan3D& mainPlan, size_t numBatches,
+	const FlatPlan3D& remPlan,
+	ThreadPool& pool
+)
+{
+	runBatches(mainPlan, numBatches, remPlan, fields, &pool);
+}
+
+void
+Engine::tiled(
+	Fields& fields,
+	const FlatPlan3D& mainPlan, const TileGraph3D& mainGraph,
+	size_t numBatches,
+	const FlatPlan3D& remPlan, const TileGraph3D& remGraph,
+	ThreadPool& pool
+)
+{
+	runGraphBatches(
+		mainPlan, mainGraph, numBatches, remPlan, remGraph, fields, pool
+	);
+}
+
+// Subtile is a Subtile3D, LazySubtile3D or FlatSubtile3D, the ranges of
+// the latter two are decoded on the fly and returned by value.
+template <typename Subtile>
+static void
+runSubtile(const Subtile& subtile, Engine::Fields& fields)
+{
+	for (size_t halfTs = 0; halfTs < subtile.size(); halfTs += 2) {
+		const Range3D<size_t>& voltRange = subtile[halfTs];
+		const Range3D<size_t>& currRange = subtile[halfTs + 1];
+
+		updateVoltageRange(
+			fields.volt, fields.curr, fields.vv, fields.vi,
+			voltRange.first, voltRange.last
+		);
+
+		updateCurrentRange(
+			fields.curr, fields.volt, fields.ii, fields.iv,
+			currRange.first, currRange.last
+		);
+	}
+}
+
+// Bounding box size and cell updates of a subtile, only computed when
+// the profiler is enabled.
+template <typename Subtile>
+static std::pair<std::array<size_t, 3>, size_t>
+shapeOf(const Subtile& subtile)
+{
+	std::array<size_t, 3> first = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
+	std::array<size_t, 3> last = {0, 0, 0};
+	size_t cells = 0;
+
+	for (size_t halfTs = 0; halfTs < subtile.size(); halfTs++) {
+		const Range3D<size_t>& range = subtile[halfTs];
+		if (range.empty()) {
+			continue;
+		}
+
+		size_t rangeCells = 1;
+		for (size_t n = 0; n < 3; n++) {
+			first[n] = std::min(first[n], range.first[n]);
+			last[n] = std::max(last[n], range.last[n]);
+			rangeCells *= range.last[n] - range.first[n] + 1;
+		}
+		cells += rangeCells;
+	}
+
+	std::array<size_t, 3> shape = {0, 0, 0};
+	if (cells > 0) {
+		for (size_t n = 0; n < 3; n++) {
+			shape[n] = last[n] - first[n] + 1;
+		}
+	}
+	return {shape, cells};
+}
+
+// Tile is a Tile3D, LazyTile3D or FlatTile3D. The tile is the idx-th
+// tile of the stage, threadId is the slot of the executing thread in
+// the profiler and tracer, and batch is relative to the current batch
+// of the tracer. If both are disabled, the only overhead is the check
+// of the pointers once per tile.
+template <typename Tile>
+static void
+runTile(
+	const Tile& tile, size_t stage, size_t idx,
+	Engine::Fields& fields, size_t threadId = 0, size_t batch = 0
+)
+{
+	if (profiler == NULL && tracer == NULL) {
+		for (const auto& subtile : tile) {
+			runSubtile(subtile, fields);
+		}
+		return;
+	}
+
+	uint64_t start = tracer ? tracer->now() : 0;
+	if (profiler) {
+		profiler->beginTile(threadId, stage, idx, tile.id());
+	}
+
+	for (const auto& subtile : tile) {
+		runSubtile(subtile, fields);
+
+		if (profiler) {
+			auto [shape, cells] = shapeOf(subtile);
+			profiler->endSubtile(threadId, shape, cells);
+		}
+	}
+
+	if (tracer) {
+		tracer->tile(
+			threadId, batch, stage, idx, tile.id(), start, tracer->now()
+		);
+	}
+}
+
+template <typename Plan>
+static void
+runPlan(const Plan& plan, Engine::Fields& fields)
+{
+	if (profiler) {
+		profiler->beginPlan(&plan);
+	}
+
+	size_t stage = 0;
+	for (const auto& tileList : plan) {
+		uint64_t start = tracer ? tracer->now() : 0;
+		for (size_t idx = 0; idx < tileList.size(); idx++) {
+			runTile(tileList[idx], stage, idx, fields);
+		}
+		if (tracer) {
+			tracer->stage(stage, start, tracer->now());
+		}
+		stage++;
+	}
+}
+
+template <typename Plan>
+static void
+runPlan(const Plan& plan, Engine::Fields& fields, ThreadPool& pool)
+{
+	if (profiler) {
+		profiler->beginPlan(&plan);
+	}
+
+	size_t stage = 0;
+	for (const auto& tileList : plan) {
+		uint64_t start = tracer ? tracer->now() : 0;
+
+		// parallelFor() returns only after all tiles are done, which
+		// is the barrier between two stages.
+		pool.parallelFor(tileList.size(), [&](size_t idx, size_t threadId) {
+			runTile(tileList[idx], stage, idx, fields, threadId);
+		});
+
+		if (tracer) {
+			tracer->stage(stage, start, tracer->now());
+		}
+		stage++;
+	}
+}
+
+void
+Engine::tiledBody(const Plan3D& plan, Fields& fields)
+{
+	runPlan(plan, fields);
+}
+
+void
+Engine::tiledBody(const Plan3D& plan, Fields& fields, ThreadPool& pool)
+{
+	runPlan(plan, fields, pool);
+}
+
+void
+Engine::tiledBody(const LazyPlan3D& plan, Fields& fields)
+{
+	runPlan(plan, fields);
+}
+
+void
+Engine::tiledBody(const LazyPlan3D& plan, Fields& fields, ThreadPool& pool)
+{
+	runPlan(plan, fields, pool);
+}
+
+void
+Engine::tiledBody(const FlatPlan3D& plan, Fields& fields)
+{
+	runPlan(plan, fields);
+}
+
+void
+Engine::tiledBody(const FlatPlan3D& plan, Fields& fields, ThreadPool& pool)
+{
+	runPlan(plan, fields, pool);
+}
+
+void
+Engine::tiledBody(
+	const Plan3D& plan, const TileGraph3D& graph,
+	Fields& fields, ThreadPool& pool
+)
+{
+	runGraph(plan, graph, 1, fields, pool);
+}
+
+void
+Engine::tiledBody(
+	const FlatPlan3D& plan, const TileGraph3D& graph,
+	Fields& fields, ThreadPool& pool
+)
+{
+	runGraph(plan, graph, 1, fields, pool);
+}
+
+// Execute the same plan numBatches times as one big dependency graph.
+// Node (batch, n) depends on its predecessors within the batch, and on
+// all neighbors of node n in the previous batch.
+template <typename Plan>
+static void
+runGraph(
+	const Plan& plan, const TileGraph3D& graph,
+	size_t numBatches,
+	Engine::Fields& fields, ThreadPool& pool
+)
+{
+	const size_t numNodes = graph.size();
+	const size_t totalNodes = numNodes * numBatches;
+	if (totalNodes == 0) {
+		return;
+	}
+	if (profiler) {
+		profiler->beginPlan(&plan);
+	}
+
+	size_t batchPriority = 0;
+	for (const TileNode3D& node : graph) {
+		batchPriority = std::max(batchPriority, node.priority);
+	}
+
+	// (priority, batch, node), the highest priority is popped first.
+	// Earlier batches are always more critical than later ones.
+	using ReadyTile = std::tuple<size_t, size_t, size_t>;
+	std::priority_queue<ReadyTile> readyQueue;
+
+	auto pushReady = [&](size_t batch, size_t nodeIdx) {
+		size_t priority = graph[nodeIdx].priority;
+		priority += (numBatches - 1 - batch) * batchPriority;
+		readyQueue.push({priority, batch, nodeIdx});
+	};
+
+	std::vector<size_t> remaining(totalNodes);
+	for (size_t batch = 0; batch < numBatches; batch++) {
+		for (size_t nodeIdx = 0; nodeIdx < numNodes; nodeIdx++) {
+			const TileNode3D& node = graph[nodeIdx];
+
+			remaining[batch * numNodes + nodeIdx] = node.numPredecessors;
+			if (batch > 0) {
+				remaining[batch * numNodes + nodeIdx] += node.neighbors.size();
+			}
+
+			if (remaining[batch * numNodes + nodeIdx] == 0) {
+				pushReady(batch, nodeIdx);
+			}
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	size_t finished = 0;
+
+	// If a tile throws, its successors never become ready, so the other
+	// threads must stop waiting. The pool rethrows the exception.
+	bool failed = false;
+
+	auto release = [&](size_t batch, size_t nodeIdx) {
+		if (--remaining[batch * numNodes + nodeIdx] == 0) {
+			pushReady(batch, nodeIdx);
+			cond.notify_one();
+		}
+	};
+
+	pool.parallelFor(pool.size(), [&](size_t, size_t threadId) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (true) {
+			cond.wait(lock, [&] {
+				return !readyQueue.empty() || finished == totalNodes || failed;
+			});
+			if (readyQueue.empty() || failed) {
+				break;
+			}
+
+			auto [priority, batch, nodeIdx] = readyQueue.top();
+			readyQueue.pop();
+			const TileNode3D& node = graph[nodeIdx];
+
+			lock.unlock();
+			try {
+				runTile(
+					plan[node.stage][node.tile], node.stage, node.tile,
+					fields, threadId, batch
+				);
+			}
+			catch (...) {
+				lock.lock();
+				failed = true;
+				cond.notify_all();
+				throw;
+			}
+			lock.lock();
+
+			for (size_t successorIdx : node.successors) {
+				release(batch, successorIdx);
+			}
+			if (batch + 1 < numBatches) {
+				for (size_t neighborIdx : node.neighbors) {
+					release(batch + 1, neighborIdx);
+				}
+			}
+
+			finished++;
+			if (finished == totalNodes) {
+				cond.notify_all();
+			}
+		}
+	});
+}
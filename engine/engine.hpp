@@ -0,0 +1,216 @@
+// BSD Zero Clause License
+// 
+// Copyright (C) 2024 Yifeng Li
+// 
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef ENGINE_HPP
+#define ENGINE_HPP
+
+#include <array>
+#include "narray3d.hpp"
+#include "threadpool.hpp"
+#include "profiler.hpp"
+#include "tracer.hpp"
+#include "tiling.hpp"
+#include "plancache.hpp"
+
+namespace Engine {
+	using size_t = std::size_t;
+	using Tiling::Plan3D;
+	using Tiling::LazyPlan3D;
+	using Tiling::FlatPlan3D;
+	using Tiling::TileGraph3D;
+	using Tiling::PlanCache;
+
+	// All field and operator arrays of a single FP32 simulation.
+	struct Fields
+	{
+	public:
+		Fields(std::array<size_t, 3> size);
+		void copyFrom(const Fields& src);
+
+		const std::array<size_t, 3> size;
+
+		// field arrays
+		NArray3D<float> volt, curr;
+
+		// operator arrays, expected to be read-only
+		NArray3D<float> vv, vi, ii, iv;
+	};
+
+	// Build the tiling plan for tileHalfTs half timesteps, using the
+	// same combination of plan generators as the sanity and verify tools.
+	// Trapezoid plans are built on up to numThreads threads, the result
+	// is identical regardless of the number of threads. With alignK > 1,
+	// the tile edges in dimension k are aligned to alignK cells at least
+	// once per batch, see computeParallelogramTiles(), so the kernels use
+	// fewer masked vectors. It's ignored by recursive tiling.
+	Plan3D makePlan(
+		std::array<size_t, 3> gridSize,
+		std::array<size_t, 3> tileSize,
+		std::array<char, 3>   tileType,
+		size_t tileHalfTs,
+		size_t numThreads = 1,
+		size_t alignK = 1
+	);
+
+	// Same as above, but the plan is memoized in the cache (and its
+	// directory, if any), and owned by it. If innerTileSizes is given,
+	// the plan is refined into smaller subtiles by refineTiles().
+	const Plan3D& makePlan(
+		std::array<size_t, 3> gridSize,
+		std::array<size_t, 3> tileSize,
+		std::array<char, 3>   tileType,
+		size_t tileHalfTs,
+		PlanCache& cache,
+		size_t numThreads = 1,
+		const std::vector<std::array<size_t, 3>>& innerTileSizes = {},
+		size_t alignK = 1
+	);
+
+	// Same as above, but the plan is flat. When it's loaded from the
+	// cache directory, it's used directly in the memory-mapped file.
+	const FlatPlan3D& makeFlatPlan(
+		std::array<size_t, 3> gridSize,
+		std::array<size_t, 3> tileSize,
+		std::array<char, 3>   tileType,
+		size_t tileHalfTs,
+		PlanCache& cache,
+		size_t numThreads = 1,
+		const std::vector<std::array<size_t, 3>>& innerTileSizes = {},
+		size_t alignK = 1
+	);
+
+	// Same as the first one, but the plan is a lazy view of the 1D plans,
+	// which is much cheaper to build and store for large grids.
+	LazyPlan3D makeLazyPlan(
+		std::array<size_t, 3> gridSize,
+		std::array<size_t, 3> tileSize,
+		std::array<char, 3>   tileType,
+		size_t tileHalfTs,
+		size_t alignK = 1
+	);
+
+	// Fraction of the cell updates of a plan done by masked partial
+	// vectors rather than full ones, i.e. the cells of each row before the
+	// first and after the last multiple of kernelMinVectorWidth in k.
+	double maskedFraction(const Plan3D& plan);
+	double maskedFraction(const LazyPlan3D& plan);
+	double maskedFraction(const FlatPlan3D& plan);
+
+	// Textbook FDTD, one full timestep in the entire 3D space at a time.
+	void naive(Fields& fields, size_t timesteps);
+
+	// Time-skewed FDTD, the main plan is applied numBatches times, then
+	// the remainder plan is applied once (skipped if it's empty).
+	void tiled(
+		Fields& fields,
+		const Plan3D& mainPlan, size_t numBatches,
+		const Plan3D& remPlan
+	);
+
+	// Same as above, but the tiles of each stage run on a thread pool.
+	void tiled(
+		Fields& fields,
+		const Plan3D& mainPlan, size_t numBatches,
+		const Plan3D& remPlan,
+		ThreadPool& pool
+	);
+
+	// Same as the two above, but the plans are lazy.
+	void tiled(
+		Fields& fields,
+		const LazyPlan3D& mainPlan, size_t numBatches,
+		const LazyPlan3D& remPlan
+	);
+
+	void tiled(
+		Fields& fields,
+		const LazyPlan3D& mainPlan, size_t numBatches,
+		const LazyPlan3D& remPlan,
+		ThreadPool& pool
+	);
+
+	// Same as the thread pool version, but without stage barriers. Each
+	// tile is started as soon as the tiles it depends on are finished,
+	// including the tiles from the previous batch, and ready tiles on the
+	// critical path are preferred. The graphs come from computeTileGraph().
+	void tiled(
+		Fields& fields,
+		const Plan3D& mainPlan, const TileGraph3D& mainGraph,
+		size_t numBatches,
+		const Plan3D& remPlan, const TileGraph3D& remGraph,
+		ThreadPool& pool
+	);
+
+	// Same as the Plan3D versions above, but the plans are flat.
+	void tiled(
+		Fields& fields,
+		const FlatPlan3D& mainPlan, size_t numBatches,
+		const FlatPlan3D& remPlan
+	);
+
+	void tiled(
+		Fields& fields,
+		const FlatPlan3D& mainPlan, size_t numBatches,
+		const FlatPlan3D& remPlan,
+		ThreadPool& pool
+	);
+
+	void tiled(
+		Fields& fields,
+		const FlatPlan3D& mainPlan, const TileGraph3D& mainGraph,
+		size_t numBatches,
+		const FlatPlan3D& remPlan, const TileGraph3D& remGraph,
+		ThreadPool& pool
+	);
+
+	// Record the hardware counters of every subtile executed by tiled()
+	// and tiledBody() into the profiler, until it's set to NULL. The
+	// profiler needs a slot for each thread of the pool.
+	void setProfiler(Profiler* profiler);
+
+	// Record the timeline of every tile, stage and batch executed by
+	// tiled() and tiledBody() into the tracer, until it's set to NULL.
+	// The tracer needs a slot for each thread of the pool.
+	void setTracer(Tracer* tracer);
+
+	// Apply a plan once, all stages and tiles are executed in serial.
+	void tiledBody(const Plan3D& plan, Fields& fields);
+
+	// Apply a plan once. All tiles within a stage are independent, so
+	// they're executed in parallel on the thread pool, with a barrier
+	// between two stages.
+	void tiledBody(const Plan3D& plan, Fields& fields, ThreadPool& pool);
+
+	// Same as the two above, but the plan is lazy.
+	void tiledBody(const LazyPlan3D& plan, Fields& fields);
+	void tiledBody(const LazyPlan3D& plan, Fields& fields, ThreadPool& pool);
+
+	// Same as the Plan3D versions above, but the plan is flat.
+	void tiledBody(const FlatPlan3D& plan, Fields& fields);
+	void tiledBody(const FlatPlan3D& plan, Fields& fields, ThreadPool& pool);
+
+	// Apply a plan once, tiles are scheduled by their dependencies.
+	void tiledBody(
+		const Plan3D& plan, const TileGraph3D& graph,
+		Fields& fields, ThreadPool& pool
+	);
+
+	void tiledBody(
+		const FlatPlan3D& plan, const TileGraph3D& graph,
+		Fields& fields, ThreadPool& pool
+	);
+}
+
+#endif  // ENGINE_HPP
@@ -0,0 +1,402 @@
+#include <algorithm>
+#include "kernel-simd.hpp"
+#include "simd.hpp"
+
+// FP32 counterpart of verify/kernel-simd.cpp, the arithmetic is kept
+// in the exact same order as verify/kernel-scalar.cpp, so the symbolic
+// verification still applies, and each lane is bit-exact with it.
+//
+// This file is compiled once per ISA level, see kernel-simd.hpp. Only
+// the KernelTable has external linkage, the kernels are static and the
+// helpers of simd.hpp are in an anonymous namespace, otherwise the linker
+// may pick a copy built for an ISA the CPU doesn't support. The only
+// shared symbols left are the scalar accessors of NArray3D and std::array
+// when they're not inlined, which don't use any ISA extension.
+
+#ifndef KERNEL_TABLE
+#error "KERNEL_TABLE and KERNEL_ISA must be defined, see the Makefile."
+#endif
+
+// The k - 1 neighbors are the misaligned loads of the verified kernel,
+// done as a lane shift of the current and previous vectors. At k = 0,
+// the first vector is its own previous vector, like prev_k in the scalar
+// kernel.
+//
+// If masked, [begin_k, end_k) is only a part of a single vector, which is
+// computed as a whole, but only the lanes in the range are stored.
+template <size_t veclen, bool boundary, bool masked = false>
+inline static void updateVoltageVectorKernel(
+	const NArray3D<float>& volt,
+	const NArray3D<float>& curr,
+	const NArray3D<float>& vv,
+	const NArray3D<float>& vi,
+	size_t i, size_t j,
+	size_t begin_k, size_t end_k
+)
+{
+	using Vec = Simd<float, veclen>;
+
+	size_t pi = i > 0 ? i - 1 : 0;
+	size_t pj = j > 0 ? j - 1 : 0;
+
+	size_t begin_lane = begin_k % veclen;
+	size_t end_lane = end_k - (begin_k - begin_lane);
+	if constexpr (masked) {
+		begin_k -= begin_lane;
+	}
+
+	for (size_t k = begin_k; k < end_k; k += veclen) {
+		// 3 x veclen FP32 loads
+		Vec volt0_ci_cj_ck = Vec::load(&volt(i, j, k, 0));
+		Vec volt1_ci_cj_ck = Vec::load(&volt(i, j, k, 1));
+		Vec volt2_ci_cj_ck = Vec::load(&volt(i, j, k, 2));
+
+		// 3 x veclen FP32 loads
+		Vec curr0_ci_cj_ck = Vec::load(&curr(i, j, k, 0));
+		Vec curr1_ci_cj_ck = Vec::load(&curr(i, j, k, 1));
+		Vec curr2_ci_cj_ck = Vec::load(&curr(i, j, k, 2));
+
+		// 4 x veclen FP32 loads
+		Vec curr0_ci_pj_ck = Vec::load(&curr(i,  pj, k, 0));
+		Vec curr2_ci_pj_ck = Vec::load(&curr(i,  pj, k, 2));
+		Vec curr1_pi_cj_ck = Vec::load(&curr(pi, j,  k, 1));
+		Vec curr2_pi_cj_ck = Vec::load(&curr(pi, j,  k, 2));
+
+		// 2 misaligned FP32 loads, as lane shifts
+		Vec curr0_ci_cj_pk, curr1_ci_cj_pk;
+		if constexpr (boundary) {
+			curr0_ci_cj_pk = shiftPrevBoundary(curr0_ci_cj_ck);
+			curr1_ci_cj_pk = shiftPrevBoundary(curr1_ci_cj_ck);
+		}
+		else {
+			curr0_ci_cj_pk = shiftPrev(
+				Vec::load(&curr(i, j, k - veclen, 0)), curr0_ci_cj_ck
+			);
+			curr1_ci_cj_pk = shiftPrev(
+				Vec::load(&curr(i, j, k - veclen, 1)), curr1_ci_cj_ck
+			);
+		}
+
+		// 6 x veclen FP32 loads
+		Vec vv0_ci_cj_ck = Vec::load(&vv(i, j, k, 0));
+		Vec vv1_ci_cj_ck = Vec::load(&vv(i, j, k, 1));
+		Vec vv2_ci_cj_ck = Vec::load(&vv(i, j, k, 2));
+		Vec vi0_ci_cj_ck = Vec::load(&vi(i, j, k, 0));
+		Vec vi1_ci_cj_ck = Vec::load(&vi(i, j, k, 1));
+		Vec vi2_ci_cj_ck = Vec::load(&vi(i, j, k, 2));
+
+		// x-polarization
+		volt0_ci_cj_ck *= vv0_ci_cj_ck;
+		volt0_ci_cj_ck +=
+			vi0_ci_cj_ck * (
+				curr2_ci_cj_ck -
+				curr2_ci_pj_ck -
+				curr1_ci_cj_ck +
+				curr1_ci_cj_pk
+			);
+
+		// y-polarization
+		volt1_ci_cj_ck *= vv1_ci_cj_ck;
+		volt1_ci_cj_ck +=
+			vi1_ci_cj_ck * (
+				curr0_ci_cj_ck -
+				curr0_ci_cj_pk -
+				curr2_ci_cj_ck +
+				curr2_pi_cj_ck
+			);
+
+		// z-polarization
+		volt2_ci_cj_ck *= vv2_ci_cj_ck;
+		volt2_ci_cj_ck +=
+			vi2_ci_cj_ck * (
+				curr1_ci_cj_ck -
+				curr1_pi_cj_ck -
+				curr0_ci_cj_ck +
+				curr0_ci_pj_ck
+			);
+
+		// 3 x veclen FP32 stores
+		if constexpr (masked) {
+			volt0_ci_cj_ck.storePartial(
+				&volt(i, j, k, 0), begin_lane, end_lane
+			);
+			volt1_ci_cj_ck.storePartial(
+				&volt(i, j, k, 1), begin_lane, end_lane
+			);
+			volt2_ci_cj_ck.storePartial(
+				&volt(i, j, k, 2), begin_lane, end_lane
+			);
+		}
+		else {
+			volt0_ci_cj_ck.store(&volt(i, j, k, 0));
+			volt1_ci_cj_ck.store(&volt(i, j, k, 1));
+			volt2_ci_cj_ck.store(&volt(i, j, k, 2));
+		}
+	}
+}
+
+// The k + 1 neighbors are a lane shift of the current and next vectors.
+// If the next vector is outside the grid, it's treated as 0, as in the
+// verified kernel. Masking is the same as above.
+template <size_t veclen, bool boundary, bool masked = false>
+inline static void updateCurrentVectorKernel(
+	const NArray3D<float>& curr,
+	const NArray3D<float>& volt,
+	const NArray3D<float>& ii,
+	const NArray3D<float>& iv,
+	size_t i, size_t j,
+	size_t begin_k, size_t end_k
+)
+{
+	using Vec = Simd<float, veclen>;
+
+	size_t begin_lane = begin_k % veclen;
+	size_t end_lane = end_k - (begin_k - begin_lane);
+	if constexpr (masked) {
+		begin_k -= begin_lane;
+	}
+
+	for (size_t k = begin_k; k < end_k; k += veclen) {
+		// 3 x veclen FP32 loads
+		Vec curr0_ci_cj_ck = Vec::load(&curr(i, j, k, 0));
+		Vec curr1_ci_cj_ck = Vec::load(&curr(i, j, k, 1));
+		Vec curr2_ci_cj_ck = Vec::load(&curr(i, j, k, 2));
+
+		// 3 x veclen FP32 loads
+		Vec volt0_ci_cj_ck = Vec::load(&volt(i, j, k, 0));
+		Vec volt1_ci_cj_ck = Vec::load(&volt(i, j, k, 1));
+		Vec volt2_ci_cj_ck = Vec::load(&volt(i, j, k, 2));
+
+		// 4 x veclen FP32 loads
+		Vec volt0_ci_nj_ck = Vec::load(&volt(i,     j + 1, k, 0));
+		Vec volt2_ci_nj_ck = Vec::load(&volt(i,     j + 1, k, 2));
+		Vec volt1_ni_cj_ck = Vec::load(&volt(i + 1, j,     k, 1));
+		Vec volt2_ni_cj_ck = Vec::load(&volt(i + 1, j,     k, 2));
+
+		// 2 misaligned FP32 loads, as lane shifts
+		Vec volt0_ci_cj_nk, volt1_ci_cj_nk;
+		if constexpr (boundary) {
+			Vec zero;
+			zero = 0;
+			volt0_ci_cj_nk = shiftNext(volt0_ci_cj_ck, zero);
+			volt1_ci_cj_nk = shiftNext(volt1_ci_cj_ck, zero);
+		}
+		else {
+			volt0_ci_cj_nk = shiftNext(
+				volt0_ci_cj_ck, Vec::load(&volt(i, j, k + veclen, 0))
+			);
+			volt1_ci_cj_nk = shiftNext(
+				volt1_ci_cj_ck, Vec::load(&volt(i, j, k + veclen, 1))
+			);
+		}
+
+		// 6 x veclen FP32 loads
+		Vec ii0_ci_cj_ck = Vec::load(&ii(i, j, k, 0));
+		Vec ii1_ci_cj_ck = Vec::load(&ii(i, j, k, 1));
+		Vec ii2_ci_cj_ck = Vec::load(&ii(i, j, k, 2));
+		Vec iv0_ci_cj_ck = Vec::load(&iv(i, j, k, 0));
+		Vec iv1_ci_cj_ck = Vec::load(&iv(i, j, k, 1));
+		Vec iv2_ci_cj_ck = Vec::load(&iv(i, j, k, 2));
+
+		// x-polarization
+		curr0_ci_cj_ck *= ii0_ci_cj_ck;
+		curr0_ci_cj_ck +=
+			iv0_ci_cj_ck * (
+				volt2_ci_cj_ck -
+				volt2_ci_nj_ck -
+				volt1_ci_cj_ck +
+				volt1_ci_cj_nk
+			);
+
+		// y-polarization
+		curr1_ci_cj_ck *= ii1_ci_cj_ck;
+		curr1_ci_cj_ck +=
+			iv1_ci_cj_ck * (
+				volt0_ci_cj_ck -
+				volt0_ci_cj_nk -
+				volt2_ci_cj_ck +
+				volt2_ni_cj_ck
+			);
+
+		// z-polarization
+		curr2_ci_cj_ck *= ii2_ci_cj_ck;
+		curr2_ci_cj_ck +=
+			iv2_ci_cj_ck * (
+				volt1_ci_cj_ck -
+				volt1_ni_cj_ck -
+				volt0_ci_cj_ck +
+				volt0_ci_nj_ck
+			);
+
+		// 3 x veclen FP32 stores
+		if constexpr (masked) {
+			curr0_ci_cj_ck.storePartial(
+				&curr(i, j, k, 0), begin_lane, end_lane
+			);
+			curr1_ci_cj_ck.storePartial(
+				&curr(i, j, k, 1), begin_lane, end_lane
+			);
+			curr2_ci_cj_ck.storePartial(
+				&curr(i, j, k, 2), begin_lane, end_lane
+			);
+		}
+		else {
+			curr0_ci_cj_ck.store(&curr(i, j, k, 0));
+			curr1_ci_cj_ck.store(&curr(i, j, k, 1));
+			curr2_ci_cj_ck.store(&curr(i, j, k, 2));
+		}
+	}
+}
+
+// The K dimension is vectorized but the loop range (first_k, last_k)
+// is often at the middle of some vectors. Thus, each step of a row uses
+// the widest vector that is aligned at k and fits into the range, down
+// to kernelMinVectorWidth. Since a block of the array is 16 cells, any
+// narrower vector is aligned as well. The remaining cells before the
+// next or after the last vector of that width are a single masked vector.
+// Everything is inlined into a single loop per row, so the addresses of
+// the row are only computed once, which matters on the short rows of
+// small tiles.
+template <size_t veclen>
+inline static size_t updateVoltageStep(
+	const NArray3D<float>& volt,
+	const NArray3D<float>& curr,
+	const NArray3D<float>& vv,
+	const NArray3D<float>& vi,
+	size_t i, size_t j,
+	size_t k, size_t end_k
+)
+{
+	static_assert(veclen >= kernelMinVectorWidth);
+
+	if (k % veclen != 0 || k + veclen > end_k) {
+		if constexpr (veclen > kernelMinVectorWidth) {
+			return updateVoltageStep<veclen / 2>(
+				volt, curr, vv, vi, i, j, k, end_k
+			);
+		}
+		else {
+			size_t vector_k = k / veclen * veclen;
+			size_t partial_k = std::min(vector_k + veclen, end_k);
+			if (vector_k == 0) {
+				updateVoltageVectorKernel<veclen, true, true>(
+					volt, curr, vv, vi, i, j, k, partial_k
+				);
+			}
+			else {
+				updateVoltageVectorKernel<veclen, false, true>(
+					volt, curr, vv, vi, i, j, k, partial_k
+				);
+			}
+			return partial_k;
+		}
+	}
+
+	// the first vector of a row has no previous vector
+	if (k == 0) {
+		updateVoltageVectorKernel<veclen, true>(
+			volt, curr, vv, vi, i, j, 0, veclen
+		);
+		k = veclen;
+	}
+
+	size_t body_k = k + (end_k - k) / veclen * veclen;
+	updateVoltageVectorKernel<veclen, false>(
+		volt, curr, vv, vi, i, j, k, body_k
+	);
+	return body_k;
+}
+
+template <size_t veclen>
+inline static size_t updateCurrentStep(
+	const NArray3D<float>& curr,
+	const NArray3D<float>& volt,
+	const NArray3D<float>& ii,
+	const NArray3D<float>& iv,
+	size_t i, size_t j,
+	size_t k, size_t end_k
+)
+{
+	static_assert(veclen >= kernelMinVectorWidth);
+
+	if (k % veclen != 0 || k + veclen > end_k) {
+		if constexpr (veclen > kernelMinVectorWidth) {
+			return updateCurrentStep<veclen / 2>(
+				curr, volt, ii, iv, i, j, k, end_k
+			);
+		}
+		else {
+			size_t vector_k = k / veclen * veclen;
+			size_t partial_k = std::min(vector_k + veclen, end_k);
+			if (vector_k + veclen >= volt.k()) {
+				updateCurrentVectorKernel<veclen, true, true>(
+					curr, volt, ii, iv, i, j, k, partial_k
+				);
+			}
+			else {
+				updateCurrentVectorKernel<veclen, false, true>(
+					curr, volt, ii, iv, i, j, k, partial_k
+				);
+			}
+			return partial_k;
+		}
+	}
+
+	// the last vector of a row has no next vector if it ends at the
+	// edge of the grid
+	size_t body_k = k + (end_k - k) / veclen * veclen;
+	bool boundary = body_k >= volt.k();
+	updateCurrentVectorKernel<veclen, false>(
+		curr, volt, ii, iv, i, j, k, boundary ? body_k - veclen : body_k
+	);
+	if (boundary) {
+		updateCurrentVectorKernel<veclen, true>(
+			curr, volt, ii, iv, i, j, body_k - veclen, body_k
+		);
+	}
+	return body_k;
+}
+
+static void updateVoltageRange(
+	const NArray3D<float>& volt,
+	const NArray3D<float>& curr,
+	const NArray3D<float>& vv,
+	const NArray3D<float>& vi,
+	std::array<size_t, 3> first,
+	std::array<size_t, 3> last
+)
+{
+	for (size_t i = first[0]; i <= last[0]; i++) {
+		for (size_t j = first[1]; j <= last[1]; j++) {
+			for (size_t k = first[2]; k <= last[2];) {
+				k = updateVoltageStep<simdWidth>(
+					volt, curr, vv, vi, i, j, k, last[2] + 1
+				);
+			}
+		}
+	}
+}
+
+static void updateCurrentRange(
+	const NArray3D<float>& curr,
+	const NArray3D<float>& volt,
+	const NArray3D<float>& ii,
+	const NArray3D<float>& iv,
+	std::array<size_t, 3> first,
+	std::array<size_t, 3> last
+)
+{
+	for (size_t i = first[0]; i <= last[0]; i++) {
+		for (size_t j = first[1]; j <= last[1]; j++) {
+			for (size_t k = first[2]; k <= last[2];) {
+				k = updateCurrentStep<simdWidth>(
+					curr, volt, ii, iv, i, j, k, last[2] + 1
+				);
+			}
+		}
+	}
+}
+
+const KernelTable KERNEL_TABLE = {
+	KERNEL_ISA, simdWidth, updateVoltageRange, updateCurrentRange
+};
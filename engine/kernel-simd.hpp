@@ -0,0 +1,41 @@
+// Float kernels of a single ISA level. kernel-simd.cpp is compiled once
+// per level, with its own -march, and each build defines its own table.
+// kernel.cpp selects one of them at startup, see kernel.hpp.
+#pragma once
+#include <array>
+#include "narray3d.hpp"
+
+// Narrowest vector used by the kernels of all ISAs. Cells before the
+// first and after the last multiple of it in a row use a masked vector.
+constexpr size_t kernelMinVectorWidth = 4;
+
+struct KernelTable
+{
+	const char* isa;
+
+	// in FP32 elements
+	size_t vectorWidth;
+
+	void (*updateVoltageRange)(
+		const NArray3D<float>& volt,
+		const NArray3D<float>& curr,
+		const NArray3D<float>& vv,
+		const NArray3D<float>& vi,
+		std::array<size_t, 3> first,
+		std::array<size_t, 3> last
+	);
+
+	void (*updateCurrentRange)(
+		const NArray3D<float>& curr,
+		const NArray3D<float>& volt,
+		const NArray3D<float>& ii,
+		const NArray3D<float>& iv,
+		std::array<size_t, 3> first,
+		std::array<size_t, 3> last
+	);
+};
+
+// -march=x86-64-v2, v3 and v4
+extern const KernelTable kernelSse42;
+extern const KernelTable kernelAvx2;
+extern const KernelTable kernelAvx512;
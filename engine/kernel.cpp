@@ -0,0 +1,107 @@
+#include <format>
+#include <stdexcept>
+#include "kernel.hpp"
+#include "kernel-simd.hpp"
+
+// The feature levels match the -march of each table in the Makefile.
+static bool
+isSupported(const KernelTable* table)
+{
+	__builtin_cpu_init();
+
+	if (table == &kernelAvx512) {
+		return __builtin_cpu_supports("x86-64-v4");
+	}
+	else if (table == &kernelAvx2) {
+		return __builtin_cpu_supports("x86-64-v3");
+	}
+	else {
+		return __builtin_cpu_supports("x86-64-v2");
+	}
+}
+
+static const KernelTable*
+bestKernels()
+{
+	for (const KernelTable* table : {&kernelAvx512, &kernelAvx2}) {
+		if (isSupported(table)) {
+			return table;
+		}
+	}
+
+	// the baseline of the build, the binary can't run without it anyway
+	return &kernelSse42;
+}
+
+static const KernelTable* kernels = bestKernels();
+
+const char*
+kernelIsa()
+{
+	return kernels->isa;
+}
+
+size_t
+kernelVectorWidth()
+{
+	return kernels->vectorWidth;
+}
+
+size_t
+kernelMaskedCells(size_t first_k, size_t last_k)
+{
+	const size_t width = kernelMinVectorWidth;
+
+	size_t bodyBegin = (first_k + width - 1) / width * width;
+	size_t bodyEnd = (last_k + 1) / width * width;
+	if (bodyBegin >= bodyEnd) {
+		return last_k - first_k + 1;
+	}
+	return (bodyBegin - first_k) + (last_k + 1 - bodyEnd);
+}
+
+void
+setKernelIsa(const std::string& isa)
+{
+	for (const KernelTable* table : {&kernelAvx512, &kernelAvx2, &kernelSse42}) {
+		if (isa != table->isa) {
+			continue;
+		}
+
+		if (!isSupported(table)) {
+			throw std::invalid_argument(
+				std::format("{} kernels are not supported by this CPU", isa)
+			);
+		}
+		kernels = table;
+		return;
+	}
+
+	throw std::invalid_argument(
+		std::format("unknown kernel ISA {}, must be sse4.2, avx2 or avx512", isa)
+	);
+}
+
+void updateVoltageRange(
+	const NArray3D<float>& volt,
+	const NArray3D<float>& curr,
+	const NArray3D<float>& vv,
+	const NArray3D<float>& vi,
+	std::array<size_t, 3> first,
+	std::array<size_t, 3> last
+)
+{
+	kernels->updateVoltageRange(volt, curr, vv, vi, first, last);
+}
+
+void updateCurrentRange(
+	const NArray3D<float>& curr,
+	const NArray3D<float>& volt,
+	const NArray3D<float>& ii,
+	const NArray3D<float>& iv,
+	std::array<size_t, 3> first,
+	std::array<size_t, 3> last
+)
+{
+	kernels->updateCurrentRange(curr, volt, ii, iv, first, last);
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <array>
+#include <string>
+#include "narray3d.hpp"
+
+void updateVoltageRange(
+	const NArray3D<float>& volt,
+	const NArray3D<float>& curr,
+	const NArray3D<float>& vv,
+	const NArray3D<float>& vi,
+	std::array<size_t, 3> first,
+	std::array<size_t, 3> last
+);
+
+void updateCurrentRange(
+	const NArray3D<float>& curr,
+	const NArray3D<float>& volt,
+	const NArray3D<float>& ii,
+	const NArray3D<float>& iv,
+	std::array<size_t, 3> first,
+	std::array<size_t, 3> last
+);
+
+// The float kernels are built for SSE4.2, AVX2 and AVX-512, the best one
+// supported by the CPU is selected at startup.
+const char* kernelIsa();
+
+// Vector width of the selected kernels in FP32 elements. Ranges with k
+// edges at multiples of it don't need masked vectors.
+size_t kernelVectorWidth();
+
+// Number of cells in [first_k, last_k] of a row that are updated by a
+// masked partial vector, the rest are updated by full vectors.
+size_t kernelMaskedCells(size_t first_k, size_t last_k);
+
+// Select the kernels of another ISA ("sse4.2", "avx2" or "avx512"), e.g.
+// for benchmarking. Throws if the CPU doesn't support it. Not thread-safe,
+// call it before running any engine.
+void setKernelIsa(const std::string& isa);
@@ -0,0 +1,83 @@
+// Production 4D array to represent a 3D vector field inside a 3D space.
+//
+// Same layout as verify/narray3d.hpp with Simd<T, blockK> elements, as
+// used by verify-simd, but without bounds checking and with cacheline-
+// aligned storage, since this one sits in the innermost loop of real
+// simulations rather than symbolic checks.
+//
+// The K dimension is stored in blocks of blockK cells. Each block holds
+// the blockK cells of the 1st component, then of the 2nd and 3rd, i.e.
+// (i, j, k / blockK, n, k % blockK), so a vector of up to blockK cells of
+// the same component is a single aligned load. K is padded to a multiple
+// of blockK, the padding is never updated. With blockK = 1, it's the plain
+// (i, j, k, n) layout.
+//
+// Copying is forbidden, always pass it by reference.
+
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <array>
+#include <new>
+#include <algorithm>
+
+template<typename T, size_t maxN=3, size_t blockK=16>
+class NArray3D
+{
+public:
+	NArray3D(std::array<size_t, 3> size)
+	{
+		size_t paddedK = (size[2] + blockK - 1) / blockK * blockK;
+
+		m_elems = size[0] * size[1] * paddedK * maxN;
+		m_size = size;
+
+		m_strideI = size[1] * paddedK * maxN;
+		m_strideJ = paddedK * maxN;
+
+		// std::aligned_alloc() requires the size to be a multiple
+		// of the alignment.
+		size_t bytes = m_elems * sizeof(T);
+		bytes = (bytes + alignment - 1) / alignment * alignment;
+
+		m_ptr = static_cast<T*>(std::aligned_alloc(alignment, bytes));
+		if (!m_ptr) {
+			throw std::bad_alloc();
+		}
+		std::fill(m_ptr, m_ptr + m_elems, T());
+	}
+
+	~NArray3D()
+	{
+		std::free(m_ptr);
+		m_ptr = NULL;
+	}
+
+	NArray3D(const NArray3D&) = delete;
+	NArray3D& operator= (const NArray3D&) = delete;
+
+	T& operator() (size_t i, size_t j, size_t k, size_t n) const
+	{
+		return m_ptr[
+			i * m_strideI + j * m_strideJ +
+			(k / blockK) * strideK + n * blockK + k % blockK
+		];
+	}
+
+	T*     data()  const { return m_ptr;     }
+	size_t elems() const { return m_elems;   }
+	size_t i()     const { return m_size[0]; }
+	size_t j()     const { return m_size[1]; }
+	size_t k()     const { return m_size[2]; }
+
+private:
+	static const size_t alignment = 64;
+
+	// a compile-time constant, so the offset of k is shared by all arrays
+	static const size_t strideK = blockK * maxN;
+
+	std::array<size_t, 3> m_size;
+	size_t m_elems;
+	size_t m_strideI, m_strideJ;
+	T* m_ptr;
+};
@@ -0,0 +1,281 @@
+// BSD Zero Clause License
+// 
+// Copyright (C) 2024 Yifeng Li
+// 
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "profiler.hpp"
+using namespace Engine;
+
+// memReadBytes is derived from the number of LLC read misses
+static const size_t lineSize = 64;
+
+Counters&
+Counters::operator+= (const Counters& other)
+{
+	subtiles += other.subtiles;
+	cells += other.cells;
+	cycles += other.cycles;
+	llcMisses += other.llcMisses;
+	memReadBytes += other.memReadBytes;
+	return *this;
+}
+
+static int
+openEvent(uint32_t type, uint64_t config, int groupFd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	// pid 0 and cpu -1: the calling thread, on any CPU
+	return syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+static const struct
+{
+	uint32_t type;
+	uint64_t config;
+} events[] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{PERF_TYPE_HW_CACHE,
+	 PERF_COUNT_HW_CACHE_LL |
+	 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)}
+};
+
+Profiler::Profiler(size_t numThreads) :
+	m_slots(numThreads)
+{
+	if (numThreads == 0) {
+		throw std::invalid_argument("numThreads must be at least 1.");
+	}
+
+	// Find out which events are supported on the calling thread, the
+	// same set is opened by all threads later.
+	int leader = openEvent(events[Cycles].type, events[Cycles].config, -1);
+	if (leader < 0) {
+		throw std::runtime_error(std::format(
+			"can't open the CPU cycles counter: {} (no PMU, or check "
+			"/proc/sys/kernel/perf_event_paranoid)", strerror(errno)
+		));
+	}
+	m_hasEvent[Cycles] = true;
+
+	for (size_t event = Cycles + 1; event < NumEvents; event++) {
+		int fd = openEvent(events[event].type, events[event].config, leader);
+		if (fd >= 0) {
+			m_hasEvent[event] = true;
+			close(fd);
+		}
+	}
+	close(leader);
+}
+
+Profiler::~Profiler()
+{
+	for (Slot& slot : m_slots) {
+		closeGroup(slot);
+	}
+}
+
+bool
+Profiler::openGroup(Slot& slot)
+{
+	for (size_t event = Cycles; event < NumEvents; event++) {
+		if (!m_hasEvent[event]) {
+			continue;
+		}
+
+		int fd = openEvent(
+			events[event].type, events[event].config, slot.leader
+		);
+		if (fd < 0) {
+			closeGroup(slot);
+			return false;
+		}
+
+		if (event == Cycles) {
+			slot.leader = fd;
+		}
+		slot.fds.push_back(fd);
+	}
+	return true;
+}
+
+void
+Profiler::closeGroup(Slot& slot)
+{
+	for (int fd : slot.fds) {
+		close(fd);
+	}
+	slot.fds.clear();
+	slot.leader = -1;
+}
+
+std::array<uint64_t, Profiler::NumEvents>
+Profiler::read(const Slot& slot) const
+{
+	// PERF_FORMAT_GROUP: the number of events, then their values in the
+	// order they were opened
+	uint64_t buf[1 + NumEvents] = {};
+	if (::read(slot.leader, buf, sizeof(buf)) < 0) {
+		return {0, 0, 0};
+	}
+
+	std::array<uint64_t, NumEvents> values = {0, 0, 0};
+	size_t idx = 1;
+	for (size_t event = Cycles; event < NumEvents; event++) {
+		if (m_hasEvent[event] && idx <= buf[0]) {
+			values[event] = buf[idx++];
+		}
+	}
+	return values;
+}
+
+void
+Profiler::beginPlan(const void* plan)
+{
+	auto it = std::find(m_plans.begin(), m_plans.end(), plan);
+	m_currentPlan = it - m_plans.begin();
+	if (it == m_plans.end()) {
+		m_plans.push_back(plan);
+	}
+
+	for (Slot& slot : m_slots) {
+		slot.profiles.resize(m_plans.size());
+		slot.profiles[m_currentPlan].plan = plan;
+	}
+}
+
+void
+Profiler::beginTile(
+	size_t threadId, size_t stage, size_t tile,
+	std::array<size_t, 3> id
+)
+{
+	Slot& slot = m_slots[threadId];
+	if (slot.leader < 0 && !slot.failed) {
+		// threads without counters still count subtiles and cells
+		slot.failed = !openGroup(slot);
+	}
+
+	PlanProfile& profile = slot.profiles[m_currentPlan];
+	if (profile.tiles.size() <= stage) {
+		profile.tiles.resize(stage + 1);
+	}
+	if (profile.tiles[stage].size() <= tile) {
+		profile.tiles[stage].resize(tile + 1);
+	}
+	profile.tiles[stage][tile].id = id;
+
+	slot.stage = stage;
+	slot.tile = tile;
+	if (slot.leader >= 0) {
+		slot.last = read(slot);
+	}
+}
+
+void
+Profiler::endSubtile(
+	size_t threadId, std::array<size_t, 3> shape, size_t cells
+)
+{
+	Slot& slot = m_slots[threadId];
+
+	Counters delta;
+	delta.subtiles = 1;
+	delta.cells = cells;
+	if (slot.leader >= 0) {
+		std::array<uint64_t, NumEvents> now = read(slot);
+		delta.cycles = now[Cycles] - slot.last[Cycles];
+		delta.llcMisses = now[LlcMisses] - slot.last[LlcMisses];
+		delta.memReadBytes = (now[MemReads] - slot.last[MemReads]) * lineSize;
+		slot.last = now;
+	}
+
+	PlanProfile& profile = slot.profiles[m_currentPlan];
+	profile.tiles[slot.stage][slot.tile].counters += delta;
+	profile.shapes[shape] += delta;
+}
+
+std::vector<PlanProfile>
+Profiler::profiles() const
+{
+	std::vector<PlanProfile> merged(m_plans.size());
+
+	for (size_t planIdx = 0; planIdx < m_plans.size(); planIdx++) {
+		PlanProfile& profile = merged[planIdx];
+		profile.plan = m_plans[planIdx];
+
+		for (const Slot& slot : m_slots) {
+			const PlanProfile& src = slot.profiles[planIdx];
+
+			if (profile.tiles.size() < src.tiles.size()) {
+				profile.tiles.resize(src.tiles.size());
+			}
+			for (size_t stage = 0; stage < src.tiles.size(); stage++) {
+				std::vector<TileProfile>& tiles = profile.tiles[stage];
+				if (tiles.size() < src.tiles[stage].size()) {
+					tiles.resize(src.tiles[stage].size());
+				}
+
+				for (size_t tile = 0; tile < src.tiles[stage].size(); tile++) {
+					const TileProfile& srcTile = src.tiles[stage][tile];
+					if (srcTile.id != std::array<size_t, 3>{0, 0, 0}) {
+						tiles[tile].id = srcTile.id;
+					}
+					tiles[tile].counters += srcTile.counters;
+				}
+			}
+
+			for (const auto& [shape, counters] : src.shapes) {
+				profile.shapes[shape] += counters;
+			}
+		}
+
+		profile.stages.resize(profile.tiles.size());
+		for (size_t stage = 0; stage < profile.tiles.size(); stage++) {
+			for (const TileProfile& tile : profile.tiles[stage]) {
+				profile.stages[stage] += tile.counters;
+			}
+		}
+	}
+
+	return merged;
+}
+
+void
+Profiler::reset()
+{
+	m_plans.clear();
+	m_currentPlan = 0;
+	for (Slot& slot : m_slots) {
+		slot.profiles.clear();
+	}
+}
@@ -0,0 +1,140 @@
+// BSD Zero Clause License
+// 
+// Copyright (C) 2024 Yifeng Li
+// 
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace Engine {
+	using size_t = std::size_t;
+
+	// Hardware counters of one or more subtiles. Events not supported
+	// by the CPU stay 0, see Profiler::hasLlcMisses().
+	struct Counters
+	{
+		// number of subtiles, and cell updates of both volt and curr
+		size_t subtiles = 0;
+		size_t cells = 0;
+
+		uint64_t cycles = 0;
+		uint64_t llcMisses = 0;
+
+		// LLC read misses times the cache line size, i.e. demand reads
+		// from DRAM, hardware prefetches are not included
+		uint64_t memReadBytes = 0;
+
+		Counters& operator+= (const Counters& other);
+	};
+
+	struct TileProfile
+	{
+		std::array<size_t, 3> id = {0, 0, 0};
+		Counters counters;
+	};
+
+	// Counters of a plan, summed over all batches and threads.
+	struct PlanProfile
+	{
+		const void* plan = NULL;
+
+		std::vector<Counters> stages;
+
+		// [stage][tile], in the same order as the plan
+		std::vector<std::vector<TileProfile>> tiles;
+
+		// keyed by the bounding box size of the subtile
+		std::map<std::array<size_t, 3>, Counters> shapes;
+	};
+
+	// Per-subtile hardware counters of the tiled engine, enabled by
+	// Engine::setProfiler(). Each thread of the pool reads its own
+	// perf_event_open() group, opened on its first tile, into its own
+	// slot, so there's no synchronization between threads. Counting is
+	// limited to user space, which is allowed for the own process with
+	// the default perf_event_paranoid.
+	//
+	// The constructor throws if the CPU cycles counter can't be opened,
+	// e.g. in a VM without a virtual PMU. LLC misses and memory reads are
+	// optional, as not all CPUs have generic LLC events.
+	class Profiler
+	{
+	public:
+		Profiler(size_t numThreads = 1);
+		~Profiler();
+
+		Profiler(const Profiler&) = delete;
+		Profiler& operator= (const Profiler&) = delete;
+
+		bool hasLlcMisses() const { return m_hasEvent[LlcMisses]; }
+		bool hasMemReadBytes() const { return m_hasEvent[MemReads]; }
+
+		// Profiles of all plans executed so far, in the order of their
+		// first execution. Plans are identified by their address.
+		std::vector<PlanProfile> profiles() const;
+
+		void reset();
+
+		// Called by the engine: beginPlan() before the stages of each
+		// plan on the calling thread, beginTile() and endSubtile() by
+		// the thread executing the tile.
+		void beginPlan(const void* plan);
+		void beginTile(
+			size_t threadId, size_t stage, size_t tile,
+			std::array<size_t, 3> id
+		);
+		void endSubtile(
+			size_t threadId, std::array<size_t, 3> shape, size_t cells
+		);
+
+	private:
+		enum Event
+		{
+			Cycles, LlcMisses, MemReads, NumEvents
+		};
+
+		// Per-thread state, aligned to avoid false sharing.
+		struct alignas(64) Slot
+		{
+			// group leader (the cycles counter), -1 if not opened yet
+			int leader = -1;
+			std::vector<int> fds;
+			bool failed = false;
+
+			// counter values at the end of the last subtile
+			std::array<uint64_t, NumEvents> last = {0, 0, 0};
+
+			size_t stage = 0;
+			size_t tile = 0;
+
+			std::vector<PlanProfile> profiles;
+		};
+
+		bool openGroup(Slot& slot);
+		void closeGroup(Slot& slot);
+		std::array<uint64_t, NumEvents> read(const Slot& slot) const;
+
+		std::array<bool, NumEvents> m_hasEvent = {false, false, false};
+		std::vector<const void*> m_plans;
+		size_t m_currentPlan = 0;
+		std::vector<Slot> m_slots;
+	};
+}
+
+#endif  // PROFILER_HPP
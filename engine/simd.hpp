@@ -0,0 +1,195 @@
+// Real SIMD type using GCC vector extensions, the FP32 counterpart of
+// the emulated verify/simd.hpp. Arithmetic is element-wise in the same
+// order as the scalar kernel, so results are bit-exact as long as FMA
+// contraction is disabled by -ffp-contract=off, see the Makefile.
+//
+// A Simd<float, 4/8/16> is a single SSE/AVX/AVX-512 register when the
+// ISA is enabled, otherwise GCC splits it into narrower registers.
+//
+// Everything is in an anonymous namespace, since kernel-simd.cpp is
+// compiled once per ISA level: with external linkage, the linker would
+// keep a single copy of each template function that isn't inlined, built
+// for an arbitrary ISA (storePartial() even has a different body in each
+// build), and use it for all of them.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <immintrin.h>
+
+namespace {
+
+// Widest vector of the target ISA, in FP32 elements.
+#if defined(__AVX512F__)
+constexpr size_t simdWidth = 16;
+#elif defined(__AVX__)
+constexpr size_t simdWidth = 8;
+#else
+constexpr size_t simdWidth = 4;
+#endif
+
+template <typename Tscalar, size_t num>
+struct Simd
+{
+	static_assert(sizeof(Tscalar) == sizeof(int32_t),
+				  "shuffle masks are only implemented for 32-bit types");
+
+	typedef Tscalar Vector __attribute__((vector_size(sizeof(Tscalar) * num)));
+	typedef int32_t Mask __attribute__((vector_size(sizeof(int32_t) * num)));
+
+	Vector vec;
+
+	// Memory of the arrays is accessed by memcpy() to avoid aliasing
+	// problems, it's compiled into a single vector load or store.
+	static Simd load(const Tscalar* ptr)
+	{
+		Simd retval;
+		std::memcpy(&retval.vec, ptr, sizeof(Vector));
+		return retval;
+	}
+
+	void store(Tscalar* ptr) const
+	{
+		std::memcpy(ptr, &vec, sizeof(Vector));
+	}
+
+	// Store lanes [begin, end) only, see below.
+	void storePartial(Tscalar* ptr, size_t begin, size_t end) const;
+
+	void operator= (const int val)
+	{
+		vec = Vector{} + (Tscalar) val;
+	}
+};
+
+template <typename Tscalar, size_t num>
+Simd<Tscalar, num>
+operator+ (const Simd<Tscalar, num>& a, const Simd<Tscalar, num>& b)
+{
+	return {a.vec + b.vec};
+}
+
+template <typename Tscalar, size_t num>
+Simd<Tscalar, num>
+operator- (const Simd<Tscalar, num>& a, const Simd<Tscalar, num>& b)
+{
+	return {a.vec - b.vec};
+}
+
+template <typename Tscalar, size_t num>
+Simd<Tscalar, num>
+operator* (const Simd<Tscalar, num>& a, const Simd<Tscalar, num>& b)
+{
+	return {a.vec * b.vec};
+}
+
+template <typename Tscalar, size_t num>
+void
+operator+= (Simd<Tscalar, num>& a, const Simd<Tscalar, num>& b) { a = a + b; }
+
+template <typename Tscalar, size_t num>
+void
+operator*= (Simd<Tscalar, num>& a, const Simd<Tscalar, num>& b) { a = a * b; }
+
+// Shuffle masks are built from index sequences, so they're constant
+// expressions and each shift is compiled into a single permute, e.g.
+// valignd (AVX-512), vpermps (AVX2) or palignr (SSE).
+template <typename Mask, size_t offset, size_t... idx>
+constexpr Mask
+shiftMask(std::index_sequence<idx...>)
+{
+	return Mask{(int32_t) (idx + offset)...};
+}
+
+template <typename Mask, size_t... idx>
+constexpr Mask
+clampedShiftMask(std::index_sequence<idx...>)
+{
+	return Mask{(int32_t) (idx > 0 ? idx - 1 : 0)...};
+}
+
+// The k - 1 neighbors of vector a: {prev[num - 1], a[0], ..., a[num - 2]}.
+template <typename Tscalar, size_t num>
+Simd<Tscalar, num>
+shiftPrev(const Simd<Tscalar, num>& prev, const Simd<Tscalar, num>& a)
+{
+	using Mask = typename Simd<Tscalar, num>::Mask;
+	constexpr Mask mask = shiftMask<Mask, num - 1>(
+		std::make_index_sequence<num>()
+	);
+	return {__builtin_shuffle(prev.vec, a.vec, mask)};
+}
+
+// Same as above at k = 0, which is its own neighbor: {a[0], a[0], ...,
+// a[num - 2]}.
+template <typename Tscalar, size_t num>
+Simd<Tscalar, num>
+shiftPrevBoundary(const Simd<Tscalar, num>& a)
+{
+	using Mask = typename Simd<Tscalar, num>::Mask;
+	constexpr Mask mask = clampedShiftMask<Mask>(
+		std::make_index_sequence<num>()
+	);
+	return {__builtin_shuffle(a.vec, mask)};
+}
+
+// The k + 1 neighbors of vector a: {a[1], ..., a[num - 1], next[0]}.
+template <typename Tscalar, size_t num>
+Simd<Tscalar, num>
+shiftNext(const Simd<Tscalar, num>& a, const Simd<Tscalar, num>& next)
+{
+	using Mask = typename Simd<Tscalar, num>::Mask;
+	constexpr Mask mask = shiftMask<Mask, 1>(
+		std::make_index_sequence<num>()
+	);
+	return {__builtin_shuffle(a.vec, next.vec, mask)};
+}
+
+// The other lanes are left untouched in memory, rather than written
+// back, since they may belong to a tile updated by another thread at the
+// same time. It's a single masked store on AVX-512 (any width, with VL)
+// and AVX (8 or 4 lanes), SSE has no masked store except the
+// non-temporal maskmovdqu, so the lanes are stored one at a time.
+template <typename Tscalar, size_t num>
+void
+Simd<Tscalar, num>::storePartial(Tscalar* ptr, size_t begin, size_t end) const
+{
+#if defined(__AVX512F__) && defined(__AVX512VL__)
+	if constexpr (num == 16 || num == 8 || num == 4) {
+		uint32_t mask = ((1u << end) - 1) & ~((1u << begin) - 1);
+
+		if constexpr (num == 16) {
+			_mm512_mask_storeu_ps((float*) ptr, mask, (__m512) vec);
+		}
+		else if constexpr (num == 8) {
+			_mm256_mask_storeu_ps((float*) ptr, mask, (__m256) vec);
+		}
+		else {
+			_mm_mask_storeu_ps((float*) ptr, mask, (__m128) vec);
+		}
+		return;
+	}
+#elif defined(__AVX__)
+	if constexpr (num == 8 || num == 4) {
+		constexpr Mask lanes = shiftMask<Mask, 0>(
+			std::make_index_sequence<num>()
+		);
+		Mask mask = (lanes >= (int32_t) begin) & (lanes < (int32_t) end);
+
+		if constexpr (num == 8) {
+			_mm256_maskstore_ps((float*) ptr, (__m256i) mask, (__m256) vec);
+		}
+		else {
+			_mm_maskstore_ps((float*) ptr, (__m128i) mask, (__m128) vec);
+		}
+		return;
+	}
+#endif
+	for (size_t n = begin; n < end; n++) {
+		Tscalar val = vec[n];
+		std::memcpy(ptr + n, &val, sizeof(Tscalar));
+	}
+}
+
+}  // namespace
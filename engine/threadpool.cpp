@@ -0,0 +1,107 @@
+#include <stdexcept>
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool(size_t numThreads) : m_numThreads(numThreads)
+{
+	if (numThreads == 0) {
+		throw std::invalid_argument("numThreads must be at least 1.");
+	}
+
+	for (size_t threadId = 1; threadId < numThreads; threadId++) {
+		m_threads.emplace_back(&ThreadPool::worker, this, threadId);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_startCond.notify_all();
+
+	for (std::thread& thread : m_threads) {
+		thread.join();
+	}
+}
+
+void
+ThreadPool::parallelFor(size_t n, const Job& job)
+{
+	if (n == 0) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = &job;
+		m_numItems = n;
+		m_nextItem = 0;
+		m_busyThreads = m_threads.size();
+		m_generation++;
+	}
+	m_startCond.notify_all();
+
+	// the calling thread works as thread 0
+	runItems(0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_doneCond.wait(lock, [this] { return m_busyThreads == 0; });
+	m_job = nullptr;
+
+	if (m_error) {
+		std::exception_ptr error = m_error;
+		m_error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void
+ThreadPool::worker(size_t threadId)
+{
+	size_t seenGeneration = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_startCond.wait(lock, [this, seenGeneration] {
+				return m_stop || m_generation != seenGeneration;
+			});
+
+			if (m_stop) {
+				return;
+			}
+			seenGeneration = m_generation;
+		}
+
+		runItems(threadId);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_busyThreads--;
+		}
+		m_doneCond.notify_one();
+	}
+}
+
+void
+ThreadPool::runItems(size_t threadId)
+{
+	while (true) {
+		size_t idx = m_nextItem.fetch_add(1, std::memory_order_relaxed);
+		if (idx >= m_numItems) {
+			break;
+		}
+
+		try {
+			(*m_job)(idx, threadId);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_error) {
+				m_error = std::current_exception();
+			}
+			m_nextItem = m_numItems;
+		}
+	}
+}
@@ -0,0 +1,60 @@
+// Persistent thread pool for executing independent tiles in parallel.
+//
+// Threads are created once and reused for every stage of every batch,
+// so the cost of a stage barrier is a condition variable wake-up, not
+// a thread creation.
+
+#pragma once
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	using Job = std::function<void(size_t idx, size_t threadId)>;
+
+	// The calling thread also participates as thread 0, so only
+	// numThreads - 1 extra threads are spawned.
+	ThreadPool(size_t numThreads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator= (const ThreadPool&) = delete;
+
+	size_t size() const { return m_numThreads; }
+
+	// Call job(idx, threadId) for every idx in [0, n) in parallel, items
+	// are handed out dynamically. Return only after all items are done,
+	// thus each call is a barrier. If a job throws, no more items are
+	// started, and the first exception is rethrown once all running jobs
+	// have returned.
+	void parallelFor(size_t n, const Job& job);
+
+private:
+	void worker(size_t threadId);
+	void runItems(size_t threadId);
+
+	size_t m_numThreads;
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_startCond;
+	std::condition_variable m_doneCond;
+
+	const Job* m_job = nullptr;
+	size_t m_numItems = 0;
+	std::atomic<size_t> m_nextItem = 0;
+
+	// first exception thrown by a job of the current call
+	std::exception_ptr m_error;
+
+	size_t m_generation = 0;
+	size_t m_busyThreads = 0;
+	bool m_stop = false;
+};
@@ -0,0 +1,155 @@
+// BSD Zero Clause License
+// 
+// Copyright (C) 2024 Yifeng Li
+// 
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstdio>
+#include <format>
+#include <stdexcept>
+
+#include "tracer.hpp"
+using namespace Engine;
+
+Tracer::Tracer(size_t numThreads) :
+	m_epoch(std::chrono::steady_clock::now()),
+	m_slots(numThreads)
+{
+	if (numThreads == 0) {
+		throw std::invalid_argument("numThreads must be at least 1.");
+	}
+
+	// avoid reallocations in the middle of short runs
+	for (Slot& slot : m_slots) {
+		slot.events.reserve(4096);
+	}
+}
+
+void
+Tracer::beginBatch(size_t first, size_t count)
+{
+	m_batch = first;
+	m_batchCount = count;
+	m_batchStart = now();
+}
+
+void
+Tracer::endBatch()
+{
+	m_slots[0].events.push_back({
+		Kind::Batch, m_batch, 0, m_batchCount, {0, 0, 0}, m_batchStart, now()
+	});
+}
+
+void
+Tracer::stage(size_t stage, uint64_t start, uint64_t end)
+{
+	m_slots[0].events.push_back({
+		Kind::Stage, m_batch, stage, 0, {0, 0, 0}, start, end
+	});
+}
+
+void
+Tracer::tile(
+	size_t threadId, size_t batch, size_t stage, size_t tile,
+	std::array<size_t, 3> id, uint64_t start, uint64_t end
+)
+{
+	m_slots[threadId].events.push_back({
+		Kind::Tile, m_batch + batch, stage, tile, id, start, end
+	});
+}
+
+void
+Tracer::write(const std::string& path) const
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file) {
+		throw std::invalid_argument(std::format("can't open {}", path));
+	}
+
+	fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	for (size_t threadId = 0; threadId < m_slots.size(); threadId++) {
+		fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", "
+					  "\"pid\": 0, \"tid\": %zu, "
+					  "\"args\": {\"name\": \"thread %zu\"}}",
+					  threadId > 0 ? ",\n" : "", threadId, threadId);
+	}
+
+	// Complete events, timestamps are in microseconds. Events of the
+	// same thread nest, as stages and batches are recorded when all of
+	// their tiles are done.
+	for (size_t threadId = 0; threadId < m_slots.size(); threadId++) {
+		for (const Event& event : m_slots[threadId].events) {
+			std::string name, args;
+			const char* category = "";
+
+			switch (event.kind) {
+				case Kind::Batch:
+					category = "batch";
+					if (event.tile == 1) {
+						name = std::format("batch {}", event.batch);
+					}
+					else {
+						name = std::format(
+							"batch {}-{}", event.batch, event.batch + event.tile - 1
+						);
+					}
+					args = std::format(
+						"\"batch\": {}, \"batches\": {}", event.batch, event.tile
+					);
+					break;
+				case Kind::Stage:
+					category = "stage";
+					name = std::format("stage {}", event.stage);
+					args = std::format(
+						"\"batch\": {}, \"stage\": {}", event.batch, event.stage
+					);
+					break;
+				case Kind::Tile:
+					// named by stage, so tiles of the same stage have the
+					// same color
+					category = "tile";
+					name = std::format("tile (stage {})", event.stage);
+					args = std::format(
+						"\"batch\": {}, \"stage\": {}, \"tile\": {}, "
+						"\"id\": [{}, {}, {}]",
+						event.batch, event.stage, event.tile,
+						event.id[0], event.id[1], event.id[2]
+					);
+					break;
+			}
+
+			fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"%s\", "
+						  "\"ph\": \"X\", \"pid\": 0, \"tid\": %zu, "
+						  "\"ts\": %.3f, \"dur\": %.3f, \"args\": {%s}}",
+						  name.c_str(), category, threadId,
+						  event.start / 1e3, (event.end - event.start) / 1e3,
+						  args.c_str());
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	if (fclose(file) != 0) {
+		throw std::invalid_argument(std::format("can't write {}", path));
+	}
+}
+
+void
+Tracer::reset()
+{
+	m_batch = 0;
+	m_batchCount = 0;
+	for (Slot& slot : m_slots) {
+		slot.events.clear();
+	}
+}
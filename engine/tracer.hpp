@@ -0,0 +1,108 @@
+// BSD Zero Clause License
+// 
+// Copyright (C) 2024 Yifeng Li
+// 
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Engine {
+	using size_t = std::size_t;
+
+	// Timeline of the tiled engine, enabled by Engine::setTracer(). The
+	// start and end of every tile is appended to the buffer of the
+	// thread executing it, so threads never synchronize. Stages and
+	// batches are recorded by the calling thread, which is also thread
+	// 0 of the pool, so they nest with its tiles.
+	//
+	// The timeline is written as a Chrome trace (JSON Trace Event
+	// Format), which can be opened in Perfetto or chrome://tracing.
+	class Tracer
+	{
+	public:
+		Tracer(size_t numThreads = 1);
+
+		// nanoseconds since the tracer was created
+		uint64_t now() const
+		{
+			auto elapsed = std::chrono::steady_clock::now() - m_epoch;
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				elapsed
+			).count();
+		}
+
+		// Called by the engine on the calling thread. The dependency-
+		// driven scheduler runs several batches at once, which are
+		// traced as a single range of count batches.
+		void beginBatch(size_t first, size_t count = 1);
+		void endBatch();
+		size_t batch() const { return m_batch; }
+
+		void stage(size_t stage, uint64_t start, uint64_t end);
+
+		// Called by the thread executing the tile, batch is relative to
+		// the current batch.
+		void tile(
+			size_t threadId, size_t batch, size_t stage, size_t tile,
+			std::array<size_t, 3> id, uint64_t start, uint64_t end
+		);
+
+		// Throws if the file can't be written.
+		void write(const std::string& path) const;
+
+		void reset();
+
+	private:
+		enum class Kind
+		{
+			Batch, Stage, Tile
+		};
+
+		struct Event
+		{
+			Kind kind;
+
+			// for a batch range, tile is the number of batches
+			size_t batch;
+			size_t stage;
+			size_t tile;
+			std::array<size_t, 3> id;
+
+			uint64_t start;
+			uint64_t end;
+		};
+
+		// per-thread buffer, aligned to avoid false sharing
+		struct alignas(64) Slot
+		{
+			std::vector<Event> events;
+		};
+
+		std::chrono::steady_clock::time_point m_epoch;
+
+		size_t m_batch = 0;
+		size_t m_batchCount = 0;
+		uint64_t m_batchStart = 0;
+
+		std::vector<Slot> m_slots;
+	};
+}
+
+#endif  // TRACER_HPP
@@ -6,6 +6,7 @@
 #include "kernel.hpp"
 
 #include "tiling.hpp"
+#include "plancache.hpp"
 using namespace Tiling;
 
 std::array<size_t, 3> gridSize = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
@@ -14,11 +15,14 @@ std::array<char, 3>   tileType = {'-', '-', '-'};
 size_t tileHalfTs = SIZE_MAX;
 size_t timesteps = SIZE_MAX;
 bool debug = false;
+PlanCache planCache;
+std::vector<std::array<size_t, 3>> innerTileSizes;
 
 void ref(void);
 void tiled(void);
-void tiledBody(Plan3D plan, Array3D<uint32_t>& volt, Array3D<uint32_t>& curr);
-Plan3D makePlan(size_t tileHalfTs);
+void tiledBody(const Plan3D& plan, Array3D<uint32_t>& volt, Array3D<uint32_t>& curr);
+const Plan3D& makePlan(size_t tileHalfTs);
+Plan3D buildPlan(size_t tileHalfTs);
 void parseArgs(int argc, char** argv);
 int main(int argc, char** argv);
 
@@ -56,18 +60,18 @@ void tiled(void)
 	auto volt = Array3D<uint32_t>(gridSize[0], gridSize[1], gridSize[2]);
 	auto curr = Array3D<uint32_t>(gridSize[0], gridSize[1], gridSize[2]);
 
-	Plan3D mainPlan = makePlan(tileHalfTs);
+	const Plan3D& mainPlan = makePlan(tileHalfTs);
 	tiledBody(mainPlan, volt, curr);
 
 	if (remHalfTs > 0) {
-		Plan3D remPlan = makePlan(remHalfTs);
+		const Plan3D& remPlan = makePlan(remHalfTs);
 		tiledBody(remPlan, volt, curr);
 	}
 
 	std::cout << "\tpassed!\n";
 }
 
-void tiledBody(Plan3D plan, Array3D<uint32_t>& volt, Array3D<uint32_t>& curr)
+void tiledBody(const Plan3D& plan, Array3D<uint32_t>& volt, Array3D<uint32_t>& curr)
 {
 	size_t stage = 0;
 	for (const TileList3D& tileList : plan) {
@@ -98,21 +102,97 @@ void tiledBody(Plan3D plan, Array3D<uint32_t>& volt, Array3D<uint32_t>& curr)
 	}
 }
 
-Plan3D makePlan(size_t tileHalfTs)
+// Plans are memoized, so the remainder plan reuses the 1D plans of
+// identical dimensions, and with --plan-cache, repeated runs load the
+// 3D plan from disk.
+const Plan3D& makePlan(size_t tileHalfTs)
 {
-	Plan1D i = computeTrapezoidTiles(gridSize[0], tileSize[0], tileHalfTs);
-	Plan1D j = computeTrapezoidTiles(gridSize[1], tileSize[1], tileHalfTs);
+	return planCache.plan3D(
+		gridSize, tileSize, tileType, tileHalfTs,
+		[=]() { return refineTiles(buildPlan(tileHalfTs), innerTileSizes); },
+		innerTileSizes
+	);
+}
+
+Plan3D buildPlan(size_t tileHalfTs)
+{
+	if (tileType[0] == 'r') {
+		return computeRecursiveTiles(gridSize, tileSize, tileHalfTs);
+	}
+
+	if (tileType[2] == 'f') {
+		// DiamondTorre, the remainder batch may be too short for diamond
+		// tiling, in this case, fall back to trapezoid tiling.
+		const Plan1D& i = tileHalfTs % 4 == 0 ?
+			planCache.plan1D('d', gridSize[0], tileSize[0], tileHalfTs) :
+			planCache.plan1D('t', gridSize[0], tileSize[0], tileHalfTs);
+		const Plan1D& j = planCache.plan1D(
+			'p', gridSize[1], tileSize[1], tileHalfTs
+		);
+		const Plan1D& k = planCache.plan1D(
+			'f', gridSize[2], tileSize[2], tileHalfTs
+		);
+		Plan3D plan = combineTilesDiamondTorre(i, j, k);
+		return plan;
+	}
+
+	if (tileType[0] == 'c' && tileHalfTs % 4 == 0) {
+		const Plan1D& i = planCache.plan1D(
+			'd', gridSize[0], tileSize[0], tileHalfTs
+		);
+		const Plan1D& j = planCache.plan1D(
+			'd', gridSize[1], tileSize[1], tileHalfTs
+		);
+		const Plan1D& k = planCache.plan1D(
+			'd', gridSize[2], tileSize[2], tileHalfTs
+		);
+		Plan3D plan = combineTilesDiamondCandy(i, j, k);
+		return plan;
+	}
+
+	if (tileType[0] == 'd' && tileHalfTs % 4 == 0) {
+		const Plan1D& i = planCache.plan1D(
+			'd', gridSize[0], tileSize[0], tileHalfTs
+		);
+		const Plan1D& j = planCache.plan1D(
+			'd', gridSize[1], tileSize[1], tileHalfTs
+		);
+
+		if (tileType[2] == 'p') {
+			const Plan1D& k = planCache.plan1D(
+				'p', gridSize[2], tileSize[2], tileHalfTs
+			);
+			Plan3D plan = combineTilesDDP(i, j, k);
+			return plan;
+		}
+		else {
+			const Plan1D& k = planCache.plan1D(
+				'd', gridSize[2], tileSize[2], tileHalfTs
+			);
+			Plan3D plan = combineTilesDDD(i, j, k);
+			return plan;
+		}
+	}
+
+	// The remainder batch may be too short for diamond tiling, in this
+	// case, fall back to trapezoid tiling.
+	const Plan1D& i = planCache.plan1D(
+		't', gridSize[0], tileSize[0], tileHalfTs
+	);
+	const Plan1D& j = planCache.plan1D(
+		't', gridSize[1], tileSize[1], tileHalfTs
+	);
 
 	if (tileType[2] == 'p') {
-		Plan1D k = computeParallelogramTiles(
-			gridSize[2], tileSize[2], tileHalfTs
+		const Plan1D& k = planCache.plan1D(
+			'p', gridSize[2], tileSize[2], tileHalfTs
 		);
 		Plan3D plan = combineTilesTTP(i, j, k);
 		return plan;
 	}
-	else if (tileType[2] == 't') {
-		Plan1D k = computeTrapezoidTiles(
-			gridSize[2], tileSize[2], tileHalfTs
+	else if (tileType[2] == 't' || tileType[2] == 'd' || tileType[2] == 'c') {
+		const Plan1D& k = planCache.plan1D(
+			't', gridSize[2], tileSize[2], tileHalfTs
 		);
 		Plan3D plan = combineTilesTTT(i, j, k);
 		return plan;
@@ -132,6 +212,8 @@ void parseArgs(int argc, char** argv)
 		{"tile-size",			required_argument, 0, 't'},
 		{"tile-height",			required_argument, 0, 'h'},
 		{"total-timesteps",		optional_argument, 0, 'n'},
+		{"plan-cache",			required_argument, 0, 'c'},
+		{"refine",				required_argument, 0, 'r'},
 	};
 
 	const char* progname = "sanity";
@@ -145,7 +227,7 @@ void parseArgs(int argc, char** argv)
 	char* tileArg = NULL;
 	int opt;
 
-	while ((opt = getopt_long(argc, argv, "dg:t:h:n:", longopts, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "dc:r:g:t:h:n:", longopts, NULL)) != -1) {
 		switch (opt) {
 			case 'g':
 				gridArg = optarg;
@@ -156,6 +238,16 @@ void parseArgs(int argc, char** argv)
 			case 'h':
 				tileHalfTs = atoi(optarg);
 				break;
+			case 'c':
+				planCache = PlanCache(optarg);
+				break;
+			case 'r':
+				innerTileSizes.push_back({
+					(size_t) atoi(strtok(optarg, ",")),
+					(size_t) atoi(strtok(NULL, ",")),
+					(size_t) atoi(strtok(NULL, ","))
+				});
+				break;
 			case 'n':
 				timesteps = atoi(optarg);
 				break;
@@ -173,13 +265,29 @@ void parseArgs(int argc, char** argv)
 		printf("%s: Quick Sanity Check of Tiling Correctness\n\n", progname);
 		printf("Usage: %s [OPTION]\n", progname);
 		printf("   --grid-size\t\t-g\ti,j,k\t\t\t(e.g: 400,400,400)\n");
-		printf("   --tile-size\t\t-t\tit,jt,kt/kp\t\t"
-			   "(e.g: 20t,20t,20t or 20t,20t,20p)\n");
+		printf("   --tile-size\t\t-t\tit/id,jt/jd,kt/kd/kp\t"
+			   "(e.g: 20t,20t,20t, 20t,20t,20p or 20d,20d,20p)\n");
+		printf("   \t\t\tid,jp,f\t\t\t(DiamondTorre, e.g: 20d,20p,f)\n");
+		printf("   \t\t\tic,jc,kc\t\t(DiamondCandy, e.g: 20c,20c,20c)\n");
+		printf("   \t\t\tir,jr,kr\t\t(recursive, e.g: 16r,16r,64r)\n");
 		printf("   --tile-height\t-h\thalfTimesteps\t\t(e.g: 18)\n");
 		printf("   --total-timesteps\t-n\ttimesteps\t\t(defafult: 100)\n");
 		printf("   --dump\t\t-d\tdump traces for debugging\t(default: no)\n");
+		printf("   --plan-cache\t-c\tdirectory\t\t(default: none)\n");
+		printf("   --refine\t\t-r\ti,j,k\t\t\t(e.g: 8,8,8, repeat for "
+			   "each cache level)\n");
 		printf("\nNote: Parallelogram tiling uses suffix \"p\", "
-			   "trapezoid tiling uses suffix \"t\".\n");
+			   "trapezoid tiling uses suffix \"t\", "
+			   "diamond tiling uses suffix \"d\".\n");
+		printf("Note: DiamondTorre uses diamond tiling in dimension i, "
+			   "parallelogram tiling\n      in dimension j, and column "
+			   "tiling (suffix \"f\", not tiled) in dimension k.\n");
+		printf("Note: DiamondCandy uses diamond tiling in all dimensions, "
+			   "grouped into levels\n      of candies that can run "
+			   "concurrently.\n");
+		printf("Note: Recursive tiling cuts the whole grid in space and time "
+			   "until the pieces\n      are no larger than the given base "
+			   "size, without tuning for cache size.\n");
 		std::exit(1);
 	}
 
@@ -195,10 +303,13 @@ void parseArgs(int argc, char** argv)
 	for (size_t dim = 0; dim < 3; dim++) {
 		std::string& arg = tileArgString[dim];
 
-		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p') {
+		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p' &&
+			arg[arg.size() - 1] != 'd' && arg[arg.size() - 1] != 'f' &&
+			arg[arg.size() - 1] != 'c' && arg[arg.size() - 1] != 'r'
+		) {
 			throw std::invalid_argument(
-				std::format("tile suffix must be 't' or 'p', got {}",
-							arg[arg.size() - 1])
+				std::format("tile suffix must be 't', 'p', 'd', 'f', 'c' or "
+							"'r', got {}", arg[arg.size() - 1])
 			);
 		}
 
@@ -207,9 +318,50 @@ void parseArgs(int argc, char** argv)
 		tileSize[dim] = atoi(arg.c_str());
 	}
 
-	if (tileType[0] != 't' || tileType[1] != 't') {
+	if (tileType[0] == 'r' || tileType[1] == 'r' || tileType[2] == 'r') {
+		if (tileType[0] != 'r' || tileType[1] != 'r' || tileType[2] != 'r') {
+			throw std::invalid_argument(
+				"recursive tiling (suffix r) must be used in all dimensions"
+			);
+		}
+	}
+	else if (tileType[1] == 'p' || tileType[2] == 'f') {
+		// DiamondTorre
+		if (tileType[0] != 'd' || tileType[1] != 'p' || tileType[2] != 'f') {
+			throw std::invalid_argument(
+				"DiamondTorre must use diamond tiling (suffix d) in "
+				"dimension i, parallelogram tiling (suffix p) in dimension "
+				"j, and column tiling (suffix f) in dimension k"
+			);
+		}
+
+		// dimension k is not tiled
+		tileSize[2] = gridSize[2];
+	}
+	else {
+		if (tileType[0] != tileType[1] ||
+			(tileType[0] != 't' && tileType[0] != 'd' && tileType[0] != 'c')
+		) {
+			throw std::invalid_argument(
+				"dimension i and j only support trapezoid (suffix t), "
+				"diamond (suffix d) or DiamondCandy (suffix c) tiling"
+			);
+		}
+		if (tileType[2] != 'p' && tileType[2] != tileType[0]) {
+			throw std::invalid_argument(
+				"dimension k must use parallelogram tiling (suffix p), or "
+				"the same tiling as dimension i and j"
+			);
+		}
+		if (tileType[0] == 'c' && tileType[2] != 'c') {
+			throw std::invalid_argument(
+				"DiamondCandy (suffix c) must be used in all dimensions"
+			);
+		}
+	}
+	if ((tileType[0] == 'd' || tileType[0] == 'c') && tileHalfTs % 4 != 0) {
 		throw std::invalid_argument(
-			"dimension i and j only support trapezoid tiling (suffix t)"
+			"diamond tiling requires tile height to be a multiple of 4"
 		);
 	}
 }
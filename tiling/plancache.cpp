@@ -0,0 +1,301 @@
+// BSD Zero Clause License
+// 
+// Copyright (C) 2024 Yifeng Li
+// 
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "plancache.hpp"
+using namespace Tiling;
+
+// Increase the version whenever the file header or the FlatPlan3D layout
+// is changed, old files are then ignored and overwritten.
+static const uint32_t planFileVersion = 1;
+static const char planFileMagic[8] = {'D', 'I', 'A', 'M', 'P', 'L', 'A', 'N'};
+
+// Files are only portable between machines of the same byte order, which
+// is detected by this marker.
+static const uint32_t planFileByteOrder = 0x01020304;
+
+// The header is 256 bytes, so the FlatPlan3D buffer that follows is still
+// aligned to 64 bytes when the file is mapped at a page boundary.
+struct PlanFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t numStages, numTiles, numSubtiles, numRanges;
+	uint64_t bytes;
+	char key[200];
+};
+static_assert(sizeof(PlanFileHeader) == 256);
+
+const Plan1D&
+PlanCache::plan1D(
+	char tileType,
+	size_t totalWidth, size_t tileWidth,
+	size_t halfTimesteps, size_t alignment
+)
+{
+	Key1D key = {tileType, totalWidth, tileWidth, halfTimesteps, alignment};
+
+	auto it = m_plans1D.find(key);
+	if (it != m_plans1D.end()) {
+		return it->second;
+	}
+
+	Plan1D plan;
+	if (tileType == 'p') {
+		plan = computeParallelogramTiles(
+			totalWidth, tileWidth, halfTimesteps, alignment
+		);
+	}
+	else if (tileType == 't') {
+		plan = computeTrapezoidTiles(
+			totalWidth, tileWidth, halfTimesteps, alignment
+		);
+	}
+	else if (tileType == 'd') {
+		plan = computeDiamondTiles(
+			totalWidth, tileWidth, halfTimesteps, alignment
+		);
+	}
+	else if (tileType == 'f') {
+		plan = computeColumnTiles(totalWidth, halfTimesteps);
+	}
+	else {
+		throw std::invalid_argument(
+			std::string("unknown tile type ") + tileType
+		);
+	}
+
+	return m_plans1D.emplace(key, std::move(plan)).first->second;
+}
+
+const Plan3D&
+PlanCache::plan3D(
+	std::array<size_t, 3> gridSize,
+	std::array<size_t, 3> tileSize,
+	std::array<char, 3>   tileType,
+	size_t halfTimesteps,
+	const Builder& build,
+	const std::vector<std::array<size_t, 3>>& innerTileSizes,
+	size_t alignK
+)
+{
+	std::string name = key(
+		gridSize, tileSize, tileType, halfTimesteps, innerTileSizes, alignK
+	);
+
+	auto it = m_plans3D.find(name);
+	if (it != m_plans3D.end()) {
+		return it->second;
+	}
+
+	if (!m_dir.empty()) {
+		FlatPlan3D flatPlan;
+		if (load(name, flatPlan)) {
+			return m_plans3D.emplace(name, flatPlan.toPlan3D()).first->second;
+		}
+	}
+
+	Plan3D plan = build();
+	if (!m_dir.empty()) {
+		try {
+			save(name, FlatPlan3D(plan));
+		}
+		catch (const std::invalid_argument&) {
+			// not representable as a flat plan, don't persist it
+		}
+	}
+
+	return m_plans3D.emplace(name, std::move(plan)).first->second;
+}
+
+const FlatPlan3D&
+PlanCache::flatPlan3D(
+	std::array<size_t, 3> gridSize,
+	std::array<size_t, 3> tileSize,
+	std::array<char, 3>   tileType,
+	size_t halfTimesteps,
+	const Builder& build,
+	const std::vector<std::array<size_t, 3>>& innerTileSizes,
+	size_t alignK
+)
+{
+	std::string name = key(
+		gridSize, tileSize, tileType, halfTimesteps, innerTileSizes, alignK
+	);
+
+	auto it = m_flatPlans3D.find(name);
+	if (it != m_flatPlans3D.end()) {
+		return it->second;
+	}
+
+	FlatPlan3D flatPlan;
+	if (m_dir.empty() || !load(name, flatPlan)) {
+		flatPlan = FlatPlan3D(build());
+		if (!m_dir.empty()) {
+			save(name, flatPlan);
+		}
+	}
+
+	return m_flatPlans3D.emplace(name, std::move(flatPlan)).first->second;
+}
+
+std::string
+PlanCache::key(
+	std::array<size_t, 3> gridSize,
+	std::array<size_t, 3> tileSize,
+	std::array<char, 3>   tileType,
+	size_t halfTimesteps,
+	const std::vector<std::array<size_t, 3>>& innerTileSizes,
+	size_t alignK
+) const
+{
+	std::string key = "g";
+	for (size_t n = 0; n < 3; n++) {
+		key += std::to_string(gridSize[n]) + (n < 2 ? "x" : "");
+	}
+
+	key += "-t";
+	for (size_t n = 0; n < 3; n++) {
+		key += std::to_string(tileSize[n]) + tileType[n] + (n < 2 ? "x" : "");
+	}
+
+	key += "-h" + std::to_string(halfTimesteps);
+
+	for (std::array<size_t, 3> innerTileSize : innerTileSizes) {
+		key += "-r";
+		for (size_t n = 0; n < 3; n++) {
+			key += std::to_string(innerTileSize[n]) + (n < 2 ? "x" : "");
+		}
+	}
+
+	// omitted by default, so existing cache files are still found
+	if (alignK != 1) {
+		key += "-a" + std::to_string(alignK);
+	}
+	return key;
+}
+
+bool
+PlanCache::load(const std::string& key, FlatPlan3D& plan) const
+{
+	std::string path = m_dir + "/" + key + ".plan";
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(PlanFileHeader)) {
+		close(fd);
+		return false;
+	}
+
+	size_t size = st.st_size;
+	void* ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		return false;
+	}
+
+	// The mapping lives as long as the plan, or any copy of it.
+	std::shared_ptr<const uint8_t> mapping(
+		(const uint8_t*) ptr,
+		[size](const uint8_t* ptr) {
+			munmap((void*) ptr, size);
+		}
+	);
+
+	PlanFileHeader header;
+	std::memcpy(&header, mapping.get(), sizeof(header));
+
+	if (std::memcmp(header.magic, planFileMagic, sizeof(planFileMagic)) ||
+		header.version != planFileVersion ||
+		header.byteOrder != planFileByteOrder ||
+		std::strncmp(header.key, key.c_str(), sizeof(header.key)) != 0 ||
+		header.bytes != size - sizeof(header)
+	) {
+		return false;
+	}
+
+	FlatPlan3D::Counts counts = {
+		header.numStages, header.numTiles,
+		header.numSubtiles, header.numRanges
+	};
+
+	try {
+		plan = FlatPlan3D(
+			std::shared_ptr<const uint8_t>(
+				mapping, mapping.get() + sizeof(header)
+			),
+			header.bytes, counts
+		);
+	}
+	catch (const std::invalid_argument&) {
+		return false;
+	}
+
+	return true;
+}
+
+void
+PlanCache::save(const std::string& key, const FlatPlan3D& plan) const
+{
+	PlanFileHeader header;
+	std::memset(&header, 0, sizeof(header));
+
+	if (key.size() >= sizeof(header.key)) {
+		return;
+	}
+
+	std::memcpy(header.magic, planFileMagic, sizeof(planFileMagic));
+	header.version = planFileVersion;
+	header.byteOrder = planFileByteOrder;
+	header.numStages = plan.counts().numStages;
+	header.numTiles = plan.counts().numTiles;
+	header.numSubtiles = plan.counts().numSubtiles;
+	header.numRanges = plan.counts().numRanges;
+	header.bytes = plan.bytes();
+	std::memcpy(header.key, key.c_str(), key.size());
+
+	// Write to a temporary file first and rename it, so that concurrent
+	// runs of a parameter sweep never see a partially written file.
+	std::string path = m_dir + "/" + key + ".plan";
+	std::string tmpPath = path + ".tmp." + std::to_string(getpid());
+
+	// The cache is only an optimization, errors are silently ignored.
+	FILE* file = fopen(tmpPath.c_str(), "wb");
+	if (!file) {
+		return;
+	}
+
+	bool success = true;
+	success &= fwrite(&header, sizeof(header), 1, file) == 1;
+	success &= fwrite(plan.data(), plan.bytes(), 1, file) == 1;
+	success &= fclose(file) == 0;
+
+	if (!success || rename(tmpPath.c_str(), path.c_str()) != 0) {
+		remove(tmpPath.c_str());
+	}
+}
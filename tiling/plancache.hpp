@@ -0,0 +1,103 @@
+// BSD Zero Clause License
+// 
+// Copyright (C) 2024 Yifeng Li
+// 
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef PLANCACHE_HPP
+#define PLANCACHE_HPP
+
+#include <array>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <functional>
+
+#include "tiling.hpp"
+
+namespace Tiling {
+	// Memoize plans by their parameters, so identical plans are only
+	// computed once per process, e.g. dimension i and j of a cubic grid.
+	//
+	// If a directory is given, 3D plans are also saved there as FlatPlan3D
+	// files, and later processes memory-map them instead of computing them
+	// again, which is useful for parameter sweeps with many short runs.
+	class PlanCache
+	{
+	public:
+		PlanCache(std::string dir = "") : m_dir(dir) {}
+
+		// 1D plan of the given tile type: parallelogram ('p'), trapezoid
+		// ('t'), diamond ('d') or column ('f') tiling, with the tile edges
+		// aligned to alignment, see tiling.hpp.
+		const Plan1D& plan1D(
+			char tileType,
+			size_t totalWidth, size_t tileWidth,
+			size_t halfTimesteps, size_t alignment = 1
+		);
+
+		// 3D plan identified by the grid size, tile size, tile type,
+		// tile height, the inner tile sizes of refineTiles(), if any, and
+		// the alignment of the tile edges in dimension k.
+		// build() is only called if it's not cached. It must be a pure
+		// function of these parameters, otherwise different plans would
+		// share the same cache entry.
+		using Builder = std::function<Plan3D()>;
+
+		const Plan3D& plan3D(
+			std::array<size_t, 3> gridSize,
+			std::array<size_t, 3> tileSize,
+			std::array<char, 3>   tileType,
+			size_t halfTimesteps,
+			const Builder& build,
+			const std::vector<std::array<size_t, 3>>& innerTileSizes = {},
+			size_t alignK = 1
+		);
+
+		// Same as above, but the plan is flat. If it's loaded from the
+		// cache directory, it's used in place in the memory-mapped file.
+		const FlatPlan3D& flatPlan3D(
+			std::array<size_t, 3> gridSize,
+			std::array<size_t, 3> tileSize,
+			std::array<char, 3>   tileType,
+			size_t halfTimesteps,
+			const Builder& build,
+			const std::vector<std::array<size_t, 3>>& innerTileSizes = {},
+			size_t alignK = 1
+		);
+
+	private:
+		std::string key(
+			std::array<size_t, 3> gridSize,
+			std::array<size_t, 3> tileSize,
+			std::array<char, 3>   tileType,
+			size_t halfTimesteps,
+			const std::vector<std::array<size_t, 3>>& innerTileSizes,
+			size_t alignK
+		) const;
+
+		// Load a flat plan from the cache directory, return false if the
+		// file doesn't exist or is incompatible.
+		bool load(const std::string& key, FlatPlan3D& plan) const;
+		void save(const std::string& key, const FlatPlan3D& plan) const;
+
+		std::string m_dir;
+
+		using Key1D = std::tuple<char, size_t, size_t, size_t, size_t>;
+		std::map<Key1D, Plan1D> m_plans1D;
+		std::map<std::string, Plan3D> m_plans3D;
+		std::map<std::string, FlatPlan3D> m_flatPlans3D;
+	};
+}
+
+#endif  // PLANCACHE_HPP
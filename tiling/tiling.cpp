@@ -14,17 +14,39 @@
 // PERFORMANCE OF THIS SOFTWARE.
 
 #include <cassert>
+#include <cstdlib>
+#include <algorithm>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <functional>
 
 #ifndef TILING_HEADER_ONLY
 #include "tiling.hpp"
 #endif
 using namespace Tiling;
 
+// Move the last cell of a tile at the 1st half timestep to the right, so
+// that the edge to the next tile is aligned to a multiple of alignment
+// after shifting by phase units to the left, see alignment in tiling.hpp.
+static size_t
+alignTileEnd(size_t last, size_t alignment, size_t phase, size_t totalWidth)
+{
+	if (alignment == 1) {
+		return last;
+	}
+
+	size_t edge = last + 1;
+	edge = (edge - phase + alignment - 1) / alignment * alignment + phase;
+	return std::min(edge - 1, totalWidth - 1);
+}
+
 Plan1D
 Tiling::computeParallelogramTiles(
 	size_t totalWidth, size_t tileWidth,
-	size_t halfTimesteps
+	size_t halfTimesteps, size_t alignment
 )
 {
 	const size_t tileMinWidth = tileWidth - halfTimesteps / 2;
@@ -40,12 +62,20 @@ Tiling::computeParallelogramTiles(
 			"Timestep size is too large for tile size."
 		);
 	}
+	if (alignment == 0) {
+		throw std::invalid_argument("alignment must be at least 1.");
+	}
+
+	// All edges shift 1 unit to the left at odd timesteps, so they're
+	// aligned after the 1st shift.
+	const size_t phase = 1;
 
 	TileList1D tileList;
 	Range1D<size_t> range = {
 		0,
 		std::min(tileMaxWidth - 1, totalWidth - 1)
 	};
+	range.last = alignTileEnd(range.last, alignment, phase, totalWidth);
 
 	// Split totalWidth into tiles, each is tileMinWidth long.
 	while (range.first <= totalWidth - 1) {
@@ -55,10 +85,11 @@ Tiling::computeParallelogramTiles(
 
 		// create 1st half timestep within tile
 		tile.push_back(range);
-		tileList.push_back(tile);
+		tileList.push_back(std::move(tile));
 
 		range.first = range.last + 1;
 		range.last = std::min(range.last + tileMinWidth, totalWidth - 1);
+		range.last = alignTileEnd(range.last, alignment, phase, totalWidth);
 	}
 
 	// Iterate all tiles and complete the remaining half timesteps ranges
@@ -118,14 +149,14 @@ Tiling::computeParallelogramTiles(
 
 	// parallelogram tiling only has 1 stage
 	Plan1D plan(1);
-	plan[0] = tileList;
+	plan[0] = std::move(tileList);
 	return plan;
 }
 
 Plan1D
 Tiling::computeTrapezoidTiles(
 	size_t totalWidth, size_t tileWidth,
-	size_t halfTimesteps
+	size_t halfTimesteps, size_t alignment
 )
 {
 	const size_t tileMinWidth = tileWidth - halfTimesteps + 1;
@@ -143,12 +174,22 @@ Tiling::computeTrapezoidTiles(
 			"Timestep size is too large for tile size."
 		);
 	}
+	if (alignment == 0) {
+		throw std::invalid_argument("alignment must be at least 1.");
+	}
+
+	// The right edge of a mountain shifts 1 unit to the left at odd
+	// timesteps, so it's aligned after the 1st shift. The left edge
+	// shifts to the right at even timesteps, it's aligned before.
+	const size_t mountainPhase = 1;
+	const size_t valleyPhase = 0;
 
 	TileList1D tileList;
 	Range1D<size_t> range = {
 		0,
 		std::min(tileMaxWidth - 1, totalWidth)
 	};
+	range.last = alignTileEnd(range.last, alignment, mountainPhase, totalWidth);
 
 	while (range.first <= totalWidth - 1) {
 		// create tile
@@ -157,7 +198,7 @@ Tiling::computeTrapezoidTiles(
 
 		// create 1st half timestep within tile
 		tile.push_back(range);
-		tileList.push_back(tile);
+		tileList.push_back(std::move(tile));
 
 		range.first = range.last + 1;
 		if (tileList.size() % 2 == 0 || totalWidth == tileWidth) {
@@ -165,12 +206,18 @@ Tiling::computeTrapezoidTiles(
 				range.first + tileMaxWidth - 1,
 				totalWidth - 1
 			);
+			range.last = alignTileEnd(
+				range.last, alignment, mountainPhase, totalWidth
+			);
 		}
 		else {
 			range.last = std::min(
 				range.first + tileMinWidth - 1,
 				totalWidth - 1
 			);
+			range.last = alignTileEnd(
+				range.last, alignment, valleyPhase, totalWidth
+			);
 
 			// Another special edge case: if tile (n - 1) is a valley
 			// and it eventually expands to the rightmost cell, the
@@ -253,11 +300,240 @@ Tiling::computeTrapezoidTiles(
 	for (size_t tileId = 0; tileId < tileList.size(); tileId++) {
 		if (tileId % 2 == 0) {
 			/* all mountain blocks go to stage 1 */
-			plan[0].push_back(tileList[tileId]);
+			plan[0].push_back(std::move(tileList[tileId]));
 		}
 		else {
 			/* all valley blocks go to stage 2 */
-			plan[1].push_back(tileList[tileId]);
+			plan[1].push_back(std::move(tileList[tileId]));
+		}
+	}
+
+	return plan;
+}
+
+Plan1D
+Tiling::computeDiamondTiles(
+	size_t totalWidth, size_t tileWidth,
+	size_t halfTimesteps, size_t alignment
+)
+{
+	if (halfTimesteps % 4 != 0) {
+		throw std::invalid_argument(
+			"halfTimesteps must be a multiple of 4."
+		);
+	}
+
+	// The lower half of the batch is exactly a trapezoid tiling, the
+	// mountains are the lower halves between two diamonds, the valleys
+	// are the lower halves of the diamonds.
+	const size_t halfHeight = halfTimesteps / 2;
+	Plan1D trapezoid = computeTrapezoidTiles(
+		totalWidth, tileWidth, halfHeight, alignment
+	);
+
+	std::vector<const Tile1D*> tileList;
+	for (const TileList1D& stage : trapezoid) {
+		for (const Tile1D& tile : stage) {
+			if (tile.id() >= tileList.size()) {
+				tileList.resize(tile.id() + 1);
+			}
+			tileList[tile.id()] = &tile;
+		}
+	}
+
+	// diamond tiling has 3 stages
+	Plan1D plan(3);
+
+	for (size_t tileId = 0; tileId < tileList.size(); tileId++) {
+		const Tile1D& lowerTile = *tileList[tileId];
+
+		// Mountains become valleys in the upper half, valleys become
+		// mountains. The upper half between two diamonds is a new tile,
+		// but the diamond itself is the same tile.
+		bool mountain = tileId % 2 == 0;
+		Tile1D tile(tileId, mountain ? halfHeight : 0);
+		if (!mountain) {
+			tile = lowerTile;
+		}
+		tile.reserve(halfTimesteps);
+
+		// The last range of the lower half may have been truncated at
+		// the right boundary, recover it.
+		Range1D<size_t> prevRange = lowerTile[halfHeight - 1];
+		if (tileId == tileList.size() - 1) {
+			prevRange.last = totalWidth - 1;
+		}
+
+		for (size_t halfTs = halfHeight; halfTs < halfTimesteps; halfTs++) {
+			Range1D<ssize_t> shift;
+
+			if (!mountain) {
+				// upper half of diamond, shrink like a mountain
+				if (halfTs % 2 == 1) {
+					// timestep is odd, shrink right edge by 1 unit
+					shift = Range1D<ssize_t>{0, -1};
+				}
+				else {
+					// timestep is even, shrink left edge by 1 unit
+					shift = Range1D<ssize_t>{1, 0};
+				}
+			}
+			else {
+				// upper half between diamonds, grow like a valley
+				if (halfTs % 2 == 1) {
+					// timestep is odd, grow left edge by 1 unit
+					shift = Range1D<ssize_t>{-1, 0};
+				}
+				else {
+					// timestep is even, grow right edge by 1 unit
+					shift = Range1D<ssize_t>{0, 1};
+				}
+			}
+
+			if (tileId == 0) {
+				shift.first = 0;
+			}
+			if (tileId == tileList.size() - 1
+				|| prevRange.last + shift.last > totalWidth - 1
+			) {
+				shift.last = 0;
+			}
+
+			Range1D<size_t> currRange = {
+				prevRange.first + shift.first,
+				prevRange.last + shift.last
+			};
+
+			// In FDTD, the last magnetic cells at the right boundary
+			// depends on cells outside the simulation grid, so they can't
+			// be calculated. Remove these cells.
+			if (halfTs % 2 == 1 && currRange.last > totalWidth - 2) {
+				tile.push_back({currRange.first, totalWidth - 2});
+			}
+			else {
+				tile.push_back(currRange);
+			}
+
+			prevRange = currRange;
+		}
+
+		if (mountain) {
+			/* lower halves between diamonds go to stage 1 */
+			plan[0].push_back(lowerTile);
+			/* upper halves between diamonds go to stage 3 */
+			plan[2].push_back(std::move(tile));
+		}
+		else {
+			/* diamonds go to stage 2 */
+			plan[1].push_back(std::move(tile));
+		}
+	}
+
+	return plan;
+}
+
+Plan1D
+Tiling::computeColumnTiles(size_t totalWidth, size_t halfTimesteps)
+{
+	if (halfTimesteps % 2 != 0) {
+		throw std::invalid_argument(
+			"halfTimesteps must be even."
+		);
+	}
+
+	Tile1D tile(/* id= */ 0);
+	tile.reserve(halfTimesteps);
+
+	for (size_t halfTs = 0; halfTs < halfTimesteps; halfTs++) {
+		if (halfTs % 2 == 0) {
+			tile.push_back({0, totalWidth - 1});
+		}
+		else {
+			// In FDTD, the last magnetic cells at the right boundary
+			// depends on cells outside the simulation grid, so they
+			// can't be calculated. Remove these cells.
+			tile.push_back({0, totalWidth - 2});
+		}
+	}
+
+	// column tiling only has 1 stage with 1 tile
+	Plan1D plan(1);
+	plan[0].push_back(std::move(tile));
+	return plan;
+}
+
+// Run job(idx) for each idx in [0, numJobs), on up to numThreads threads.
+// The first exception thrown by any job is rethrown in the caller.
+static void
+parallelFor(
+	size_t numJobs, size_t numThreads,
+	const std::function<void(size_t)>& job
+)
+{
+	if (numThreads <= 1 || numJobs <= 1) {
+		for (size_t idx = 0; idx < numJobs; idx++) {
+			job(idx);
+		}
+		return;
+	}
+
+	std::atomic<size_t> nextJob = 0;
+	std::exception_ptr error;
+	std::mutex errorMutex;
+
+	auto worker = [&]() {
+		for (size_t idx = nextJob++; idx < numJobs; idx = nextJob++) {
+			try {
+				job(idx);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+				nextJob = numJobs;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t n = 0; n < std::min(numThreads, numJobs); n++) {
+		threads.emplace_back(worker);
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+// A row of 3D tiles sharing the same 1D tile in dimension I. Rows are
+// independent of each other, and the ID of their first subtile is known
+// before they're built, so they can be built in any order.
+struct TileRow3D
+{
+	size_t stage;
+	size_t idxI;
+	size_t firstSubtileId;
+};
+
+// Concatenate all rows in order, the result doesn't depend on which
+// thread has built which row.
+static Plan3D
+gatherTileRows(
+	size_t numStages,
+	const std::vector<TileRow3D>& rows,
+	std::vector<TileList3D>& rowTiles
+)
+{
+	Plan3D plan(numStages);
+
+	for (size_t rowIdx = 0; rowIdx < rows.size(); rowIdx++) {
+		TileList3D& tileListIJK = plan[rows[rowIdx].stage];
+		for (Tile3D& tile : rowTiles[rowIdx]) {
+			tileListIJK.push_back(std::move(tile));
 		}
 	}
 
@@ -265,66 +541,92 @@ Tiling::computeTrapezoidTiles(
 }
 
 Plan3D
-Tiling::combineTilesTTT(const Plan1D& i, const Plan1D& j, const Plan1D& k)
+Tiling::combineTilesTTT(
+	const Plan1D& i, const Plan1D& j, const Plan1D& k,
+	size_t numThreads
+)
 {
 	if (i.size() != 2 || j.size() != 2 || k.size() != 2) {
 		throw std::invalid_argument("i/j/k must be trapezoid tiles.");
 	}
 
-	Plan3D plan(8);
+	// 3-to-8 decoder:
+	// Each dimension has two stages, mountain and valley.
+	// Select a 3-tuple from all 8 possible combinations. 
+	auto decode = [&](size_t stage) {
+		return std::array<const TileList1D*, 3>{
+			&i[(stage >> 2) & 0x01],  // [0, 1]
+			&j[(stage >> 1) & 0x01],  // [0, 1]
+			&k[(stage >> 0) & 0x01]   // [0, 1]
+		};
+	};
+
+	std::vector<TileRow3D> rows;
 	size_t globalSubtileId = 0;
 
 	for (size_t stage = 0; stage < 8; stage++) {
-		// 3-to-8 decoder:
-		// Each dimension has two stages, mountain and valley.
-		// Select a 3-tuple from all 8 possible combinations. 
-		const TileList1D& tileListI = i[(stage >> 2) & 0x01];  // [0, 1]
-		const TileList1D& tileListJ = j[(stage >> 1) & 0x01];  // [0, 1]
-		const TileList1D& tileListK = k[(stage >> 0) & 0x01];  // [0, 1]
-		TileList3D& tileListIJK = plan[stage];
-
-		for (const Tile1D& tileI : tileListI) {
-			for (const Tile1D& tileJ : tileListJ) {
-				for (const Tile1D& tileK : tileListK) {
-					if (tileI.size() != tileJ.size() ||
-						tileJ.size() != tileK.size()
-					) {
-						throw std::invalid_argument(
-							"all tiles must be time-aligned."
-						);
-					}
-						
-					Subtile3D subtile(globalSubtileId);
-					globalSubtileId++;
+		auto [tileListI, tileListJ, tileListK] = decode(stage);
 
-					for (size_t halfTs = 0; halfTs < tileI.size(); halfTs++) {
-						subtile.push_back(Range3D<size_t>{
-							{
-								tileI[halfTs].first,
-								tileJ[halfTs].first,
-								tileK[halfTs].first
-							},
-							{
-								tileI[halfTs].last,
-								tileJ[halfTs].last,
-								tileK[halfTs].last
-							}
-						});
-					}
+		for (size_t idxI = 0; idxI < tileListI->size(); idxI++) {
+			rows.push_back({stage, idxI, globalSubtileId});
+			globalSubtileId += tileListJ->size() * tileListK->size();
+		}
+	}
+
+	std::vector<TileList3D> rowTiles(rows.size());
+
+	parallelFor(rows.size(), numThreads, [&](size_t rowIdx) {
+		auto [tileListI, tileListJ, tileListK] = decode(rows[rowIdx].stage);
+		const Tile1D& tileI = (*tileListI)[rows[rowIdx].idxI];
+		size_t globalSubtileId = rows[rowIdx].firstSubtileId;
+
+		TileList3D& tileListIJK = rowTiles[rowIdx];
+		tileListIJK.reserve(tileListJ->size() * tileListK->size());
+
+		for (const Tile1D& tileJ : *tileListJ) {
+			for (const Tile1D& tileK : *tileListK) {
+				if (tileI.size() != tileJ.size() ||
+					tileJ.size() != tileK.size()
+				) {
+					throw std::invalid_argument(
+						"all tiles must be time-aligned."
+					);
+				}
 
-					Tile3D tile({tileI.id(), tileJ.id(), tileK.id()});
-					tile.push_back(subtile);
-					tileListIJK.push_back(tile);
+				Subtile3D subtile(globalSubtileId);
+				subtile.reserve(tileI.size());
+				globalSubtileId++;
+
+				for (size_t halfTs = 0; halfTs < tileI.size(); halfTs++) {
+					subtile.push_back(Range3D<size_t>{
+						{
+							tileI[halfTs].first,
+							tileJ[halfTs].first,
+							tileK[halfTs].first
+						},
+						{
+							tileI[halfTs].last,
+							tileJ[halfTs].last,
+							tileK[halfTs].last
+						}
+					});
 				}
+
+				Tile3D tile({tileI.id(), tileJ.id(), tileK.id()});
+				tile.push_back(std::move(subtile));
+				tileListIJK.push_back(std::move(tile));
 			}
 		}
-	}
+	});
 
-	return plan;
+	return gatherTileRows(8, rows, rowTiles);
 }
 
 Plan3D
-Tiling::combineTilesTTP(const Plan1D& i, const Plan1D& j, const Plan1D& k)
+Tiling::combineTilesTTP(
+	const Plan1D& i, const Plan1D& j, const Plan1D& k,
+	size_t numThreads
+)
 {
 	if (i.size() != 2 || j.size() != 2 || k.size() != 1) {
 		throw std::invalid_argument(
@@ -332,101 +634,1233 @@ Tiling::combineTilesTTP(const Plan1D& i, const Plan1D& j, const Plan1D& k)
 		);
 	}
 
-	Plan3D plan(4);
+	// 2-to-4 decoder:
+	// Each dimension has two stages, mountain and valley.
+	// Select a 2-tuple from all 4 possible combinations. 
+	//
+	// The last dimension uses parallelogram instead of trapezoid
+	// tiling, so it only has 1 stage and must be executed in serial
+	// rather parallel.
+	auto decode = [&](size_t stage) {
+		return std::array<const TileList1D*, 3>{
+			&i[(stage >> 1) & 0x01],  // [0, 1]
+			&j[(stage >> 0) & 0x01],  // [0, 1]
+			&k[0]
+		};
+	};
+
+	std::vector<TileRow3D> rows;
 	size_t globalSubtileId = 0;
 
 	for (size_t stage = 0; stage < 4; stage++) {
-		// 2-to-4 decoder:
-		// Each dimension has two stages, mountain and valley.
-		// Select a 2-tuple from all 4 possible combinations. 
-		const TileList1D& tileListI = i[(stage >> 1) & 0x01];  // [0, 1]
-		const TileList1D& tileListJ = j[(stage >> 0) & 0x01];  // [0, 1]
-
-		// The last dimension uses parallelogram instead of trapezoid
-		// tiling, so it only has 1 stage and must be executed in serial
-		// rather parallel.
-		const TileList1D& tileListK = k[0];
-		TileList3D& tileListIJK = plan[stage];
+		auto [tileListI, tileListJ, tileListK] = decode(stage);
+
+		for (size_t idxI = 0; idxI < tileListI->size(); idxI++) {
+			rows.push_back({stage, idxI, globalSubtileId});
+			globalSubtileId += tileListJ->size() * tileListK->size();
+		}
+	}
+
+	std::vector<TileList3D> rowTiles(rows.size());
+
+	parallelFor(rows.size(), numThreads, [&](size_t rowIdx) {
+		auto [tileListI, tileListJ, tileListK] = decode(rows[rowIdx].stage);
+		const Tile1D& tileI = (*tileListI)[rows[rowIdx].idxI];
+		size_t globalSubtileId = rows[rowIdx].firstSubtileId;
+
+		TileList3D& tileListIJK = rowTiles[rowIdx];
+		tileListIJK.reserve(tileListJ->size());
 
 		// Instead of combining every tiles from I, J, K dimensions with
 		// each other, here, only I and J dimensions are combined, then
 		// each 2D tile is combined with all 1D tiles from dimension K
 		// as a whole to create a single 3D tile.
-		for (const Tile1D& tileI : tileListI) {
-			for (const Tile1D& tileJ : tileListJ) {
-				Tile3D tile({tileI.id(), tileJ.id(), 0});
+		for (const Tile1D& tileJ : *tileListJ) {
+			Tile3D tile({tileI.id(), tileJ.id(), 0});
+			tile.reserve(tileListK->size());
+
+			for (const Tile1D& tileK : *tileListK) {
+				Subtile3D subtile(globalSubtileId);
+				subtile.reserve(tileI.size());
+				globalSubtileId++;
+
+				for (size_t halfTs = 0; halfTs < tileI.size(); halfTs++) {
+					if (tileI.size() != tileJ.size() ||
+						tileJ.size() != tileK.size()
+					) {
+						throw std::invalid_argument(
+							"all tiles must be time-aligned."
+						);
+					}
+
+					subtile.push_back(Range3D<size_t>{
+						{
+							tileI[halfTs].first,
+							tileJ[halfTs].first,
+							tileK[halfTs].first
+						},
+						{
+							tileI[halfTs].last,
+							tileJ[halfTs].last,
+							tileK[halfTs].last
+						}
+					});
+				}
+				tile.push_back(std::move(subtile));
+			}
+			tileListIJK.push_back(std::move(tile));
+		}
+	});
+
+	return gatherTileRows(4, rows, rowTiles);
+}
+
+// Combine 1D tiles that may not span the entire batch. A 3D subtile only
+// exists at the halfTs where all its 1D tiles exist. Each dimension may
+// have any number of stages, all combinations of them are visited in
+// lexicographical order, which is the same order as combineTilesTTT().
+// If serialDim is 1 or 2, like combineTilesTTP(), this dimension is not
+// decoded, all its 1D tiles are combined with each 2D tile of the other
+// two dimensions as a whole to create a single 3D tile, and executed in
+// serial. If serialDim is 3, all dimensions are decoded.
+// If byLevel is true, stages are merged into concurrency levels: the
+// dependencies of a product of 1D tilings follow the product order of
+// their 1D stages, so all combinations with the same sum of 1D stage
+// numbers are independent and can run concurrently.
+static Plan3D
+combineTilesStaged(
+	const Plan1D& i, const Plan1D& j, const Plan1D& k,
+	size_t serialDim, bool byLevel
+)
+{
+	const std::array<const Plan1D*, 3> plan1D = {&i, &j, &k};
+
+	std::array<size_t, 3> stagesIJK;
+	size_t numStages = 1;
+	for (size_t n = 0; n < 3; n++) {
+		stagesIJK[n] = n == serialDim ? 1 : plan1D[n]->size();
+		numStages *= stagesIJK[n];
+	}
+
+	size_t numLevels = 1;
+	for (size_t n = 0; n < 3; n++) {
+		numLevels += stagesIJK[n] - 1;
+	}
+
+	Plan3D plan;
+	Plan3D levels(byLevel ? numLevels : 0);
+	size_t globalSubtileId = 0;
+
+	for (size_t stage = 0; stage < numStages; stage++) {
+		// Decode the stage number, the last dimension is the least
+		// significant digit. The serial dimension contributes all of
+		// its tiles, stage by stage.
+		std::array<std::vector<const Tile1D*>, 3> tileListIJK;
+		size_t level = 0;
+		size_t digits = stage;
+		for (size_t n = 3; n-- > 0;) {
+			level += digits % stagesIJK[n];
+			for (size_t stageN = 0; stageN < plan1D[n]->size(); stageN++) {
+				if (n != serialDim && stageN != digits % stagesIJK[n]) {
+					continue;
+				}
+				for (const Tile1D& tile : (*plan1D[n])[stageN]) {
+					tileListIJK[n].push_back(&tile);
+				}
+			}
+			digits /= stagesIJK[n];
+		}
+
+		TileList3D tileList3D;
+		std::map<std::array<size_t, 3>, size_t> idToTile;
+
+		for (const Tile1D* tileI : tileListIJK[0]) {
+			for (const Tile1D* tileJ : tileListIJK[1]) {
+				for (const Tile1D* tileK : tileListIJK[2]) {
+					std::array<const Tile1D*, 3> tileIJK = {
+						tileI, tileJ, tileK
+					};
+
+					size_t firstHalfTs = 0;
+					size_t lastHalfTs = SIZE_MAX;
+					for (const Tile1D* tile : tileIJK) {
+						firstHalfTs = std::max(
+							firstHalfTs, tile->firstHalfTs()
+						);
+						lastHalfTs = std::min(
+							lastHalfTs, tile->firstHalfTs() + tile->size()
+						);
+					}
+					if (firstHalfTs >= lastHalfTs) {
+						// never exist at the same time
+						continue;
+					}
 
-				for (const Tile1D& tileK : tileListK) {
 					Subtile3D subtile(globalSubtileId);
+					subtile.firstHalfTs = firstHalfTs;
+					subtile.reserve(lastHalfTs - firstHalfTs);
 					globalSubtileId++;
 
-					for (size_t halfTs = 0; halfTs < tileI.size(); halfTs++) {
-						if (tileI.size() != tileJ.size() ||
-							tileJ.size() != tileK.size()
-						) {
-							throw std::invalid_argument(
-								"all tiles must be time-aligned."
-							);
+					for (size_t halfTs = firstHalfTs;
+						 halfTs < lastHalfTs;
+						 halfTs++
+					) {
+						Range3D<size_t> range;
+						for (size_t n = 0; n < 3; n++) {
+							const Tile1D& tile = *tileIJK[n];
+							const Range1D<size_t>& range1D =
+								tile[halfTs - tile.firstHalfTs()];
+
+							range.first[n] = range1D.first;
+							range.last[n] = range1D.last;
 						}
+						subtile.push_back(range);
+					}
+
+					std::array<size_t, 3> id = {
+						tileI->id(), tileJ->id(), tileK->id()
+					};
+					if (serialDim < 3) {
+						id[serialDim] = 0;
+					}
 
-						subtile.push_back(Range3D<size_t>{
-							{
-								tileI[halfTs].first,
-								tileJ[halfTs].first,
-								tileK[halfTs].first
-							},
-							{
-								tileI[halfTs].last,
-								tileJ[halfTs].last,
-								tileK[halfTs].last
-							}
-						});
+					auto it = idToTile.find(id);
+					if (it == idToTile.end()) {
+						it = idToTile.emplace(id, tileList3D.size()).first;
+						tileList3D.push_back(Tile3D(id));
 					}
-					tile.push_back(subtile);
+					tileList3D[it->second].push_back(std::move(subtile));
 				}
-				tileListIJK.push_back(tile);
 			}
 		}
+
+		if (byLevel) {
+			for (Tile3D& tile : tileList3D) {
+				levels[level].push_back(std::move(tile));
+			}
+		}
+		else if (tileList3D.size() > 0) {
+			plan.push_back(std::move(tileList3D));
+		}
+	}
+
+	for (TileList3D& tileList : levels) {
+		if (tileList.size() > 0) {
+			plan.push_back(std::move(tileList));
+		}
 	}
 
 	return plan;
 }
 
 Plan3D
-Tiling::toLocalCoords(Plan3D plan)
+Tiling::combineTilesDDD(const Plan1D& i, const Plan1D& j, const Plan1D& k)
 {
-	for (TileList3D& tileList : plan) {
-		for (Tile3D& tile : tileList) {
-			for (Subtile3D& subtile : tile) {
-				for (Range3D<size_t>& range : subtile) {
-					for (size_t n = 0; n < 3; n++) {
-						range.first[n] = 0;
-						range.last[n] = range.last[n] - subtile.first[n];
-					}
-				}
-			}
-		}
+	if (i.size() != 3 || j.size() != 3 || k.size() != 3) {
+		throw std::invalid_argument("i/j/k must be diamond tiles.");
 	}
 
-	return plan;
+	// 27 stages, but some are empty since the lower and upper halves
+	// between diamonds never exist at the same time.
+	return combineTilesStaged(i, j, k, /* serialDim= */ 3, /* byLevel= */ false);
 }
 
-void
-Tiling::visualizeTiles(
-	const Plan1D& plan,
-	size_t totalWidth, size_t tileWidth,
-	size_t halfTimesteps
+Plan3D
+Tiling::combineTilesDDP(const Plan1D& i, const Plan1D& j, const Plan1D& k)
+{
+	if (i.size() != 3 || j.size() != 3 || k.size() != 1) {
+		throw std::invalid_argument(
+			"i/j must be diamond tiles, k must be parallelogram tiles."
+		);
+	}
+
+	// 9 stages, the last dimension uses parallelogram tiling, so it's
+	// executed in serial within each 3D tile, like combineTilesTTP().
+	return combineTilesStaged(i, j, k, /* serialDim= */ 2, /* byLevel= */ false);
+}
+
+Plan3D
+Tiling::combineTilesDiamondTorre(
+	const Plan1D& i, const Plan1D& j, const Plan1D& k
 )
 {
-	char simSpace[halfTimesteps][totalWidth];
+	if ((i.size() != 3 && i.size() != 2) || j.size() != 1 ||
+		k.size() != 1 || k[0].size() != 1
+	) {
+		throw std::invalid_argument(
+			"i must be diamond or trapezoid tiles, j must be parallelogram "
+			"tiles, k must be a column tile."
+		);
+	}
 
-	for (size_t halfTs = 0; halfTs < halfTimesteps; halfTs++) {
-		for (size_t pos = 0; pos < totalWidth; pos++) {
-			simSpace[halfTs][pos] = '!';
+	// Each 3D tile is a tower of diamond (x-t) cross-sections, which
+	// sweeps through dimension J in serial, one parallelogram at a time.
+	// Dimension K is never split.
+	return combineTilesStaged(i, j, k, /* serialDim= */ 1, /* byLevel= */ false);
+}
+
+// Interleave the bits of a 3D tile ID, so that sorting tiles by this
+// key visits them in Z-order.
+static uint64_t
+mortonCode(std::array<size_t, 3> id)
+{
+	uint64_t code = 0;
+	for (size_t bit = 0; bit < 21; bit++) {
+		for (size_t n = 0; n < 3; n++) {
+			code |= (uint64_t) ((id[n] >> bit) & 0x01) << (bit * 3 + 2 - n);
 		}
 	}
+	return code;
+}
+
+Plan3D
+Tiling::combineTilesDiamondCandy(
+	const Plan1D& i, const Plan1D& j, const Plan1D& k
+)
+{
+	if (i.size() != 3 || j.size() != 3 || k.size() != 3) {
+		throw std::invalid_argument("i/j/k must be diamond tiles.");
+	}
+
+	// Same tiles as combineTilesDDD(), but the 27 stages are merged
+	// into 7 concurrency levels.
+	Plan3D plan = combineTilesStaged(
+		i, j, k, /* serialDim= */ 3, /* byLevel= */ true
+	);
+
+	// Executors hand out tiles to threads in order. Sort each level in
+	// Z-order, so candies that run at the same time are close to each
+	// other and share their boundaries in the last-level cache.
+	for (TileList3D& tileList : plan) {
+		std::stable_sort(tileList.begin(), tileList.end(),
+			[](const Tile3D& a, const Tile3D& b) {
+				return mortonCode(a.id()) < mortonCode(b.id());
+			}
+		);
+	}
+
+	return plan;
+}
+
+// The skew of parallelogram tiling: ranges move 1 cell to the left at
+// each odd halfTs. In coordinates shifted by this skew, no cell depends
+// on a cell with a larger coordinate in any dimension, and no cell is
+// overwritten by a cell with a smaller one.
+static size_t
+skewOf(size_t halfTs)
+{
+	return (halfTs + 1) / 2;
+}
+
+// Bounding box of a subtile in skewed coordinates, returns false if all
+// of its ranges are empty.
+static bool
+skewedBoundingBox(
+	const Subtile3D& subtile,
+	std::array<size_t, 3>& skewedFirst, std::array<size_t, 3>& skewedLast
+)
+{
+	skewedFirst = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
+	skewedLast = {0, 0, 0};
+
+	for (size_t idx = 0; idx < subtile.size(); idx++) {
+		const Range3D<size_t>& range = subtile[idx];
+		if (range.empty()) {
+			continue;
+		}
+
+		size_t skew = skewOf(subtile.firstHalfTs + idx);
+		for (size_t n = 0; n < 3; n++) {
+			skewedFirst[n] = std::min(skewedFirst[n], range.first[n] + skew);
+			skewedLast[n] = std::max(skewedLast[n], range.last[n] + skew);
+		}
+	}
+
+	return skewedFirst[0] != SIZE_MAX;
+}
+
+// Clip a subtile to a window in skewed coordinates, the parts of its
+// ranges outside of the window become empty. Leading and trailing empty
+// ranges are removed, but volt and curr ranges are kept in pairs. If
+// nothing is within the window, the returned subtile has no ranges.
+static Subtile3D
+clipSubtile(
+	const Subtile3D& subtile,
+	std::array<size_t, 3> windowFirst, std::array<size_t, 3> windowLast,
+	size_t id
+)
+{
+	std::vector<Range3D<size_t>> ranges(subtile.size());
+	std::vector<bool> empty(subtile.size(), true);
+	size_t firstIdx = SIZE_MAX;
+	size_t lastIdx = 0;
+
+	for (size_t idx = 0; idx < subtile.size(); idx++) {
+		const Range3D<size_t>& range = subtile[idx];
+		if (range.empty()) {
+			continue;
+		}
+
+		size_t skew = skewOf(subtile.firstHalfTs + idx);
+		bool inside = true;
+		for (size_t n = 0; n < 3; n++) {
+			size_t first = std::max(range.first[n] + skew, windowFirst[n]);
+			size_t last = std::min(range.last[n] + skew, windowLast[n]);
+
+			if (first > last) {
+				inside = false;
+				break;
+			}
+			ranges[idx].first[n] = first - skew;
+			ranges[idx].last[n] = last - skew;
+		}
+
+		if (inside) {
+			empty[idx] = false;
+			firstIdx = std::min(firstIdx, idx);
+			lastIdx = std::max(lastIdx, idx);
+		}
+	}
+
+	Subtile3D clipped(id);
+	if (firstIdx == SIZE_MAX) {
+		return clipped;
+	}
+
+	// Keep volt and curr ranges in pairs, their halves outside of
+	// the window are empty.
+	firstIdx -= firstIdx % 2;
+	lastIdx += 1 - lastIdx % 2;
+
+	// Empty ranges are placed at the first cell of the subtile, so
+	// they're still within its bounding box.
+	std::array<size_t, 3> boxFirst = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
+	for (size_t idx = firstIdx; idx <= lastIdx; idx++) {
+		for (size_t n = 0; n < 3 && !empty[idx]; n++) {
+			boxFirst[n] = std::min(boxFirst[n], ranges[idx].first[n]);
+		}
+	}
+
+	clipped.firstHalfTs = subtile.firstHalfTs + firstIdx;
+	clipped.reserve(lastIdx - firstIdx + 1);
+
+	for (size_t idx = firstIdx; idx <= lastIdx; idx++) {
+		if (empty[idx]) {
+			Range3D<size_t> emptyRange = {boxFirst, boxFirst};
+			emptyRange.first[0]++;
+			clipped.push_back(emptyRange);
+		}
+		else {
+			clipped.push_back(ranges[idx]);
+		}
+	}
+
+	return clipped;
+}
+
+static void
+refineSubtile(
+	const Subtile3D& subtile, std::array<size_t, 3> innerTileSize,
+	Tile3D& tile, size_t& globalSubtileId
+)
+{
+	std::array<size_t, 3> skewedFirst, skewedLast;
+	if (!skewedBoundingBox(subtile, skewedFirst, skewedLast)) {
+		// nothing to refine
+		Subtile3D innerSubtile = subtile;
+		tile.push_back(std::move(innerSubtile));
+		return;
+	}
+
+	std::array<size_t, 3> innerWidth;
+	std::array<size_t, 3> numInner;
+	for (size_t n = 0; n < 3; n++) {
+		size_t width = skewedLast[n] - skewedFirst[n] + 1;
+		innerWidth[n] = innerTileSize[n] == 0 ? width : innerTileSize[n];
+		numInner[n] = (width + innerWidth[n] - 1) / innerWidth[n];
+	}
+
+	// Visit the inner tiles in lexicographical order, each one only
+	// depends on inner tiles with smaller skewed coordinates, which are
+	// visited before it.
+	size_t numInnerTotal = numInner[0] * numInner[1] * numInner[2];
+	for (size_t innerIdx = 0; innerIdx < numInnerTotal; innerIdx++) {
+		std::array<size_t, 3> inner = {
+			innerIdx / (numInner[1] * numInner[2]),
+			innerIdx / numInner[2] % numInner[1],
+			innerIdx % numInner[2]
+		};
+
+		std::array<size_t, 3> windowFirst, windowLast;
+		for (size_t n = 0; n < 3; n++) {
+			windowFirst[n] = skewedFirst[n] + inner[n] * innerWidth[n];
+			windowLast[n] = windowFirst[n] + innerWidth[n] - 1;
+		}
+
+		Subtile3D innerSubtile = clipSubtile(
+			subtile, windowFirst, windowLast, globalSubtileId
+		);
+		if (innerSubtile.size() == 0) {
+			continue;
+		}
+
+		globalSubtileId++;
+		tile.push_back(std::move(innerSubtile));
+	}
+}
+
+Plan3D
+Tiling::refineTiles(const Plan3D& plan, std::array<size_t, 3> innerTileSize)
+{
+	Plan3D refinedPlan(plan.size());
+	size_t globalSubtileId = 0;
 
-	assert(plan.size() <= 2);
+	for (size_t stage = 0; stage < plan.size(); stage++) {
+		refinedPlan[stage].reserve(plan[stage].size());
+
+		for (const Tile3D& tile : plan[stage]) {
+			Tile3D refinedTile(tile.id());
+			for (const Subtile3D& subtile : tile) {
+				refineSubtile(
+					subtile, innerTileSize,
+					refinedTile, globalSubtileId
+				);
+			}
+			refinedPlan[stage].push_back(std::move(refinedTile));
+		}
+	}
+
+	return refinedPlan;
+}
+
+Plan3D
+Tiling::refineTiles(
+	Plan3D plan,
+	const std::vector<std::array<size_t, 3>>& innerTileSizes
+)
+{
+	for (std::array<size_t, 3> innerTileSize : innerTileSizes) {
+		plan = refineTiles(plan, innerTileSize);
+	}
+	return plan;
+}
+
+// Frigo-Strumpen walk of a space-time region, each region is either
+// cut in space or in time, and both halves are walked in order. Regions
+// are kept as subtiles, i.e. one range per halfTs.
+static void
+walkRecursive(
+	const Subtile3D& region, std::array<size_t, 3> baseSize,
+	Tile3D& tile, size_t& globalSubtileId
+)
+{
+	std::array<size_t, 3> skewedFirst, skewedLast;
+	if (!skewedBoundingBox(region, skewedFirst, skewedLast)) {
+		return;
+	}
+
+	// In skewed coordinates, a cell only depends on cells with the same
+	// or smaller coordinates at the previous halfTs, so a cut at a fixed
+	// skewed coordinate is always valid, the left half goes first. Like
+	// in the original algorithm, only cut space if the region is at least
+	// twice as wide as it's tall, so both halves are still well-shaped.
+	const size_t height = region.size();
+	bool tooLarge = false;
+
+	for (size_t n = 0; n < 3; n++) {
+		size_t width = skewedLast[n] - skewedFirst[n] + 1;
+		if (baseSize[n] == 0 || width <= baseSize[n]) {
+			continue;
+		}
+		tooLarge = true;
+
+		if (width < 2 * height && height > 2) {
+			continue;
+		}
+
+		std::array<size_t, 3> leftLast = skewedLast;
+		std::array<size_t, 3> rightFirst = skewedFirst;
+		leftLast[n] = skewedFirst[n] + width / 2 - 1;
+		rightFirst[n] = skewedFirst[n] + width / 2;
+
+		walkRecursive(
+			clipSubtile(region, skewedFirst, leftLast, 0),
+			baseSize, tile, globalSubtileId
+		);
+		walkRecursive(
+			clipSubtile(region, rightFirst, skewedLast, 0),
+			baseSize, tile, globalSubtileId
+		);
+		return;
+	}
+
+	if (!tooLarge) {
+		// base case
+		Subtile3D subtile(globalSubtileId);
+		subtile.firstHalfTs = region.firstHalfTs;
+		subtile.reserve(height);
+		for (const Range3D<size_t>& range : region) {
+			subtile.push_back(range);
+		}
+
+		tile.push_back(std::move(subtile));
+		globalSubtileId++;
+		return;
+	}
+
+	// Too tall to be cut in space, cut in time, at a volt/curr pair
+	// boundary.
+	size_t halfHeight = height / 2 - height / 2 % 2;
+
+	Subtile3D lower, upper;
+	lower.firstHalfTs = region.firstHalfTs;
+	upper.firstHalfTs = region.firstHalfTs + halfHeight;
+	lower.reserve(halfHeight);
+	upper.reserve(height - halfHeight);
+
+	for (size_t idx = 0; idx < height; idx++) {
+		if (idx < halfHeight) {
+			lower.push_back(region[idx]);
+		}
+		else {
+			upper.push_back(region[idx]);
+		}
+	}
+
+	walkRecursive(
+		clipSubtile(lower, skewedFirst, skewedLast, 0),
+		baseSize, tile, globalSubtileId
+	);
+	walkRecursive(
+		clipSubtile(upper, skewedFirst, skewedLast, 0),
+		baseSize, tile, globalSubtileId
+	);
+}
+
+Plan3D
+Tiling::computeRecursiveTiles(
+	std::array<size_t, 3> gridSize, std::array<size_t, 3> baseSize,
+	size_t halfTimesteps
+)
+{
+	if (halfTimesteps % 2 != 0) {
+		throw std::invalid_argument(
+			"halfTimesteps must be even."
+		);
+	}
+
+	// The entire batch is a single column, the same as column tiling in
+	// all dimensions.
+	Subtile3D column;
+	column.reserve(halfTimesteps);
+	for (size_t halfTs = 0; halfTs < halfTimesteps; halfTs++) {
+		if (halfTs % 2 == 0) {
+			column.push_back({
+				{0, 0, 0},
+				{gridSize[0] - 1, gridSize[1] - 1, gridSize[2] - 1}
+			});
+		}
+		else {
+			// In FDTD, the last magnetic cells at the right boundary
+			// depends on cells outside the simulation grid, so they
+			// can't be calculated. Remove these cells.
+			column.push_back({
+				{0, 0, 0},
+				{gridSize[0] - 2, gridSize[1] - 2, gridSize[2] - 2}
+			});
+		}
+	}
+
+	Tile3D tile({0, 0, 0});
+	size_t globalSubtileId = 0;
+	walkRecursive(column, baseSize, tile, globalSubtileId);
+
+	// all subtiles are executed in serial, so there's only 1 stage with
+	// 1 tile
+	Plan3D plan(1);
+	plan[0].push_back(std::move(tile));
+	return plan;
+}
+
+Plan3D
+Tiling::toLocalCoords(Plan3D plan)
+{
+	for (TileList3D& tileList : plan) {
+		for (Tile3D& tile : tileList) {
+			for (Subtile3D& subtile : tile) {
+				for (Range3D<size_t>& range : subtile) {
+					for (size_t n = 0; n < 3; n++) {
+						range.first[n] = 0;
+						range.last[n] = range.last[n] - subtile.first[n];
+					}
+				}
+			}
+		}
+	}
+
+	return plan;
+}
+
+LazySubtile3D::LazySubtile3D(std::array<const Tile1D*, 3> tileIJK) :
+	m_tileIJK(tileIJK)
+{
+	size_t lastHalfTs = SIZE_MAX;
+	for (const Tile1D* tile : tileIJK) {
+		firstHalfTs = std::max(firstHalfTs, tile->firstHalfTs());
+		lastHalfTs = std::min(lastHalfTs, tile->firstHalfTs() + tile->size());
+	}
+
+	if (firstHalfTs < lastHalfTs) {
+		m_size = lastHalfTs - firstHalfTs;
+	}
+}
+
+Range3D<size_t>
+LazySubtile3D::operator[] (size_t idx) const
+{
+	const size_t halfTs = firstHalfTs + idx;
+
+	Range3D<size_t> range;
+	for (size_t n = 0; n < 3; n++) {
+		const Tile1D& tile = *m_tileIJK[n];
+		const Range1D<size_t>& range1D = tile[halfTs - tile.firstHalfTs()];
+
+		range.first[n] = range1D.first;
+		range.last[n] = range1D.last;
+	}
+	return range;
+}
+
+LazySubtile3D
+LazyTile3D::operator[] (size_t idx) const
+{
+	std::array<const Tile1D*, 3> tileIJK = m_tileIJK;
+	if (m_serialDim < 3) {
+		tileIJK[m_serialDim] = (*m_serialTiles)[idx];
+	}
+	return LazySubtile3D(tileIJK);
+}
+
+size_t
+LazyTileList3D::size() const
+{
+	const auto& stage = m_plan->m_stages[m_stage];
+	if (stage.size() == 0) {
+		return 0;
+	}
+	return stage.back().firstTile + stage.back().numTiles;
+}
+
+LazyTile3D
+LazyTileList3D::operator[] (size_t idx) const
+{
+	const size_t serialDim = m_plan->m_serialDim;
+
+	// a level has at most 7 combinations, a linear search is enough
+	const LazyPlan3D::Combination* combination = nullptr;
+	for (const LazyPlan3D::Combination& c : m_plan->m_stages[m_stage]) {
+		if (idx < c.firstTile + c.numTiles) {
+			combination = &c;
+			break;
+		}
+	}
+	assert(combination != nullptr);
+
+	// Decode the tile number in the same order as combineTilesStaged(),
+	// the last dimension is the least significant digit.
+	std::array<size_t, 3> id = {0, 0, 0};
+	std::array<const Tile1D*, 3> tileIJK = {nullptr, nullptr, nullptr};
+	size_t digits = idx - combination->firstTile;
+	for (size_t n = 3; n-- > 0;) {
+		const std::vector<const Tile1D*>& tileList =
+			m_plan->m_tiles[n][combination->stage[n]];
+
+		if (n == serialDim) {
+			continue;
+		}
+		tileIJK[n] = tileList[digits % tileList.size()];
+		id[n] = tileIJK[n]->id();
+		digits /= tileList.size();
+	}
+
+	const std::vector<const Tile1D*>* serialTiles = nullptr;
+	if (serialDim < 3) {
+		serialTiles = &m_plan->m_tiles[serialDim][0];
+	}
+	return LazyTile3D(id, tileIJK, serialTiles, serialDim);
+}
+
+LazyPlan3D::LazyPlan3D(
+	Plan1D i, Plan1D j, Plan1D k,
+	size_t serialDim, bool byLevel
+) :
+	m_serialDim(serialDim),
+	m_plan1D({std::move(i), std::move(j), std::move(k)})
+{
+	if (serialDim > 3) {
+		throw std::invalid_argument("serialDim must be 0, 1, 2 or 3.");
+	}
+
+	for (size_t n = 0; n < 3; n++) {
+		const Plan1D& plan1D = m_plan1D[n];
+
+		if (n == serialDim) {
+			m_tiles[n].resize(1);
+		}
+		else {
+			m_tiles[n].resize(plan1D.size());
+		}
+
+		for (size_t stageN = 0; stageN < plan1D.size(); stageN++) {
+			for (const Tile1D& tile : plan1D[stageN]) {
+				m_tiles[n][n == serialDim ? 0 : stageN].push_back(&tile);
+			}
+		}
+	}
+
+	std::array<size_t, 3> stagesIJK;
+	size_t numStages = 1;
+	size_t numLevels = 1;
+	for (size_t n = 0; n < 3; n++) {
+		stagesIJK[n] = m_tiles[n].size();
+		numStages *= stagesIJK[n];
+		numLevels += stagesIJK[n] - 1;
+	}
+
+	std::vector<std::vector<Combination>> levels(byLevel ? numLevels : 0);
+
+	for (size_t stage = 0; stage < numStages; stage++) {
+		Combination combination;
+		combination.firstTile = 0;
+		combination.numTiles = 1;
+
+		size_t level = 0;
+		size_t digits = stage;
+		for (size_t n = 3; n-- > 0;) {
+			combination.stage[n] = digits % stagesIJK[n];
+			level += combination.stage[n];
+			digits /= stagesIJK[n];
+		}
+
+		// Skip the combination if it has no tiles, or if its 1D tiles
+		// can never exist at the same time.
+		size_t firstHalfTs = 0;
+		size_t lastHalfTs = SIZE_MAX;
+		for (size_t n = 0; n < 3; n++) {
+			const auto& tileList = m_tiles[n][combination.stage[n]];
+
+			size_t stageFirstHalfTs = SIZE_MAX;
+			size_t stageLastHalfTs = 0;
+			for (const Tile1D* tile : tileList) {
+				stageFirstHalfTs = std::min(
+					stageFirstHalfTs, tile->firstHalfTs()
+				);
+				stageLastHalfTs = std::max(
+					stageLastHalfTs, tile->firstHalfTs() + tile->size()
+				);
+			}
+			firstHalfTs = std::max(firstHalfTs, stageFirstHalfTs);
+			lastHalfTs = std::min(lastHalfTs, stageLastHalfTs);
+
+			if (n != serialDim) {
+				combination.numTiles *= tileList.size();
+			}
+		}
+		if (combination.numTiles == 0 || firstHalfTs >= lastHalfTs) {
+			continue;
+		}
+
+		if (byLevel) {
+			levels[level].push_back(combination);
+		}
+		else {
+			m_stages.push_back({combination});
+		}
+	}
+
+	for (std::vector<Combination>& level : levels) {
+		if (level.size() > 0) {
+			m_stages.push_back(level);
+		}
+	}
+
+	for (std::vector<Combination>& stage : m_stages) {
+		size_t firstTile = 0;
+		for (Combination& combination : stage) {
+			combination.firstTile = firstTile;
+			firstTile += combination.numTiles;
+		}
+	}
+}
+
+FlatPlan3D::Layout
+FlatPlan3D::layout(Counts counts)
+{
+	// Each array starts at a cacheline boundary.
+	const size_t alignment = 64;
+
+	Layout layout;
+	layout.bytes = 0;
+	auto section = [&](size_t bytes) {
+		size_t offset = layout.bytes;
+		layout.bytes += (bytes + alignment - 1) / alignment * alignment;
+		return offset;
+	};
+
+	layout.stageTile     = section(4 * (counts.numStages + 1));
+	layout.tileSubtile   = section(4 * (counts.numTiles + 1));
+	layout.tileId        = section(4 * counts.numTiles * 3);
+	layout.subtileRange  = section(4 * (counts.numSubtiles + 1));
+	layout.subtileFirst  = section(4 * counts.numSubtiles * 3);
+	layout.subtileHalfTs = section(2 * counts.numSubtiles);
+	layout.rangeDelta    = section(2 * counts.numRanges * 6);
+	return layout;
+}
+
+void
+FlatPlan3D::setBuffer(
+	std::shared_ptr<const uint8_t> buffer, size_t bytes,
+	Counts counts
+)
+{
+	Layout layout = FlatPlan3D::layout(counts);
+	if (bytes != layout.bytes) {
+		throw std::invalid_argument("FlatPlan3D buffer has a wrong size.");
+	}
+
+	const uint8_t* base = buffer.get();
+	m_buffer = buffer;
+	m_bytes = bytes;
+	m_counts = counts;
+
+	m_stageTile = (const uint32_t*) (base + layout.stageTile);
+	m_tileSubtile = (const uint32_t*) (base + layout.tileSubtile);
+	m_tileId = (const uint32_t*) (base + layout.tileId);
+	m_subtileRange = (const uint32_t*) (base + layout.subtileRange);
+	m_subtileFirst = (const uint32_t*) (base + layout.subtileFirst);
+	m_subtileHalfTs = (const uint16_t*) (base + layout.subtileHalfTs);
+	m_rangeDelta = (const uint16_t*) (base + layout.rangeDelta);
+}
+
+FlatPlan3D::FlatPlan3D(
+	std::shared_ptr<const uint8_t> buffer, size_t bytes,
+	Counts counts
+)
+{
+	setBuffer(buffer, bytes, counts);
+
+	// cheap consistency check of the last offset at each level
+	if (m_stageTile[counts.numStages] != counts.numTiles ||
+		m_tileSubtile[counts.numTiles] != counts.numSubtiles ||
+		m_subtileRange[counts.numSubtiles] != counts.numRanges
+	) {
+		throw std::invalid_argument("FlatPlan3D buffer is corrupted.");
+	}
+}
+
+FlatPlan3D::FlatPlan3D(const Plan3D& plan)
+{
+	Counts counts = {plan.size(), 0, 0, 0};
+
+	for (const TileList3D& tileList : plan) {
+		counts.numTiles += tileList.size();
+		for (const Tile3D& tile : tileList) {
+			counts.numSubtiles += tile.size();
+			for (const Subtile3D& subtile : tile) {
+				counts.numRanges += subtile.size();
+			}
+		}
+	}
+	if (counts.numRanges > UINT32_MAX) {
+		throw std::invalid_argument("plan is too large for FlatPlan3D.");
+	}
+
+	Layout layout = FlatPlan3D::layout(counts);
+	uint8_t* base = static_cast<uint8_t*>(
+		std::aligned_alloc(64, layout.bytes)
+	);
+	if (!base) {
+		throw std::bad_alloc();
+	}
+	setBuffer(
+		std::shared_ptr<const uint8_t>(base, [](const uint8_t* ptr) {
+			std::free((void*) ptr);
+		}),
+		layout.bytes, counts
+	);
+
+	uint32_t* stageTile = (uint32_t*) (base + layout.stageTile);
+	uint32_t* tileSubtile = (uint32_t*) (base + layout.tileSubtile);
+	uint32_t* tileId = (uint32_t*) (base + layout.tileId);
+	uint32_t* subtileRange = (uint32_t*) (base + layout.subtileRange);
+	uint32_t* subtileFirst = (uint32_t*) (base + layout.subtileFirst);
+	uint16_t* subtileHalfTs = (uint16_t*) (base + layout.subtileHalfTs);
+	uint16_t* rangeDelta = (uint16_t*) (base + layout.rangeDelta);
+
+	size_t tileIdx = 0;
+	size_t subtileIdx = 0;
+	size_t rangeIdx = 0;
+
+	for (size_t stage = 0; stage < plan.size(); stage++) {
+		stageTile[stage] = tileIdx;
+
+		for (const Tile3D& tile : plan[stage]) {
+			tileSubtile[tileIdx] = subtileIdx;
+
+			for (size_t n = 0; n < 3; n++) {
+				if (tile.id()[n] > UINT32_MAX) {
+					throw std::invalid_argument(
+						"tile ID is too large for FlatPlan3D."
+					);
+				}
+				tileId[tileIdx * 3 + n] = tile.id()[n];
+			}
+			tileIdx++;
+
+			for (const Subtile3D& subtile : tile) {
+				subtileRange[subtileIdx] = rangeIdx;
+
+				if (subtile.firstHalfTs > UINT16_MAX) {
+					throw std::invalid_argument(
+						"halfTs is too large for FlatPlan3D."
+					);
+				}
+				subtileHalfTs[subtileIdx] = subtile.firstHalfTs;
+
+				// An empty subtile has no ranges, its first is never used.
+				std::array<size_t, 3> first = {0, 0, 0};
+				if (subtile.size() > 0) {
+					first = subtile.first;
+				}
+
+				for (size_t n = 0; n < 3; n++) {
+					if (first[n] > UINT32_MAX) {
+						throw std::invalid_argument(
+							"grid is too large for FlatPlan3D."
+						);
+					}
+					subtileFirst[subtileIdx * 3 + n] = first[n];
+				}
+				subtileIdx++;
+
+				for (const Range3D<size_t>& range : subtile) {
+					for (size_t n = 0; n < 3; n++) {
+						size_t deltaFirst = range.first[n] - first[n];
+						size_t deltaLast = range.last[n] - first[n];
+
+						if (deltaLast > UINT16_MAX) {
+							throw std::invalid_argument(
+								"tile is too large for FlatPlan3D."
+							);
+						}
+						rangeDelta[rangeIdx * 6 + n] = deltaFirst;
+						rangeDelta[rangeIdx * 6 + n + 3] = deltaLast;
+					}
+					rangeIdx++;
+				}
+			}
+		}
+	}
+
+	stageTile[counts.numStages] = tileIdx;
+	tileSubtile[counts.numTiles] = subtileIdx;
+	subtileRange[counts.numSubtiles] = rangeIdx;
+}
+
+Plan3D
+FlatPlan3D::toPlan3D() const
+{
+	Plan3D plan(size());
+	size_t globalSubtileId = 0;
+
+	for (size_t stage = 0; stage < size(); stage++) {
+		const FlatTileList3D flatTileList = (*this)[stage];
+		plan[stage].reserve(flatTileList.size());
+
+		for (const FlatTile3D& flatTile : flatTileList) {
+			Tile3D tile(flatTile.id());
+			tile.reserve(flatTile.size());
+
+			for (const FlatSubtile3D& flatSubtile : flatTile) {
+				Subtile3D subtile(globalSubtileId);
+				subtile.firstHalfTs = flatSubtile.firstHalfTs;
+				subtile.reserve(flatSubtile.size());
+				globalSubtileId++;
+
+				for (const Range3D<size_t>& range : flatSubtile) {
+					subtile.push_back(range);
+				}
+				tile.push_back(std::move(subtile));
+			}
+			plan[stage].push_back(std::move(tile));
+		}
+	}
+
+	return plan;
+}
+
+void
+FlatPlan3D::swap(FlatPlan3D& other) noexcept
+{
+	std::swap(m_buffer, other.m_buffer);
+	std::swap(m_bytes, other.m_bytes);
+	std::swap(m_counts, other.m_counts);
+	std::swap(m_stageTile, other.m_stageTile);
+	std::swap(m_tileSubtile, other.m_tileSubtile);
+	std::swap(m_tileId, other.m_tileId);
+	std::swap(m_subtileRange, other.m_subtileRange);
+	std::swap(m_subtileFirst, other.m_subtileFirst);
+	std::swap(m_subtileHalfTs, other.m_subtileHalfTs);
+	std::swap(m_rangeDelta, other.m_rangeDelta);
+}
+
+template <typename Plan>
+static TileGraph3D
+computeTileGraphOf(const Plan& plan)
+{
+	TileGraph3D graph;
+	std::map<std::array<size_t, 3>, std::vector<size_t>> idToNodes;
+
+	for (size_t stage = 0; stage < plan.size(); stage++) {
+		for (size_t tileIdx = 0; tileIdx < plan[stage].size(); tileIdx++) {
+			const auto& tile = plan[stage][tileIdx];
+
+			TileNode3D node;
+			node.stage = stage;
+			node.tile = tileIdx;
+			node.cost = 0;
+			node.priority = 0;
+			node.numPredecessors = 0;
+
+			for (const auto& subtile : tile) {
+				for (const auto& range : subtile) {
+					size_t cells = 1;
+					for (size_t n = 0; n < 3; n++) {
+						cells *= range.last[n] - range.first[n] + 1;
+					}
+					node.cost += cells;
+				}
+			}
+
+			idToNodes[tile.id()].push_back(graph.size());
+			graph.push_back(node);
+		}
+	}
+
+	for (size_t nodeIdx = 0; nodeIdx < graph.size(); nodeIdx++) {
+		TileNode3D& node = graph[nodeIdx];
+		std::array<size_t, 3> id = plan[node.stage][node.tile].id();
+
+		// visit all 27 IDs around this tile, including itself
+		for (size_t offset = 0; offset < 27; offset++) {
+			std::array<ssize_t, 3> delta = {
+				(ssize_t) (offset / 9) - 1,
+				(ssize_t) (offset / 3 % 3) - 1,
+				(ssize_t) (offset % 3) - 1
+			};
+
+			std::array<size_t, 3> neighborId;
+			bool valid = true;
+			for (size_t n = 0; n < 3; n++) {
+				if (id[n] == 0 && delta[n] < 0) {
+					valid = false;
+				}
+				neighborId[n] = id[n] + delta[n];
+			}
+
+			auto it = idToNodes.find(neighborId);
+			if (!valid || it == idToNodes.end()) {
+				continue;
+			}
+
+			for (size_t neighborIdx : it->second) {
+				node.neighbors.push_back(neighborIdx);
+
+				if (graph[neighborIdx].stage > node.stage) {
+					node.successors.push_back(neighborIdx);
+					graph[neighborIdx].numPredecessors++;
+				}
+			}
+		}
+	}
+
+	// Successors are always in later stages, thus have larger node
+	// numbers. Walk backwards so they're all known when needed.
+	for (size_t nodeIdx = graph.size(); nodeIdx-- > 0;) {
+		TileNode3D& node = graph[nodeIdx];
+
+		size_t longestSuccessor = 0;
+		for (size_t successorIdx : node.successors) {
+			longestSuccessor = std::max(
+				longestSuccessor, graph[successorIdx].priority
+			);
+		}
+		node.priority = node.cost + longestSuccessor;
+	}
+
+	return graph;
+}
+
+TileGraph3D
+Tiling::computeTileGraph(const Plan3D& plan)
+{
+	return computeTileGraphOf(plan);
+}
+
+TileGraph3D
+Tiling::computeTileGraph(const FlatPlan3D& plan)
+{
+	return computeTileGraphOf(plan);
+}
+
+size_t
+Tiling::estimateTraffic(const Plan3D& plan, size_t slidingDim)
+{
+	// volt and curr are read and written, vv, vi, ii and iv are only
+	// read, each cell is a vec3 of FP32
+	const size_t bytesPerCell = 8 * 3 * sizeof(float);
+	size_t cells = 0;
+
+	for (const TileList3D& tileList : plan) {
+		for (const Tile3D& tile : tileList) {
+			for (size_t idx = 0; idx < tile.size(); idx++) {
+				// last - first rather than the inclusive box size, as
+				// the model of utils/speedup always had it
+				const Subtile3D& subtile = tile[idx];
+				std::array<size_t, 3> size;
+				for (size_t n = 0; n < 3; n++) {
+					size[n] = subtile.last[n] - subtile.first[n];
+				}
+
+				if (idx > 0 && slidingDim < 3) {
+					size_t lastPos = tile[idx - 1].last[slidingDim];
+					size_t currPos = subtile.last[slidingDim];
+					size[slidingDim] = currPos - lastPos;
+				}
+				cells += size[0] * size[1] * size[2];
+			}
+		}
+	}
+
+	return cells * bytesPerCell;
+}
+
+void
+Tiling::visualizeTiles(
+	const Plan1D& plan,
+	size_t totalWidth, size_t tileWidth,
+	size_t halfTimesteps
+)
+{
+	char simSpace[halfTimesteps][totalWidth];
+
+	for (size_t halfTs = 0; halfTs < halfTimesteps; halfTs++) {
+		for (size_t pos = 0; pos < totalWidth; pos++) {
+			simSpace[halfTs][pos] = '!';
+		}
+	}
+
+	assert(plan.size() <= 3);
 	for (size_t stage = 0; stage < plan.size(); stage++) {
 		char tileID;
 		if (stage == 0) {
@@ -435,6 +1869,9 @@ Tiling::visualizeTiles(
 		else if (stage == 1) {
 			tileID = 'A';
 		}
+		else if (stage == 2) {
+			tileID = 'a';
+		}
 
 		const TileList1D& tileList = plan[stage];
 
@@ -450,7 +1887,7 @@ Tiling::visualizeTiles(
 								  << " @pos " << pos << "\n";
 						continue;
 					}
-					simSpace[halfTs][pos] = tileID;
+					simSpace[tile.firstHalfTs() + halfTs][pos] = tileID;
 				}
 			}
 
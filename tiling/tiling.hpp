@@ -19,6 +19,8 @@
 #include <cstdint>
 #include <array>
 #include <vector>
+#include <map>
+#include <memory>
 
 namespace Tiling {
 	using size_t = std::size_t;
@@ -38,7 +40,7 @@ namespace Tiling {
 		size_t         size()   const { return m_vector.size();     }
 
 		void     reserve(size_t numelem)       { m_vector.reserve(numelem); }
-		void     push_back(T elem)             { m_vector.push_back(elem);  }
+		void     push_back(T elem)             { m_vector.push_back(std::move(elem)); }
 		T&       operator[] (size_t idx)       { return m_vector[idx];      }
 		const T& operator[] (size_t idx) const { return m_vector[idx];      }
 
@@ -55,33 +57,72 @@ namespace Tiling {
 	struct Tile1D : WrappedVector<Range1D<size_t>>
 	{
 	public:
-		Tile1D(size_t id) : m_id(id) {}
+		Tile1D(size_t id, size_t firstHalfTs = 0) :
+			m_id(id), m_firstHalfTs(firstHalfTs) {}
 		size_t id() const { return m_id; }
 
+		// Most tiles span the entire batch, but diamond tiles may
+		// start in the middle, their 1st range is at this halfTs.
+		size_t firstHalfTs() const { return m_firstHalfTs; }
+
 	private:
 		size_t m_id;
+		size_t m_firstHalfTs;
 	};
 
 	using TileList1D = std::vector<Tile1D>;
 	using Plan1D = std::vector<TileList1D>;
 
+	// With alignment > 1, each tile is widened so that its edge to the
+	// next tile is a multiple of alignment at the 1st or 2nd half
+	// timestep. Edges shift by 1 unit per timestep, so they can't stay
+	// aligned, but all of them are aligned at least once per batch. This
+	// is meant for dimension k, so that the SIMD kernels need fewer
+	// partial vectors at tile edges.
 	Plan1D
 	computeParallelogramTiles(
 		size_t totalWidth, size_t tileWidth,
-		size_t halfTimesteps
+		size_t halfTimesteps, size_t alignment = 1
 	);
 
 	Plan1D
 	computeTrapezoidTiles(
 		size_t totalWidth, size_t tileWidth,
-		size_t halfTimesteps
+		size_t halfTimesteps, size_t alignment = 1
 	);
 
+	// Diamond tiling has 3 stages: the lower halves between two
+	// diamonds, the diamonds, and the upper halves between two diamonds.
+	// The upper half of this batch and the lower half of the next batch
+	// also form a diamond.
+	Plan1D
+	computeDiamondTiles(
+		size_t totalWidth, size_t tileWidth,
+		size_t halfTimesteps, size_t alignment = 1
+	);
+
+	// A single tile spanning the entire dimension, i.e. the dimension
+	// is not tiled at all.
+	Plan1D
+	computeColumnTiles(size_t totalWidth, size_t halfTimesteps);
+
 	template <typename T>
 	struct Range3D
 	{
 		std::array<size_t, 3> first;
 		std::array<size_t, 3> last;
+
+		// Refined subtiles may contain empty ranges (first > last in
+		// a dimension), so that volt and curr ranges stay in pairs.
+		bool empty() const
+		{
+			for (size_t n = 0; n < 3; n++) {
+				if (first[n] > last[n]) {
+					return true;
+				}
+			}
+			return false;
+		}
 	};
 
 	struct Subtile3D : WrappedVector<Range3D<size_t>>
@@ -94,6 +135,9 @@ namespace Tiling {
 		void push_back(Range3D<size_t> range)
 		{
 			m_vector.push_back(range);
+			if (range.empty()) {
+				return;
+			}
 			for (size_t i = 0; i < 3; i++) {
 				first[i] = std::min(range.first[i], first[i]);
 				 last[i] = std::max(range.last[i],   last[i]);
@@ -103,6 +147,22 @@ namespace Tiling {
 		std::array<size_t, 3> first = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
 		std::array<size_t, 3> last  = {0, 0, 0};
 
+		// size of the bounding box [first, last], 0 if there's no range
+		std::array<size_t, 3> boxSize() const
+		{
+			if (first[0] > last[0]) {
+				return {0, 0, 0};
+			}
+			return {
+				last[0] - first[0] + 1,
+				last[1] - first[1] + 1,
+				last[2] - first[2] + 1
+			};
+		}
+
+		// halfTs of the 1st range within the batch, always even
+		size_t firstHalfTs = 0;
+
 	private:
 		size_t m_id;
 	};
@@ -120,15 +180,488 @@ namespace Tiling {
 	using TileList3D = std::vector<Tile3D>;
 	using Plan3D = std::vector<TileList3D>;
 
+	// Rows of 3D tiles are built on up to numThreads threads, the plan
+	// is identical to the serial one, including all subtile IDs.
+	Plan3D
+	combineTilesTTT(
+		const Plan1D& i, const Plan1D& j, const Plan1D& k,
+		size_t numThreads = 1
+	);
+
 	Plan3D
-	combineTilesTTT(const Plan1D& i, const Plan1D& j, const Plan1D& k);
+	combineTilesTTP(
+		const Plan1D& i, const Plan1D& j, const Plan1D& k,
+		size_t numThreads = 1
+	);
+
+	Plan3D
+	combineTilesDDD(const Plan1D& i, const Plan1D& j, const Plan1D& k);
+
+	Plan3D
+	combineTilesDDP(const Plan1D& i, const Plan1D& j, const Plan1D& k);
+
+	// DiamondCandy: the same diamond tiles as combineTilesDDD(), but
+	// grouped by concurrency level instead of by 1D stage combination.
+	// Every stage of the returned plan is a level, all candies within
+	// a level are independent and can run concurrently, and each level
+	// only depends on the previous ones. Within a level, candies are
+	// sorted in Z-order of their IDs, so the candies that are handed out
+	// to different threads at the same time are spatial neighbors.
+	Plan3D
+	combineTilesDiamondCandy(
+		const Plan1D& i, const Plan1D& j, const Plan1D& k
+	);
+
+	// DiamondTorre: diamond tiles in dimension I, each is extruded into
+	// a tower that sweeps through dimension J using parallelogram tiles
+	// in serial, dimension K is a column tile. Trapezoid tiles in I are
+	// accepted as well, for batches too short for diamond tiling.
+	Plan3D
+	combineTilesDiamondTorre(
+		const Plan1D& i, const Plan1D& j, const Plan1D& k
+	);
 
+	// Hierarchical tiling: split each subtile again into smaller
+	// time-skewed subtiles, which are executed in serial within the same
+	// Tile3D, like parallelograms. innerTileSize is the width of the
+	// inner tiles in skewed coordinates, 0 leaves the dimension uncut.
+	// With multiple sizes, e.g. for L2 then L1 cache, the subtiles are
+	// refined again by each size in turn.
 	Plan3D
-	combineTilesTTP(const Plan1D& i, const Plan1D& j, const Plan1D& k);
+	refineTiles(const Plan3D& plan, std::array<size_t, 3> innerTileSize);
+
+	Plan3D
+	refineTiles(
+		Plan3D plan,
+		const std::vector<std::array<size_t, 3>>& innerTileSizes
+	);
+
+	// Cache-oblivious tiling after Frigo & Strumpen: the entire batch is
+	// a single space-time region, it's recursively cut in space (if it's
+	// wide) or in time (if it's tall) until it's no larger than baseSize
+	// in skewed coordinates, 0 leaves the dimension uncut. The pieces
+	// are subtiles of a single Tile3D, executed in serial. The cuts
+	// don't depend on any cache size, so every level of the memory
+	// hierarchy is used well without tuning the tile size.
+	Plan3D
+	computeRecursiveTiles(
+		std::array<size_t, 3> gridSize, std::array<size_t, 3> baseSize,
+		size_t halfTimesteps
+	);
 
 	Plan3D
 	toLocalCoords(Plan3D plan);
 
+	// Forward iterator over the elements of a lazy view, which are
+	// computed on the fly and returned by value from operator[].
+	template <typename View>
+	struct IndexIterator
+	{
+	public:
+		IndexIterator(const View* view, size_t idx) :
+			m_view(view), m_idx(idx) {}
+
+		auto operator*() const { return (*m_view)[m_idx]; }
+		IndexIterator& operator++() { m_idx++; return *this; }
+		bool operator==(const IndexIterator& other) const
+		{
+			return m_idx == other.m_idx;
+		}
+
+	private:
+		const View* m_view;
+		size_t m_idx;
+	};
+
+	// The lazy counterpart of Subtile3D, its ranges are computed from
+	// the 1D tiles when accessed. If the 1D tiles never exist at the
+	// same time, the subtile is empty.
+	struct LazySubtile3D
+	{
+	public:
+		LazySubtile3D(std::array<const Tile1D*, 3> tileIJK);
+
+		size_t size() const { return m_size; }
+		Range3D<size_t> operator[] (size_t idx) const;
+
+		IndexIterator<LazySubtile3D> begin() const { return {this, 0};      }
+		IndexIterator<LazySubtile3D> end()   const { return {this, m_size}; }
+
+		// halfTs of the 1st range within the batch, always even
+		size_t firstHalfTs = 0;
+
+	private:
+		std::array<const Tile1D*, 3> m_tileIJK;
+		size_t m_size = 0;
+	};
+
+	// The lazy counterpart of Tile3D. If the plan has a serial dimension,
+	// the tile has one subtile per 1D tile of that dimension.
+	struct LazyTile3D
+	{
+	public:
+		LazyTile3D(
+			std::array<size_t, 3> id,
+			std::array<const Tile1D*, 3> tileIJK,
+			const std::vector<const Tile1D*>* serialTiles,
+			size_t serialDim
+		) :
+			m_id(id), m_tileIJK(tileIJK),
+			m_serialTiles(serialTiles), m_serialDim(serialDim) {}
+
+		std::array<size_t, 3> id() const { return m_id; }
+
+		size_t size() const
+		{
+			return m_serialDim < 3 ? m_serialTiles->size() : 1;
+		}
+		LazySubtile3D operator[] (size_t idx) const;
+
+		IndexIterator<LazyTile3D> begin() const { return {this, 0};      }
+		IndexIterator<LazyTile3D> end()   const { return {this, size()}; }
+
+	private:
+		std::array<size_t, 3> m_id;
+		std::array<const Tile1D*, 3> m_tileIJK;
+		const std::vector<const Tile1D*>* m_serialTiles;
+		size_t m_serialDim;
+	};
+
+	class LazyPlan3D;
+
+	// The lazy counterpart of TileList3D, a stage of a LazyPlan3D.
+	struct LazyTileList3D
+	{
+	public:
+		LazyTileList3D(const LazyPlan3D* plan, size_t stage) :
+			m_plan(plan), m_stage(stage) {}
+
+		size_t size() const;
+		LazyTile3D operator[] (size_t idx) const;
+
+		IndexIterator<LazyTileList3D> begin() const { return {this, 0};      }
+		IndexIterator<LazyTileList3D> end()   const { return {this, size()}; }
+
+	private:
+		const LazyPlan3D* m_plan;
+		size_t m_stage;
+	};
+
+	// A view of the Plan3D created by the combineTiles*() functions,
+	// without materializing it. Only the 1D plans are stored, tiles,
+	// subtiles and ranges are computed on the fly when accessed, so it
+	// takes O(1D tiles) memory instead of O(3D tiles x halfTimesteps).
+	//
+	// serialDim and byLevel have the same meaning as in the 1D plan
+	// combinations, i.e. TTT and DDD use serialDim = 3, TTP and DDP use
+	// serialDim = 2, DiamondTorre uses serialDim = 1, DiamondCandy uses
+	// serialDim = 3 and byLevel = true. Unlike the materialized plan,
+	// DiamondCandy tiles are not sorted in Z-order, and subtiles whose
+	// 1D tiles never exist at the same time are kept as empty subtiles.
+	class LazyPlan3D
+	{
+	public:
+		LazyPlan3D() {}
+		LazyPlan3D(
+			Plan1D i, Plan1D j, Plan1D k,
+			size_t serialDim, bool byLevel = false
+		);
+
+		// Tiles point into the 1D plans owned by this object, moving
+		// keeps them valid, copying doesn't.
+		LazyPlan3D(const LazyPlan3D&) = delete;
+		LazyPlan3D& operator=(const LazyPlan3D&) = delete;
+		LazyPlan3D(LazyPlan3D&&) = default;
+		LazyPlan3D& operator=(LazyPlan3D&&) = default;
+
+		size_t size() const { return m_stages.size(); }
+		LazyTileList3D operator[] (size_t stage) const { return {this, stage}; }
+
+		IndexIterator<LazyPlan3D> begin() const { return {this, 0};      }
+		IndexIterator<LazyPlan3D> end()   const { return {this, size()}; }
+
+	private:
+		friend struct LazyTileList3D;
+
+		// One combination of 1D stages, all its tiles are numbered
+		// from firstTile within the 3D stage.
+		struct Combination
+		{
+			std::array<size_t, 3> stage;
+			size_t firstTile;
+			size_t numTiles;
+		};
+
+		size_t m_serialDim = 3;
+		std::array<Plan1D, 3> m_plan1D;
+
+		// tiles of each dimension in each 1D stage, the serial dimension
+		// has a single stage with all tiles of all stages in order
+		std::array<std::vector<std::vector<const Tile1D*>>, 3> m_tiles;
+
+		std::vector<std::vector<Combination>> m_stages;
+	};
+
+	class FlatPlan3D;
+
+	// The flat counterpart of Subtile3D. Ranges are stored as 16-bit
+	// deltas relative to the first cell of the subtile, they're decoded
+	// when accessed.
+	struct FlatSubtile3D
+	{
+	public:
+		FlatSubtile3D(
+			std::array<size_t, 3> first, size_t firstHalfTs,
+			const uint16_t* delta, size_t size
+		) :
+			first(first), firstHalfTs(firstHalfTs),
+			m_delta(delta), m_size(size) {}
+
+		size_t size() const { return m_size; }
+
+		Range3D<size_t> operator[] (size_t idx) const
+		{
+			const uint16_t* delta = m_delta + idx * 6;
+			return Range3D<size_t>{
+				{first[0] + delta[0], first[1] + delta[1], first[2] + delta[2]},
+				{first[0] + delta[3], first[1] + delta[4], first[2] + delta[5]}
+			};
+		}
+
+		IndexIterator<FlatSubtile3D> begin() const { return {this, 0};      }
+		IndexIterator<FlatSubtile3D> end()   const { return {this, m_size}; }
+
+		std::array<size_t, 3> first;
+
+		// halfTs of the 1st range within the batch, always even
+		size_t firstHalfTs;
+
+	private:
+		const uint16_t* m_delta;
+		size_t m_size;
+	};
+
+	// The flat counterpart of Tile3D.
+	struct FlatTile3D
+	{
+	public:
+		FlatTile3D(const FlatPlan3D* plan, size_t idx) :
+			m_plan(plan), m_idx(idx) {}
+
+		std::array<size_t, 3> id() const;
+		size_t size() const;
+		FlatSubtile3D operator[] (size_t idx) const;
+
+		IndexIterator<FlatTile3D> begin() const { return {this, 0};      }
+		IndexIterator<FlatTile3D> end()   const { return {this, size()}; }
+
+	private:
+		const FlatPlan3D* m_plan;
+		size_t m_idx;
+	};
+
+	// The flat counterpart of TileList3D, a stage of a FlatPlan3D.
+	struct FlatTileList3D
+	{
+	public:
+		FlatTileList3D(const FlatPlan3D* plan, size_t stage) :
+			m_plan(plan), m_stage(stage) {}
+
+		size_t size() const;
+		FlatTile3D operator[] (size_t idx) const;
+
+		IndexIterator<FlatTileList3D> begin() const { return {this, 0};      }
+		IndexIterator<FlatTileList3D> end()   const { return {this, size()}; }
+
+	private:
+		const FlatPlan3D* m_plan;
+		size_t m_stage;
+	};
+
+	// An immutable copy of a Plan3D in a single contiguous buffer,
+	// instead of nested vectors scattered across the heap. Each level
+	// (stages, tiles, subtiles, ranges) is an array of offsets into the
+	// next one, ranges are stored as 16-bit deltas relative to their
+	// Subtile3D::first, i.e. 12 bytes instead of 48 bytes per range. The
+	// stage and tile numbering is identical to the original plan, so a
+	// TileGraph3D computed from it can be used as well.
+	class FlatPlan3D
+	{
+	public:
+		// number of elements at each level, which determines the layout
+		// of the buffer
+		struct Counts
+		{
+			size_t numStages, numTiles, numSubtiles, numRanges;
+		};
+
+		FlatPlan3D() {}
+		FlatPlan3D(const Plan3D& plan);
+
+		// Use an existing buffer created by another FlatPlan3D in place,
+		// e.g. from a memory-mapped file. The buffer must be aligned to
+		// 64 bytes, it's released by the deleter of the shared_ptr.
+		FlatPlan3D(
+			std::shared_ptr<const uint8_t> buffer, size_t bytes,
+			Counts counts
+		);
+
+		// the buffer is immutable, copies share it
+		FlatPlan3D(const FlatPlan3D&) = default;
+		FlatPlan3D& operator=(const FlatPlan3D&) = default;
+		FlatPlan3D(FlatPlan3D&& other) noexcept { swap(other); }
+		FlatPlan3D& operator=(FlatPlan3D&& other) noexcept
+		{
+			swap(other);
+			return *this;
+		}
+
+		size_t size() const { return m_counts.numStages; }
+		FlatTileList3D operator[] (size_t stage) const { return {this, stage}; }
+
+		IndexIterator<FlatPlan3D> begin() const { return {this, 0};      }
+		IndexIterator<FlatPlan3D> end()   const { return {this, size()}; }
+
+		// the buffer, its size in bytes and the counts of its layout
+		const uint8_t* data() const { return m_buffer.get(); }
+		size_t bytes() const { return m_bytes; }
+		Counts counts() const { return m_counts; }
+
+		// Convert back to a Plan3D. Subtile IDs are renumbered in plan
+		// order, everything else is identical to the original plan.
+		Plan3D toPlan3D() const;
+
+	private:
+		friend struct FlatTileList3D;
+		friend struct FlatTile3D;
+
+		struct Layout
+		{
+			size_t stageTile, tileSubtile, tileId;
+			size_t subtileRange, subtileFirst, subtileHalfTs;
+			size_t rangeDelta;
+			size_t bytes;
+		};
+		static Layout layout(Counts counts);
+		void setBuffer(
+			std::shared_ptr<const uint8_t> buffer, size_t bytes,
+			Counts counts
+		);
+
+		void swap(FlatPlan3D& other) noexcept;
+
+		std::shared_ptr<const uint8_t> m_buffer;
+		size_t m_bytes = 0;
+		Counts m_counts = {0, 0, 0, 0};
+
+		// [numStages + 1], first tile of each stage
+		const uint32_t* m_stageTile = nullptr;
+
+		// [numTiles + 1], first subtile of each tile
+		const uint32_t* m_tileSubtile = nullptr;
+
+		// [numTiles][3], Tile3D::id()
+		const uint32_t* m_tileId = nullptr;
+
+		// [numSubtiles + 1], first range of each subtile
+		const uint32_t* m_subtileRange = nullptr;
+
+		// [numSubtiles][3], Subtile3D::first
+		const uint32_t* m_subtileFirst = nullptr;
+
+		// [numSubtiles], Subtile3D::firstHalfTs
+		const uint16_t* m_subtileHalfTs = nullptr;
+
+		// [numRanges][6], first and last of each range minus
+		// Subtile3D::first
+		const uint16_t* m_rangeDelta = nullptr;
+	};
+
+	inline size_t
+	FlatTileList3D::size() const
+	{
+		return m_plan->m_stageTile[m_stage + 1] - m_plan->m_stageTile[m_stage];
+	}
+
+	inline FlatTile3D
+	FlatTileList3D::operator[] (size_t idx) const
+	{
+		return FlatTile3D(m_plan, m_plan->m_stageTile[m_stage] + idx);
+	}
+
+	inline std::array<size_t, 3>
+	FlatTile3D::id() const
+	{
+		const uint32_t* id = m_plan->m_tileId + m_idx * 3;
+		return {id[0], id[1], id[2]};
+	}
+
+	inline size_t
+	FlatTile3D::size() const
+	{
+		return m_plan->m_tileSubtile[m_idx + 1] - m_plan->m_tileSubtile[m_idx];
+	}
+
+	inline FlatSubtile3D
+	FlatTile3D::operator[] (size_t idx) const
+	{
+		const size_t subtile = m_plan->m_tileSubtile[m_idx] + idx;
+		const uint32_t* first = m_plan->m_subtileFirst + subtile * 3;
+		const size_t range = m_plan->m_subtileRange[subtile];
+
+		return FlatSubtile3D(
+			{first[0], first[1], first[2]},
+			m_plan->m_subtileHalfTs[subtile],
+			m_plan->m_rangeDelta + range * 6,
+			m_plan->m_subtileRange[subtile + 1] - range
+		);
+	}
+
+	// A tile in the dependency graph of a Plan3D, nodes are numbered
+	// in plan order (stage by stage, then tile by tile).
+	struct TileNode3D
+	{
+		size_t stage;
+		size_t tile;
+
+		// total number of cell updates in this tile
+		size_t cost;
+
+		// cost of the longest path from this tile to the end of the
+		// batch (including itself), i.e. its critical path length
+		size_t priority;
+
+		// dependencies within the same batch: tiles in earlier stages
+		// must finish before this tile, which must finish before all
+		// of its successors in later stages
+		size_t numPredecessors;
+		std::vector<size_t> successors;
+
+		// all adjacent tiles regardless of stage, including itself.
+		// When the plan is applied again in the next batch, this
+		// tile must finish before all of its neighbors can start.
+		std::vector<size_t> neighbors;
+	};
+
+	using TileGraph3D = std::vector<TileNode3D>;
+
+	// Derive tile dependencies from Tile3D::id(). Two tiles can only
+	// depend on each other if each 1D tile ID differs by at most 1, and
+	// tiles of the later stage depend on tiles of the earlier one.
+	TileGraph3D
+	computeTileGraph(const Plan3D& plan);
+
+	TileGraph3D
+	computeTileGraph(const FlatPlan3D& plan);
+
+	// DRAM traffic model of a plan in bytes, used by utils/speedup,
+	// engine/autotune and engine/bench: every subtile loads and stores
+	// its bounding box once, nothing is reused between subtiles. With a slidingDim < 3,
+	// the subtiles of a tile slide along it like a window, so each one
+	// after the first only loads the cells it adds in that dimension.
+	size_t
+	estimateTraffic(const Plan3D& plan, size_t slidingDim = 3);
+
 	void visualizeTiles(
 		const Plan1D& plan,
 		size_t totalWidth, size_t tileWidth,
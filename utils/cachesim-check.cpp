@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cachesim.hpp"
+
+int main(void);
+void expect(const std::string& name, size_t got, size_t expected);
+void checkPrivateHit(void);
+void checkSharedLastLine(void);
+void checkWriteback(void);
+
+int main(void)
+{
+	checkPrivateHit();
+	checkSharedLastLine();
+	checkWriteback();
+	printf("all cache model checks passed\n");
+	return 0;
+}
+
+void expect(const std::string& name, size_t got, size_t expected)
+{
+	if (got != expected) {
+		throw std::runtime_error(std::format(
+			"{}: expected {}, got {}", name, expected, got
+		));
+	}
+	printf("%s\tok\n", name.c_str());
+}
+
+// Repeated accesses to the same line only miss once.
+void checkPrivateHit(void)
+{
+	CacheSim::Cache cache({{128, 2}, {256, 4}});
+	for (size_t n = 0; n < 4; n++) {
+		cache.access(n * 4, false);
+	}
+	cache.access(64, false);
+	cache.access(0, false);
+
+	expect("private hit", cache.stats(0).misses, 2);
+}
+
+// 1 set, 2 ways, shared by 2 cores as the only level: core 1 evicts
+// line 0 of core 0, which must miss again, even though it's the last
+// line core 0 accessed.
+void checkSharedLastLine(void)
+{
+	CacheSim::Cache cache({{128, 2}}, 64, 2);
+	cache.access(0 * 64, false, 0);
+	cache.access(2 * 64, false, 1);
+	cache.access(4 * 64, false, 1);
+	cache.access(0 * 64, false, 0);
+
+	expect("shared last line", cache.stats(0).misses, 4);
+}
+
+// Dirty lines are written back once, when evicted or flushed.
+void checkWriteback(void)
+{
+	CacheSim::Cache cache({{128, 2}});
+	cache.access(0 * 64, true);
+	cache.access(1 * 64, false);
+	cache.access(2 * 64, false);
+	cache.flush();
+
+	expect("writeback", cache.dramBytesWritten(), 64);
+}
@@ -0,0 +1,280 @@
+// BSD Zero Clause License
+// 
+// Copyright (C) 2024 Yifeng Li
+// 
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <algorithm>
+#include <format>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+#include "cachesim.hpp"
+using namespace CacheSim;
+
+Cache::Cache(
+	const std::vector<LevelConfig>& config,
+	size_t lineSize, size_t numCores
+) :
+	m_lineSize(lineSize),
+	m_config(config),
+	m_fastPath(config.size() > 1 || numCores == 1)
+{
+	if (config.empty()) {
+		throw std::invalid_argument("cache needs at least one level");
+	}
+	if (lineSize == 0) {
+		throw std::invalid_argument("cache line size must not be 0");
+	}
+	if (numCores == 0) {
+		throw std::invalid_argument("cache needs at least one core");
+	}
+
+	for (const LevelConfig& levelConfig : config) {
+		if (levelConfig.ways == 0 ||
+			levelConfig.bytes < levelConfig.ways * lineSize
+		) {
+			throw std::invalid_argument(std::format(
+				"cache of {} bytes can't have {} ways of {} bytes",
+				levelConfig.bytes, levelConfig.ways, lineSize
+			));
+		}
+	}
+
+	size_t numPrivate = config.size() - 1;
+	m_levels.resize(numCores * numPrivate + 1);
+	for (size_t idx = 0; idx < m_levels.size(); idx++) {
+		const LevelConfig& levelConfig = idx < numCores * numPrivate ?
+			config[idx % numPrivate] : config.back();
+
+		Level& level = m_levels[idx];
+		level.ways = levelConfig.ways;
+		level.numSets = levelConfig.bytes / (levelConfig.ways * lineSize);
+		level.entries.resize(level.numSets * level.ways, invalidEntry);
+	}
+
+	m_cores.resize(numCores);
+	for (size_t core = 0; core < numCores; core++) {
+		for (size_t level = 0; level < numPrivate; level++) {
+			m_cores[core].levels.push_back(
+				&m_levels[core * numPrivate + level]
+			);
+		}
+		m_cores[core].levels.push_back(&m_levels.back());
+	}
+}
+
+void
+Cache::accessLevel(
+	size_t core, size_t level, uint64_t line, bool write, bool fill
+)
+{
+	if (level == m_config.size()) {
+		// DRAM, counted as misses and writebacks of the last level
+		return;
+	}
+
+	Level& l = *m_cores[core].levels[level];
+	uint64_t* set = &l.entries[(line % l.numSets) * l.ways];
+
+	if (!fill) {
+		l.stats.accesses++;
+	}
+
+	for (size_t way = 0; way < l.ways; way++) {
+		if (set[way] != invalidEntry && (set[way] >> 1) == line) {
+			uint64_t entry = set[way] | write;
+			std::copy_backward(set, set + way, set + way + 1);
+			set[0] = entry;
+			return;
+		}
+	}
+
+	uint64_t victim = set[l.ways - 1];
+	std::copy_backward(set, set + l.ways - 1, set + l.ways);
+	set[0] = (line << 1) | write;
+
+	// A writeback from the level above brings the entire line, only
+	// demand misses are fetched from the level below.
+	if (!fill) {
+		l.stats.misses++;
+		accessLevel(core, level + 1, line, false, false);
+	}
+
+	if (victim != invalidEntry && (victim & 1)) {
+		l.stats.writebacks++;
+		accessLevel(core, level + 1, victim >> 1, true, true);
+	}
+}
+
+void
+Cache::flush()
+{
+	for (size_t level = 0; level < m_config.size(); level++) {
+		for (size_t core = 0; core < m_cores.size(); core++) {
+			Level& l = *m_cores[core].levels[level];
+			if (level + 1 == m_config.size() && core > 0) {
+				// the shared level is only flushed once
+				break;
+			}
+
+			for (uint64_t& entry : l.entries) {
+				if (entry != invalidEntry && (entry & 1)) {
+					l.stats.writebacks++;
+					accessLevel(core, level + 1, entry >> 1, true, true);
+					entry &= ~(uint64_t) 1;
+				}
+			}
+		}
+	}
+}
+
+void
+Cache::resetStats()
+{
+	for (Level& level : m_levels) {
+		level.stats = LevelStats();
+	}
+}
+
+LevelStats
+Cache::stats(size_t level) const
+{
+	if (level + 1 == m_config.size()) {
+		return m_levels.back().stats;
+	}
+
+	LevelStats sum;
+	for (const Core& core : m_cores) {
+		sum.accesses += core.levels[level]->stats.accesses;
+		sum.misses += core.levels[level]->stats.misses;
+		sum.writebacks += core.levels[level]->stats.writebacks;
+	}
+	return sum;
+}
+
+size_t
+Cache::dramBytesRead() const
+{
+	return m_levels.back().stats.misses * m_lineSize;
+}
+
+size_t
+Cache::dramBytesWritten() const
+{
+	return m_levels.back().stats.writebacks * m_lineSize;
+}
+
+size_t
+CacheSim::parseBytes(const std::string& str)
+{
+	size_t pos;
+	size_t bytes = std::stoull(str, &pos);
+	if (pos < str.size() && (str[pos] == 'K' || str[pos] == 'k')) {
+		bytes *= 1024;
+	}
+	else if (pos < str.size() && (str[pos] == 'M' || str[pos] == 'm')) {
+		bytes *= 1024 * 1024;
+	}
+	return bytes;
+}
+
+std::vector<LevelConfig>
+CacheSim::parseConfig(const std::string& str)
+{
+	std::vector<LevelConfig> config;
+
+	size_t begin = 0;
+	while (begin <= str.size()) {
+		size_t end = str.find(',', begin);
+		if (end == std::string::npos) {
+			end = str.size();
+		}
+
+		std::string level = str.substr(begin, end - begin);
+		size_t colon = level.find(':');
+		if (colon == std::string::npos) {
+			throw std::invalid_argument(std::format(
+				"cache level must be size:ways, got {}", level
+			));
+		}
+
+		config.push_back({
+			parseBytes(level.substr(0, colon)),
+			std::stoull(level.substr(colon + 1)),
+			config.size() + 1
+		});
+		begin = end + 1;
+	}
+
+	return config;
+}
+
+std::vector<LevelConfig>
+CacheSim::readSysfsConfig()
+{
+	const std::string base = "/sys/devices/system/cpu/cpu0/cache/index";
+	std::map<size_t, LevelConfig> levels;
+
+	for (size_t index = 0; ; index++) {
+		std::string dir = base + std::to_string(index) + "/";
+		std::ifstream levelFile(dir + "level");
+		std::ifstream typeFile(dir + "type");
+		std::ifstream sizeFile(dir + "size");
+		std::ifstream waysFile(dir + "ways_of_associativity");
+		std::ifstream sharedFile(dir + "shared_cpu_list");
+		if (!levelFile || !typeFile || !sizeFile || !waysFile) {
+			break;
+		}
+
+		size_t level, ways;
+		std::string type, size, shared;
+		levelFile >> level;
+		typeFile >> type;
+		sizeFile >> size;
+		waysFile >> ways;
+		sharedFile >> shared;
+
+		if (type == "Instruction") {
+			continue;
+		}
+
+		// e.g. "0-3,8-11"
+		size_t sharedCpus = 0;
+		size_t begin = 0;
+		while (begin < shared.size()) {
+			size_t end = shared.find(',', begin);
+			if (end == std::string::npos) {
+				end = shared.size();
+			}
+
+			std::string range = shared.substr(begin, end - begin);
+			size_t dash = range.find('-');
+			size_t first = std::stoull(range);
+			size_t last = dash == std::string::npos ?
+						  first : std::stoull(range.substr(dash + 1));
+			sharedCpus += last - first + 1;
+			begin = end + 1;
+		}
+
+		levels[level] = {
+			parseBytes(size), ways, level, std::max<size_t>(sharedCpus, 1)
+		};
+	}
+
+	std::vector<LevelConfig> config;
+	for (auto& [level, levelConfig] : levels) {
+		config.push_back(levelConfig);
+	}
+	return config;
+}
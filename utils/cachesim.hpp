@@ -0,0 +1,163 @@
+// BSD Zero Clause License
+// 
+// Copyright (C) 2024 Yifeng Li
+// 
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+// REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+// AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+// LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+// OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifndef CACHESIM_HPP
+#define CACHESIM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace CacheSim {
+	using size_t = std::size_t;
+
+	struct LevelConfig
+	{
+		size_t bytes;
+		size_t ways;
+
+		// level number (1 for L1), and the number of CPUs sharing it,
+		// only known for caches read from sysfs
+		size_t level = 0;
+		size_t sharedCpus = 1;
+	};
+
+	struct LevelStats
+	{
+		// demand accesses from the level above (or the core), and the
+		// lines fetched from the level below because they missed
+		size_t accesses = 0;
+		size_t misses = 0;
+
+		// dirty lines evicted (or flushed) to the level below
+		size_t writebacks = 0;
+	};
+
+	// Multi-level, set-associative, write-back and write-allocate cache
+	// with LRU replacement. Levels are non-inclusive: a line fetched by L1
+	// is also inserted into L2 and L3 on the way, but evictions from a
+	// lower level don't invalidate upper levels. Dirty evictions are
+	// written into the next level without fetching the line first, as
+	// full lines are written. Sets are indexed by the line address modulo
+	// the number of sets, without the hashing of real sliced caches.
+	//
+	// With multiple cores, each core has private copies of all levels
+	// but the last one, which is shared. Coherence isn't modeled, cores
+	// are expected to write disjoint lines.
+	class Cache
+	{
+	public:
+		Cache(
+			const std::vector<LevelConfig>& config,
+			size_t lineSize = 64, size_t numCores = 1
+		);
+
+		Cache(const Cache&) = delete;
+		Cache& operator= (const Cache&) = delete;
+
+		void access(uint64_t addr, bool write, size_t core = 0)
+		{
+			uint64_t line = addr / m_lineSize;
+
+			// The last line is always the MRU entry of its set in L1,
+			// and hitting it again doesn't change the LRU order. Most
+			// accesses of a stencil are to the line of the last access.
+			// Not if L1 is the shared level, other cores may have
+			// evicted it or moved it within its set since.
+			Core& c = m_cores[core];
+			if (m_fastPath && line == c.lastLine) {
+				c.levels[0]->stats.accesses++;
+				*c.lastEntry |= write;
+				return;
+			}
+			accessLevel(core, 0, line, write, false);
+
+			Level& l1 = *c.levels[0];
+			c.lastLine = line;
+			c.lastEntry = &l1.entries[(line % l1.numSets) * l1.ways];
+		}
+
+		// Write back all dirty lines down to DRAM, so the writebacks of
+		// the last level are all DRAM writes of the run.
+		void flush();
+
+		void resetStats();
+
+		size_t levels() const { return m_config.size(); }
+		size_t cores() const { return m_cores.size(); }
+		size_t lineSize() const { return m_lineSize; }
+		const LevelConfig& config(size_t level) const
+		{
+			return m_config[level];
+		}
+
+		// sum of all cores for private levels
+		LevelStats stats(size_t level) const;
+
+		size_t dramBytesRead() const;
+		size_t dramBytesWritten() const;
+
+	private:
+		void accessLevel(
+			size_t core, size_t level, uint64_t line, bool write, bool fill
+		);
+
+		struct Level
+		{
+			size_t ways;
+			size_t numSets;
+
+			// Tags of each set ordered from MRU to LRU, as (line << 1)
+			// | dirty, or invalidEntry.
+			std::vector<uint64_t> entries;
+
+			LevelStats stats;
+		};
+
+		struct Core
+		{
+			// private levels of this core, followed by the shared one
+			std::vector<Level*> levels;
+
+			uint64_t lastLine = UINT64_MAX;
+			uint64_t* lastEntry = NULL;
+		};
+
+		static constexpr uint64_t invalidEntry = UINT64_MAX;
+
+		size_t m_lineSize;
+		std::vector<LevelConfig> m_config;
+		bool m_fastPath;
+
+		// private levels of all cores, then the shared last level
+		std::vector<Level> m_levels;
+		std::vector<Core> m_cores;
+	};
+
+	// Parse a size in bytes with an optional K or M suffix (or k, m),
+	// e.g. "48K", "2M" or "32768".
+	size_t parseBytes(const std::string& str);
+
+	// Parse a hierarchy such as "48K:12,2M:16,32M:16", each level is
+	// a size in bytes and its number of ways.
+	std::vector<LevelConfig> parseConfig(const std::string& str);
+
+	// Read the data and unified caches of cpu0 from sysfs, in the order
+	// of their levels, including the number of CPUs sharing each one.
+	std::vector<LevelConfig> readSysfsConfig();
+}
+
+#endif  // CACHESIM_HPP
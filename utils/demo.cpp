@@ -14,7 +14,7 @@ size_t tileHalfTs = SIZE_MAX;
 bool dumpRanges = false;
 
 int main(int argc, char** argv);
-void dumpAllTiles(Plan3D plan);
+void dumpAllTiles(const Plan3D& plan);
 void parseArgs(int argc, char** argv);
 Plan3D makePlan(size_t tileHalfTs);
 
@@ -31,7 +31,7 @@ int main(int argc, char** argv)
 	return 0;
 }
 
-void dumpAllTiles(Plan3D plan)
+void dumpAllTiles(const Plan3D& plan)
 {
 	size_t stage = 0;
 	for (const TileList3D& tileList : plan) {
@@ -102,12 +102,21 @@ void parseArgs(int argc, char** argv)
 			   "in ASCII diagram\n\n", progname);
 		printf("Usage: %s [OPTION]\n", progname);
 		printf("   --grid-size\t\t-g\ti,j,k\t\t\t(e.g: 100,100,100)\n");
-		printf("   --tile-size\t\t-t\tit,jt,kt/kp\t\t"
-			   "(e.g: 20t,20t,20t or 10t,10t,10p)\n");
+		printf("   --tile-size\t\t-t\tit/id,jt/jd,kt/kd/kp\t"
+			   "(e.g: 20t,20t,20t, 10t,10t,10p or 20d,20d,20d)\n");
+		printf("   \t\t\tid,jp,f\t\t\t(DiamondTorre, e.g: 20d,20p,f)\n");
+		printf("   \t\t\tic,jc,kc\t\t(DiamondCandy, e.g: 20c,20c,20c)\n");
 		printf("   --tile-height\t-h\thalfTimesteps\t\t(e.g: 18)\n");
 		printf("   --dump\t\t-d\tdump plan for debugging\t(default: no)\n");
 		printf("\nNote: Parallelogram tiling uses suffix \"p\", "
-			   "trapezoid tiling uses suffix \"t\".\n");
+			   "trapezoid tiling uses suffix \"t\", "
+			   "diamond tiling uses suffix \"d\".\n");
+		printf("Note: DiamondTorre uses diamond tiling in dimension i, "
+			   "parallelogram tiling\n      in dimension j, and column "
+			   "tiling (suffix \"f\", not tiled) in dimension k.\n");
+		printf("Note: DiamondCandy uses diamond tiling in all dimensions, "
+			   "grouped into levels\n      of candies that can run "
+			   "concurrently.\n");
 		printf("Note: Make sure the grid size is not too large, otherwise "
 		       "the ASCII diagram won't fit in your terminal window.\n");
 		std::exit(1);
@@ -125,10 +134,13 @@ void parseArgs(int argc, char** argv)
 	for (size_t dim = 0; dim < 3; dim++) {
 		std::string& arg = tileArgString[dim];
 
-		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p') {
+		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p' &&
+			arg[arg.size() - 1] != 'd' && arg[arg.size() - 1] != 'f' &&
+			arg[arg.size() - 1] != 'c'
+		) {
 			throw std::invalid_argument(
-				std::format("tile suffix must be 't' or 'p', got {}",
-							arg[arg.size() - 1])
+				std::format("tile suffix must be 't', 'p', 'd', 'f' or 'c', "
+							"got {}", arg[arg.size() - 1])
 			);
 		}
 
@@ -137,15 +149,119 @@ void parseArgs(int argc, char** argv)
 		tileSize[dim] = atoi(arg.c_str());
 	}
 
-	if (tileType[0] != 't' || tileType[1] != 't') {
+	if (tileType[1] == 'p' || tileType[2] == 'f') {
+		// DiamondTorre
+		if (tileType[0] != 'd' || tileType[1] != 'p' || tileType[2] != 'f') {
+			throw std::invalid_argument(
+				"DiamondTorre must use diamond tiling (suffix d) in "
+				"dimension i, parallelogram tiling (suffix p) in dimension "
+				"j, and column tiling (suffix f) in dimension k"
+			);
+		}
+
+		// dimension k is not tiled
+		tileSize[2] = gridSize[2];
+	}
+	else {
+		if (tileType[0] != tileType[1] ||
+			(tileType[0] != 't' && tileType[0] != 'd' && tileType[0] != 'c')
+		) {
+			throw std::invalid_argument(
+				"dimension i and j only support trapezoid (suffix t), "
+				"diamond (suffix d) or DiamondCandy (suffix c) tiling"
+			);
+		}
+		if (tileType[2] != 'p' && tileType[2] != tileType[0]) {
+			throw std::invalid_argument(
+				"dimension k must use parallelogram tiling (suffix p), or "
+				"the same tiling as dimension i and j"
+			);
+		}
+		if (tileType[0] == 'c' && tileType[2] != 'c') {
+			throw std::invalid_argument(
+				"DiamondCandy (suffix c) must be used in all dimensions"
+			);
+		}
+	}
+	if ((tileType[0] == 'd' || tileType[0] == 'c') && tileHalfTs % 4 != 0) {
 		throw std::invalid_argument(
-			"dimension i and j only support trapezoid tiling (suffix t)"
+			"diamond tiling requires tile height to be a multiple of 4"
 		);
 	}
 }
 
 Plan3D makePlan(size_t tileHalfTs)
 {
+	if (tileType[2] == 'f') {
+		Plan1D i = computeDiamondTiles(gridSize[0], tileSize[0], tileHalfTs);
+		Plan1D j = computeParallelogramTiles(
+			gridSize[1], tileSize[1], tileHalfTs
+		);
+		Plan1D k = computeColumnTiles(gridSize[2], tileHalfTs);
+		Plan3D plan = combineTilesDiamondTorre(i, j, k);
+
+		printf("tiling for dimension i:\n");
+		visualizeTiles(i, gridSize[0], tileSize[0], tileHalfTs);
+
+		printf("\ntiling for dimension j:\n");
+		visualizeTiles(j, gridSize[1], tileSize[1], tileHalfTs);
+
+		printf("\ntiling for dimension k:\n");
+		visualizeTiles(k, gridSize[2], tileSize[2], tileHalfTs);
+
+		return plan;
+	}
+
+	if (tileType[0] == 'c') {
+		Plan1D i = computeDiamondTiles(gridSize[0], tileSize[0], tileHalfTs);
+		Plan1D j = computeDiamondTiles(gridSize[1], tileSize[1], tileHalfTs);
+		Plan1D k = computeDiamondTiles(gridSize[2], tileSize[2], tileHalfTs);
+		Plan3D plan = combineTilesDiamondCandy(i, j, k);
+
+		printf("tiling for dimension i:\n");
+		visualizeTiles(i, gridSize[0], tileSize[0], tileHalfTs);
+
+		printf("\ntiling for dimension j:\n");
+		visualizeTiles(j, gridSize[1], tileSize[1], tileHalfTs);
+
+		printf("\ntiling for dimension k:\n");
+		visualizeTiles(k, gridSize[2], tileSize[2], tileHalfTs);
+
+		printf("\n%zu concurrency levels:\n", plan.size());
+		for (size_t level = 0; level < plan.size(); level++) {
+			printf("level %zu: %zu candies\n", level, plan[level].size());
+		}
+
+		return plan;
+	}
+
+	if (tileType[0] == 'd') {
+		Plan1D i = computeDiamondTiles(gridSize[0], tileSize[0], tileHalfTs);
+		Plan1D j = computeDiamondTiles(gridSize[1], tileSize[1], tileHalfTs);
+
+		printf("tiling for dimension i:\n");
+		visualizeTiles(i, gridSize[0], tileSize[0], tileHalfTs);
+
+		printf("\ntiling for dimension j:\n");
+		visualizeTiles(j, gridSize[1], tileSize[1], tileHalfTs);
+
+		Plan1D k;
+		Plan3D plan;
+		if (tileType[2] == 'p') {
+			k = computeParallelogramTiles(gridSize[2], tileSize[2], tileHalfTs);
+			plan = combineTilesDDP(i, j, k);
+		}
+		else {
+			k = computeDiamondTiles(gridSize[2], tileSize[2], tileHalfTs);
+			plan = combineTilesDDD(i, j, k);
+		}
+
+		printf("\ntiling for dimension k:\n");
+		visualizeTiles(k, gridSize[2], tileSize[2], tileHalfTs);
+
+		return plan;
+	}
+
 	Plan1D i = computeTrapezoidTiles(gridSize[0], tileSize[0], tileHalfTs);
 	Plan1D j = computeTrapezoidTiles(gridSize[1], tileSize[1], tileHalfTs);
 
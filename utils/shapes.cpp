@@ -5,20 +5,42 @@
 #include <cstdint>
 #include <stdexcept>
 #include <array>
+#include <vector>
 #include <unordered_map>
+#include <algorithm>
 #include <format>
 
 #include "tiling.hpp"
+#include "plancache.hpp"
+#include "cachesim.hpp"
 using namespace Tiling;
 
 int main(int argc, char** argv);
 void parseArgs(int argc, char** argv);
-Plan3D makePlan(size_t tileHalfTs);
+const Plan3D& makePlan(size_t tileHalfTs);
+Plan3D buildPlan(size_t tileHalfTs);
+void readCacheSizes(void);
 
 std::array<size_t, 3> gridSize = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
 std::array<size_t, 3> tileSize = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
 std::array<char, 3>   tileType = {'-', '-', '-'};
 size_t tileHalfTs = SIZE_MAX;
+PlanCache planCache;
+
+// L1, L2 and L3 data cache sizes in bytes, 0 if unknown
+std::array<size_t, 3> cacheSizes = {0, 0, 0};
+
+enum class OutputFormat
+{
+	Text, Json, Csv
+};
+OutputFormat outputFormat = OutputFormat::Text;
+
+// each cell of a field or operator array is a float vec3
+const size_t bytesPerCell = 3 * sizeof(float);
+
+// FLOPs of a single cell update, for both volt and curr
+const size_t flopsPerCell = 18;
 
 using SubtileSizeKey = std::array<size_t, 3>;
 
@@ -34,20 +56,144 @@ struct SubtileSizeKeyHash {
 	}
 };
 
+// Statistics of all subtiles of the same shape. Working sets are the
+// maximum of these subtiles, FLOPs and traffic are their sum.
+struct ShapeStats
+{
+	size_t count = 0;
+
+	// bytes of all 6 arrays accessed at each halfTs of the subtile
+	std::vector<size_t> halfTsBytes;
+
+	// bytes of all 6 arrays accessed by the entire subtile, i.e. what
+	// must stay in cache for the data to be reused between halfTs
+	size_t footprintBytes = 0;
+
+	// total FLOPs, and the DRAM traffic if the footprint is loaded once
+	// and volt and curr are written back once
+	size_t flops = 0;
+	size_t trafficBytes = 0;
+};
+
 using SubtileSizeMap = std::unordered_map<
-	SubtileSizeKey, size_t, SubtileSizeKeyHash
+	SubtileSizeKey, ShapeStats, SubtileSizeKeyHash
 >;
 
+static size_t
+cellsOf(const Range3D<size_t>& range)
+{
+	size_t cells = 1;
+	for (size_t n = 0; n < 3; n++) {
+		cells *= range.last[n] - range.first[n] + 1;
+	}
+	return cells;
+}
+
+// Grow the bounding box to include a range. The box is empty (all
+// SIZE_MAX) initially.
+static void
+extendBox(Range3D<size_t>& box, const Range3D<size_t>& range)
+{
+	for (size_t n = 0; n < 3; n++) {
+		if (box.first[n] == SIZE_MAX) {
+			box.first[n] = range.first[n];
+			box.last[n] = range.last[n];
+		}
+		else {
+			box.first[n] = std::min(box.first[n], range.first[n]);
+			box.last[n] = std::max(box.last[n], range.last[n]);
+		}
+	}
+}
+
+// A volt update at a range also reads curr at the previous cells, and
+// a curr update also reads volt at the next cells.
+static Range3D<size_t>
+neighborsOf(const Range3D<size_t>& range, bool volt)
+{
+	Range3D<size_t> neighbors = range;
+	for (size_t n = 0; n < 3; n++) {
+		if (volt && neighbors.first[n] > 0) {
+			neighbors.first[n]--;
+		}
+		else if (!volt && neighbors.last[n] < gridSize[n] - 1) {
+			neighbors.last[n]++;
+		}
+	}
+	return neighbors;
+}
+
+static void
+analyzeSubtile(const Subtile3D& subtile, ShapeStats& stats)
+{
+	const Range3D<size_t> emptyBox = {
+		{SIZE_MAX, SIZE_MAX, SIZE_MAX}, {SIZE_MAX, SIZE_MAX, SIZE_MAX}
+	};
+
+	// bounding boxes of the accessed cells of volt, curr, vv/vi, ii/iv
+	Range3D<size_t> voltBox = emptyBox;
+	Range3D<size_t> currBox = emptyBox;
+	Range3D<size_t> voltOpBox = emptyBox;
+	Range3D<size_t> currOpBox = emptyBox;
+
+	if (stats.halfTsBytes.size() < subtile.size()) {
+		stats.halfTsBytes.resize(subtile.size(), 0);
+	}
+
+	size_t cellsUpdated = 0;
+	for (size_t idx = 0; idx < subtile.size(); idx++) {
+		const Range3D<size_t>& range = subtile[idx];
+		if (range.empty()) {
+			continue;
+		}
+
+		// firstHalfTs is always even, so even ranges update volt
+		bool volt = idx % 2 == 0;
+		Range3D<size_t> neighbors = neighborsOf(range, volt);
+
+		// the updated array and its 2 operators, and the other array
+		size_t cells = cellsOf(range);
+		size_t bytes = (cells * 3 + cellsOf(neighbors)) * bytesPerCell;
+		stats.halfTsBytes[idx] = std::max(stats.halfTsBytes[idx], bytes);
+		cellsUpdated += cells;
+
+		if (volt) {
+			extendBox(voltBox, range);
+			extendBox(voltOpBox, range);
+			extendBox(currBox, neighbors);
+		}
+		else {
+			extendBox(currBox, range);
+			extendBox(currOpBox, range);
+			extendBox(voltBox, neighbors);
+		}
+	}
+
+	size_t fieldBytes = 0;
+	size_t operatorBytes = 0;
+	for (const Range3D<size_t>& box : {voltBox, currBox}) {
+		if (box.first[0] != SIZE_MAX) {
+			fieldBytes += cellsOf(box) * bytesPerCell;
+		}
+	}
+	for (const Range3D<size_t>& box : {voltOpBox, currOpBox}) {
+		if (box.first[0] != SIZE_MAX) {
+			operatorBytes += 2 * cellsOf(box) * bytesPerCell;
+		}
+	}
+
+	stats.footprintBytes = std::max(
+		stats.footprintBytes, fieldBytes + operatorBytes
+	);
+	stats.flops += cellsUpdated * flopsPerCell;
+	stats.trafficBytes += fieldBytes * 2 + operatorBytes;
+}
+
 int main(int argc, char** argv)
 {
 	parseArgs(argc, argv);
 
-	printf("grid\t\t" "%04zu x %04zu x %04zu\n",
-		   gridSize[0], gridSize[1], gridSize[2]);
-	printf("tile\t\t" "%04zu x %04zu x %04zu\n",
-		   tileSize[0], tileSize[1], tileSize[2]);
-
-	Plan3D plan = makePlan(tileHalfTs);
+	const Plan3D& plan = makePlan(tileHalfTs);
 	
 	SubtileSizeMap map;
 	size_t stage = 0;
@@ -60,28 +206,29 @@ int main(int argc, char** argv)
 					subtile.last[2] - subtile.first[2] + 1
 				};
 
-				if (map.find(size) == map.end()) {
-					map[size] = 1;
-				}
-				else {
-					map[size]++;
-				}
+				ShapeStats& stats = map[size];
+				stats.count++;
+				analyzeSubtile(subtile, stats);
 			}
 		}
 		stage++;
 	}
 
-	size_t totalOverlappedBytes = 0;
-	printf("\n%zu unique subtile shapes found.\n", map.size());
-	for (auto& [key, val]: map) {
-		printf("%02zu x %02zu x %02zu\t" "%zu\tsubtiles\n",
-			   key[0], key[1], key[2], val);
+	// sorted by shape, so the output is deterministic
+	std::vector<std::pair<SubtileSizeKey, ShapeStats>> shapes(
+		map.begin(), map.end()
+	);
+	std::sort(shapes.begin(), shapes.end(),
+		[](const auto& a, const auto& b) { return a.first < b.first; }
+	);
 
+	size_t totalOverlappedBytes = 0;
+	for (auto& [key, val]: shapes) {
 		size_t bytes = key[0] * key[1] * key[2];
 		bytes *= 3;  // vec3
 		bytes *= 4;  // sizeof(float)
 		bytes *= 4;  // vv, vi, iv, ii
-		bytes *= val;
+		bytes *= val.count;
 
 		totalOverlappedBytes += bytes;
 	}
@@ -91,6 +238,111 @@ int main(int argc, char** argv)
 	totalNaiveBytes *= 4;
 	totalNaiveBytes *= 4;
 
+	if (outputFormat == OutputFormat::Json) {
+		printf("{\n");
+		printf("  \"grid\": [%zu, %zu, %zu],\n",
+			   gridSize[0], gridSize[1], gridSize[2]);
+		printf("  \"tile\": [%zu, %zu, %zu],\n",
+			   tileSize[0], tileSize[1], tileSize[2]);
+		printf("  \"tileType\": \"%c%c%c\",\n",
+			   tileType[0], tileType[1], tileType[2]);
+		printf("  \"halfTimesteps\": %zu,\n", tileHalfTs);
+		printf("  \"cacheBytes\": [%zu, %zu, %zu],\n",
+			   cacheSizes[0], cacheSizes[1], cacheSizes[2]);
+		printf("  \"naiveBytes\": %zu,\n", totalNaiveBytes);
+		printf("  \"overlappedBytes\": %zu,\n", totalOverlappedBytes);
+		printf("  \"shapes\": [\n");
+
+		for (size_t idx = 0; idx < shapes.size(); idx++) {
+			auto& [key, val] = shapes[idx];
+			size_t peakBytes = *std::max_element(
+				val.halfTsBytes.begin(), val.halfTsBytes.end()
+			);
+
+			printf("    {\n");
+			printf("      \"size\": [%zu, %zu, %zu],\n", key[0], key[1], key[2]);
+			printf("      \"subtiles\": %zu,\n", val.count);
+			printf("      \"halfTsBytes\": [");
+			for (size_t halfTs = 0; halfTs < val.halfTsBytes.size(); halfTs++) {
+				printf("%s%zu", halfTs > 0 ? ", " : "", val.halfTsBytes[halfTs]);
+			}
+			printf("],\n");
+			printf("      \"peakHalfTsBytes\": %zu,\n", peakBytes);
+			printf("      \"footprintBytes\": %zu,\n", val.footprintBytes);
+			printf("      \"flops\": %zu,\n", val.flops);
+			printf("      \"trafficBytes\": %zu,\n", val.trafficBytes);
+			printf("      \"arithmeticIntensity\": %.4f,\n",
+				   (double) val.flops / val.trafficBytes);
+			printf("      \"fits\": [%s, %s, %s]\n",
+				   cacheSizes[0] && val.footprintBytes <= cacheSizes[0] ?
+					   "true" : "false",
+				   cacheSizes[1] && val.footprintBytes <= cacheSizes[1] ?
+					   "true" : "false",
+				   cacheSizes[2] && val.footprintBytes <= cacheSizes[2] ?
+					   "true" : "false");
+			printf("    }%s\n", idx + 1 < shapes.size() ? "," : "");
+		}
+
+		printf("  ]\n");
+		printf("}\n");
+		return 0;
+	}
+
+	if (outputFormat == OutputFormat::Csv) {
+		printf("size_i,size_j,size_k,subtiles,half_ts_bytes,"
+			   "peak_half_ts_bytes,footprint_bytes,flops,traffic_bytes,"
+			   "arithmetic_intensity,fits_l1,fits_l2,fits_l3\n");
+
+		for (auto& [key, val]: shapes) {
+			size_t peakBytes = *std::max_element(
+				val.halfTsBytes.begin(), val.halfTsBytes.end()
+			);
+
+			printf("%zu,%zu,%zu,%zu,", key[0], key[1], key[2], val.count);
+			for (size_t halfTs = 0; halfTs < val.halfTsBytes.size(); halfTs++) {
+				printf("%s%zu", halfTs > 0 ? ";" : "", val.halfTsBytes[halfTs]);
+			}
+			printf(",%zu,%zu,%zu,%zu,%.4f", peakBytes, val.footprintBytes,
+				   val.flops, val.trafficBytes,
+				   (double) val.flops / val.trafficBytes);
+			for (size_t level = 0; level < 3; level++) {
+				bool fits = cacheSizes[level] &&
+							val.footprintBytes <= cacheSizes[level];
+				printf(",%d", fits);
+			}
+			printf("\n");
+		}
+		return 0;
+	}
+
+	printf("grid\t\t" "%04zu x %04zu x %04zu\n",
+		   gridSize[0], gridSize[1], gridSize[2]);
+	printf("tile\t\t" "%04zu x %04zu x %04zu\n",
+		   tileSize[0], tileSize[1], tileSize[2]);
+	printf("cache\t\t" "L1 %zu KiB, L2 %zu KiB, L3 %zu KiB\n",
+		   cacheSizes[0] / 1024, cacheSizes[1] / 1024, cacheSizes[2] / 1024);
+
+	printf("\n%zu unique subtile shapes found.\n", shapes.size());
+	printf("shape\t\tcount\t\tpeak\t\tfootprint\tFLOP/byte\tfits\n");
+	for (auto& [key, val]: shapes) {
+		size_t peakBytes = *std::max_element(
+			val.halfTsBytes.begin(), val.halfTsBytes.end()
+		);
+
+		const char* fits = "none";
+		for (size_t level = 3; level-- > 0; ) {
+			if (cacheSizes[level] && val.footprintBytes <= cacheSizes[level]) {
+				fits = level == 0 ? "L1" : level == 1 ? "L2" : "L3";
+			}
+		}
+
+		printf("%02zu x %02zu x %02zu\t" "%zu\t\t"
+			   "%zu KiB\t\t" "%zu KiB\t\t" "%.2f\t\t" "%s\n",
+			   key[0], key[1], key[2], val.count,
+			   peakBytes / 1024, val.footprintBytes / 1024,
+			   (double) val.flops / val.trafficBytes, fits);
+	}
+
 	printf("%zu bytes of RAM needed if grid is stored naively\n"
 		   "%zu bytes of RAM needed if overlapped tiles are stored "
 		   "multiple times\n", totalNaiveBytes, totalOverlappedBytes);
@@ -102,6 +354,9 @@ void parseArgs(int argc, char** argv)
 		{"grid-size",			required_argument, 0, 'g'},
 		{"tile-size",			required_argument, 0, 't'},
 		{"tile-height",			required_argument, 0, 'h'},
+		{"plan-cache",			required_argument, 0, 'c'},
+		{"cache-size",			required_argument, 0, 'm'},
+		{"output",				required_argument, 0, 'o'},
 	};
 
 	const char* progname = "shapes";
@@ -113,9 +368,10 @@ void parseArgs(int argc, char** argv)
 
 	char* gridArg = NULL;
 	char* tileArg = NULL;
+	char* cacheArg = NULL;
 	int opt;
 
-	while ((opt = getopt_long(argc, argv, "wg:t:h:n:", longopts, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "wc:m:o:g:t:h:n:", longopts, NULL)) != -1) {
 		switch (opt) {
 			case 'g':
 				gridArg = optarg;
@@ -126,6 +382,29 @@ void parseArgs(int argc, char** argv)
 			case 'h':
 				tileHalfTs = atoi(optarg);
 				break;
+			case 'c':
+				planCache = PlanCache(optarg);
+				break;
+			case 'm':
+				cacheArg = optarg;
+				break;
+			case 'o':
+				if (strcmp(optarg, "json") == 0) {
+					outputFormat = OutputFormat::Json;
+				}
+				else if (strcmp(optarg, "csv") == 0) {
+					outputFormat = OutputFormat::Csv;
+				}
+				else if (strcmp(optarg, "text") == 0) {
+					outputFormat = OutputFormat::Text;
+				}
+				else {
+					throw std::invalid_argument(
+						std::format("output must be text, json or csv, "
+									"got {}", optarg)
+					);
+				}
+				break;
 			default:
 				break;
 		}
@@ -135,11 +414,24 @@ void parseArgs(int argc, char** argv)
 		printf("%s: Show statistics of all unique tile shapes.\n\n", progname);
 		printf("Usage: %s [OPTION]\n", progname);
 		printf("   --grid-size\t\t-g\ti,j,k\t\t\t(e.g: 400,400,400)\n");
-		printf("   --tile-size\t\t-t\tit,jt,kt/kp\t\t"
-			   "(e.g: 20t,20t,20t or 20t,20t,20p)\n");
+		printf("   --tile-size\t\t-t\tit/id,jt/jd,kt/kd/kp\t"
+			   "(e.g: 20t,20t,20t, 20t,20t,20p or 20d,20d,20p)\n");
+		printf("   \t\t\tid,jp,f\t\t\t(DiamondTorre, e.g: 20d,20p,f)\n");
+		printf("   \t\t\tic,jc,kc\t\t(DiamondCandy, e.g: 20c,20c,20c)\n");
 		printf("   --tile-height\t-h\thalfTimesteps\t\t(e.g: 18)\n");
+		printf("   --plan-cache\t-c\tdirectory\t\t(default: none)\n");
+		printf("   --cache-size\t\t-m\tl1,l2,l3\t\t(e.g: 48K,2M,32M, "
+			   "default: from sysfs)\n");
+		printf("   --output\t\t-o\ttext/json/csv\t\t(default: text)\n");
 		printf("\nNote: Parallelogram tiling uses suffix \"p\", "
-			   "trapezoid tiling uses suffix \"t\".\n");
+			   "trapezoid tiling uses suffix \"t\", "
+			   "diamond tiling uses suffix \"d\".\n");
+		printf("Note: DiamondTorre uses diamond tiling in dimension i, "
+			   "parallelogram tiling\n      in dimension j, and column "
+			   "tiling (suffix \"f\", not tiled) in dimension k.\n");
+		printf("Note: DiamondCandy uses diamond tiling in all dimensions, "
+			   "grouped into levels\n      of candies that can run "
+			   "concurrently.\n");
 		std::exit(1);
 	}
 
@@ -147,6 +439,20 @@ void parseArgs(int argc, char** argv)
 	gridSize[1] = atoi(strtok(NULL, ","));
 	gridSize[2] = atoi(strtok(NULL, ","));
 
+	if (cacheArg) {
+		char* token = strtok(cacheArg, ",");
+		for (size_t level = 0; level < 3; level++) {
+			if (!token) {
+				throw std::invalid_argument("cache size must be l1,l2,l3");
+			}
+			cacheSizes[level] = CacheSim::parseBytes(token);
+			token = strtok(NULL, ",");
+		}
+	}
+	else {
+		readCacheSizes();
+	}
+
 	std::array<std::string, 3> tileArgString;
 	tileArgString[0] = strtok(tileArg, ",");
 	tileArgString[1] = strtok(NULL, ",");
@@ -155,10 +461,13 @@ void parseArgs(int argc, char** argv)
 	for (size_t dim = 0; dim < 3; dim++) {
 		std::string& arg = tileArgString[dim];
 
-		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p') {
+		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p' &&
+			arg[arg.size() - 1] != 'd' && arg[arg.size() - 1] != 'f' &&
+			arg[arg.size() - 1] != 'c'
+		) {
 			throw std::invalid_argument(
-				std::format("tile suffix must be 't' or 'p', got {}",
-							arg[arg.size() - 1])
+				std::format("tile suffix must be 't', 'p', 'd', 'f' or 'c', "
+							"got {}", arg[arg.size() - 1])
 			);
 		}
 
@@ -167,28 +476,133 @@ void parseArgs(int argc, char** argv)
 		tileSize[dim] = atoi(arg.c_str());
 	}
 
-	if (tileType[0] != 't' || tileType[1] != 't') {
+	if (tileType[1] == 'p' || tileType[2] == 'f') {
+		// DiamondTorre
+		if (tileType[0] != 'd' || tileType[1] != 'p' || tileType[2] != 'f') {
+			throw std::invalid_argument(
+				"DiamondTorre must use diamond tiling (suffix d) in "
+				"dimension i, parallelogram tiling (suffix p) in dimension "
+				"j, and column tiling (suffix f) in dimension k"
+			);
+		}
+
+		// dimension k is not tiled
+		tileSize[2] = gridSize[2];
+	}
+	else {
+		if (tileType[0] != tileType[1] ||
+			(tileType[0] != 't' && tileType[0] != 'd' && tileType[0] != 'c')
+		) {
+			throw std::invalid_argument(
+				"dimension i and j only support trapezoid (suffix t), "
+				"diamond (suffix d) or DiamondCandy (suffix c) tiling"
+			);
+		}
+		if (tileType[2] != 'p' && tileType[2] != tileType[0]) {
+			throw std::invalid_argument(
+				"dimension k must use parallelogram tiling (suffix p), or "
+				"the same tiling as dimension i and j"
+			);
+		}
+		if (tileType[0] == 'c' && tileType[2] != 'c') {
+			throw std::invalid_argument(
+				"DiamondCandy (suffix c) must be used in all dimensions"
+			);
+		}
+	}
+	if ((tileType[0] == 'd' || tileType[0] == 'c') && tileHalfTs % 4 != 0) {
 		throw std::invalid_argument(
-			"dimension i and j only support trapezoid tiling (suffix t)"
+			"diamond tiling requires tile height to be a multiple of 4"
 		);
 	}
 }
 
-Plan3D makePlan(size_t tileHalfTs)
+// Plans are memoized, so the remainder plan reuses the 1D plans of
+// identical dimensions, and with --plan-cache, repeated runs load the
+// 3D plan from disk.
+const Plan3D& makePlan(size_t tileHalfTs)
+{
+	return planCache.plan3D(
+		gridSize, tileSize, tileType, tileHalfTs,
+		[=]() { return buildPlan(tileHalfTs); }
+	);
+}
+
+Plan3D buildPlan(size_t tileHalfTs)
 {
-	Plan1D i = computeTrapezoidTiles(gridSize[0], tileSize[0], tileHalfTs);
-	Plan1D j = computeTrapezoidTiles(gridSize[1], tileSize[1], tileHalfTs);
+	if (tileType[2] == 'f') {
+		// DiamondTorre, the remainder batch may be too short for diamond
+		// tiling, in this case, fall back to trapezoid tiling.
+		const Plan1D& i = tileHalfTs % 4 == 0 ?
+			planCache.plan1D('d', gridSize[0], tileSize[0], tileHalfTs) :
+			planCache.plan1D('t', gridSize[0], tileSize[0], tileHalfTs);
+		const Plan1D& j = planCache.plan1D(
+			'p', gridSize[1], tileSize[1], tileHalfTs
+		);
+		const Plan1D& k = planCache.plan1D(
+			'f', gridSize[2], tileSize[2], tileHalfTs
+		);
+		Plan3D plan = combineTilesDiamondTorre(i, j, k);
+		return plan;
+	}
+
+	if (tileType[0] == 'c' && tileHalfTs % 4 == 0) {
+		const Plan1D& i = planCache.plan1D(
+			'd', gridSize[0], tileSize[0], tileHalfTs
+		);
+		const Plan1D& j = planCache.plan1D(
+			'd', gridSize[1], tileSize[1], tileHalfTs
+		);
+		const Plan1D& k = planCache.plan1D(
+			'd', gridSize[2], tileSize[2], tileHalfTs
+		);
+		Plan3D plan = combineTilesDiamondCandy(i, j, k);
+		return plan;
+	}
+
+	if (tileType[0] == 'd' && tileHalfTs % 4 == 0) {
+		const Plan1D& i = planCache.plan1D(
+			'd', gridSize[0], tileSize[0], tileHalfTs
+		);
+		const Plan1D& j = planCache.plan1D(
+			'd', gridSize[1], tileSize[1], tileHalfTs
+		);
+
+		if (tileType[2] == 'p') {
+			const Plan1D& k = planCache.plan1D(
+				'p', gridSize[2], tileSize[2], tileHalfTs
+			);
+			Plan3D plan = combineTilesDDP(i, j, k);
+			return plan;
+		}
+		else {
+			const Plan1D& k = planCache.plan1D(
+				'd', gridSize[2], tileSize[2], tileHalfTs
+			);
+			Plan3D plan = combineTilesDDD(i, j, k);
+			return plan;
+		}
+	}
+
+	// The remainder batch may be too short for diamond tiling, in this
+	// case, fall back to trapezoid tiling.
+	const Plan1D& i = planCache.plan1D(
+		't', gridSize[0], tileSize[0], tileHalfTs
+	);
+	const Plan1D& j = planCache.plan1D(
+		't', gridSize[1], tileSize[1], tileHalfTs
+	);
 
 	if (tileType[2] == 'p') {
-		Plan1D k = computeParallelogramTiles(
-			gridSize[2], tileSize[2], tileHalfTs
+		const Plan1D& k = planCache.plan1D(
+			'p', gridSize[2], tileSize[2], tileHalfTs
 		);
 		Plan3D plan = combineTilesTTP(i, j, k);
 		return plan;
 	}
-	else if (tileType[2] == 't') {
-		Plan1D k = computeTrapezoidTiles(
-			gridSize[2], tileSize[2], tileHalfTs
+	else if (tileType[2] == 't' || tileType[2] == 'd' || tileType[2] == 'c') {
+		const Plan1D& k = planCache.plan1D(
+			't', gridSize[2], tileSize[2], tileHalfTs
 		);
 		Plan3D plan = combineTilesTTT(i, j, k);
 		return plan;
@@ -200,3 +614,14 @@ Plan3D makePlan(size_t tileHalfTs)
 		);
 	}
 }
+
+// Read the data and unified cache sizes of cpu0 from sysfs, levels that
+// don't exist are left at 0.
+void readCacheSizes(void)
+{
+	for (const CacheSim::LevelConfig& cache : CacheSim::readSysfsConfig()) {
+		if (cache.level >= 1 && cache.level <= 3) {
+			cacheSizes[cache.level - 1] = cache.bytes;
+		}
+	}
+}
@@ -3,16 +3,66 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <cmath>
+#include <chrono>
 #include <format>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "tiling.hpp"
+#include "plancache.hpp"
+#include "cachesim.hpp"
+#include "kernel.hpp"
 using namespace Tiling;
 
+using CacheStats = std::vector<CacheSim::LevelStats>;
+
+// Measured by runProbes() on this machine, in bytes or cell updates per
+// second, summed over all threads.
+struct Probes
+{
+	std::vector<double> cacheBandwidth;
+	double dramBandwidth = 0;
+	double naiveKernelRate = 0;
+	double tiledKernelRate = 0;
+};
+
 int main(int argc, char** argv);
 void parseArgs(int argc, char** argv);
-Plan3D makePlan(size_t tileHalfTs);
-size_t simulate(Plan3D plan);
+const Plan3D& makePlan(size_t tileHalfTs);
+Plan3D buildPlan(size_t tileHalfTs);
+size_t simulate(const Plan3D& plan);
+CacheStats simulateTiled(
+	const Plan3D& mainPlan, size_t numBatches, size_t remHalfTs,
+	size_t numThreads
+);
+CacheStats simulateNaive(void);
+void replayPlan(
+	const Plan3D& plan, CacheSim::Cache& cache, size_t numThreads
+);
+void replayNaive(CacheSim::Cache& cache);
+void replayVoltageRange(
+	CacheSim::Cache& cache, size_t core,
+	std::array<size_t, 3> first, std::array<size_t, 3> last
+);
+void replayCurrentRange(
+	CacheSim::Cache& cache, size_t core,
+	std::array<size_t, 3> first, std::array<size_t, 3> last
+);
+void addStats(CacheStats& total, CacheSim::Cache& cache, size_t times);
+void printStats(const char* name, const CacheStats& stats);
+size_t dramBytesOf(const CacheStats& stats);
+Probes runProbes(const Plan3D& plan, size_t numThreads, bool print);
+void keepAlive(const void* ptr);
+double probeBandwidth(size_t bytes);
+double probeKernel(size_t size);
+double probeSubtile(const Subtile3D& subtile);
+double predictSeconds(
+	size_t cellUpdates, double kernelRate, size_t idealDramBytes,
+	const CacheStats& stats, const Probes& probes, std::string& bound
+);
 
 std::array<size_t, 3> gridSize = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
 std::array<size_t, 3> tileSize = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
@@ -20,6 +70,33 @@ std::array<char, 3>   tileType = {'-', '-', '-'};
 size_t tileHalfTs = SIZE_MAX;
 size_t timesteps = 1000;
 bool parallelogramSlidingWindow = false;
+PlanCache planCache;
+
+// Replay the exact access stream of the engine kernels through a cache
+// model, in addition to the ideal model.
+bool cacheSimulation = false;
+std::vector<CacheSim::LevelConfig> cacheConfig;
+
+// Field and operator arrays of Engine::Fields, in the order they're
+// allocated. Each array starts at a page boundary in the simulated
+// address space.
+enum Array { VOLT, CURR, VV, VI, II, IV, NUM_ARRAYS };
+std::array<uint64_t, NUM_ARRAYS> arrayBase;
+const size_t lineSize = 64;
+
+// Arrays store k in blocks of 16 cells of the same component, with k
+// padded to a multiple of 16, see engine/narray3d.hpp.
+const size_t blockK = 16;
+
+// Predict the run time from the traffic of either model, using the
+// bandwidth of each cache level and DRAM, and the kernel throughput,
+// measured on this machine at startup.
+bool predict = false;
+
+// Also model the tiled engine with up to this many threads, running the
+// tiles of each stage concurrently with private caches and a shared
+// last-level cache.
+size_t maxThreads = 1;
 
 int main(int argc, char** argv)
 {
@@ -45,11 +122,11 @@ int main(int argc, char** argv)
 		fprintf(stderr, "rem batch\t" "0000 x 0000 = 0000 timesteps\n");
 	}
 
-	Plan3D mainPlan = makePlan(tileHalfTs);
+	const Plan3D& mainPlan = makePlan(tileHalfTs);
 	size_t totalBytesTransferred = simulate(mainPlan) * numBatches;
 
 	if (remHalfTs > 0) {
-		Plan3D remPlan = makePlan(remHalfTs);
+		const Plan3D& remPlan = makePlan(remHalfTs);
 		totalBytesTransferred += simulate(remPlan);
 	}
 	
@@ -65,6 +142,139 @@ int main(int argc, char** argv)
 	
 	double speedup = 100.0 * naiveBytesTransferred / totalBytesTransferred;
 	printf("speedup\t\t" "%.1f%%\n", speedup);
+
+	CacheStats tiledStats, naiveStats;
+	if (cacheSimulation) {
+		uint64_t arrayBytes = gridSize[0] * gridSize[1];
+		arrayBytes *= (gridSize[2] + blockK - 1) / blockK * blockK;
+		arrayBytes *= 3 * sizeof(float);
+		arrayBytes = (arrayBytes + 4095) / 4096 * 4096;
+		for (size_t array = 0; array < NUM_ARRAYS; array++) {
+			arrayBase[array] = array * arrayBytes;
+		}
+
+		printf("cache model\t");
+		for (size_t level = 0; level < cacheConfig.size(); level++) {
+			printf("%sL%zu %zu KiB %zu-way", level > 0 ? ", " : "",
+				   level + 1, cacheConfig[level].bytes / 1024,
+				   cacheConfig[level].ways);
+		}
+		printf("\n");
+
+		tiledStats = simulateTiled(mainPlan, numBatches, remHalfTs, 1);
+		naiveStats = simulateNaive();
+		printStats("tiled", tiledStats);
+		printStats("naive", naiveStats);
+
+		printf("simulated speedup\t" "%.1f%%\n",
+			   100.0 * dramBytesOf(naiveStats) / dramBytesOf(tiledStats));
+	}
+
+	size_t cellUpdates = gridSize[0] * gridSize[1] * gridSize[2];
+	cellUpdates *= timesteps;
+
+	double naiveSeconds = 0;
+	Probes probes;
+	if (predict) {
+		probes = runProbes(mainPlan, 1, true);
+		std::string tiledBound, naiveBound;
+
+		double tiledSeconds = predictSeconds(
+			cellUpdates, probes.tiledKernelRate,
+			totalBytesTransferred, tiledStats, probes, tiledBound
+		);
+		naiveSeconds = predictSeconds(
+			cellUpdates, probes.naiveKernelRate,
+			naiveBytesTransferred, naiveStats, probes, naiveBound
+		);
+
+		printf("tiled predicted\t" "%.2f s, %.0f Mcells/s (%s-bound)\n",
+			   tiledSeconds, cellUpdates / tiledSeconds / 1e6,
+			   tiledBound.c_str());
+		printf("naive predicted\t" "%.2f s, %.0f Mcells/s (%s-bound)\n",
+			   naiveSeconds, cellUpdates / naiveSeconds / 1e6,
+			   naiveBound.c_str());
+		printf("predicted speedup\t" "%.1f%%\n",
+			   100.0 * naiveSeconds / tiledSeconds);
+	}
+
+	if (maxThreads == 1) {
+		return 0;
+	}
+
+	// Powers of 2 up to the maximum, each model is the tiled engine with
+	// this many threads, compared with the single-threaded naive engine.
+	std::vector<size_t> threadCounts;
+	for (size_t numThreads = 1; numThreads < maxThreads; numThreads *= 2) {
+		threadCounts.push_back(numThreads);
+	}
+	threadCounts.push_back(maxThreads);
+
+	if (predict) {
+		printf("\nthreads\t" "DRAM\t\t" "speedup\t\t"
+			   "predicted\t" "Mcells/s\t" "speedup\t\t" "bound\n");
+	}
+	else {
+		printf("\nthreads\t" "DRAM\t\t" "speedup\n");
+	}
+
+	size_t saturation = 0;
+	std::string saturationBound;
+	double lastSeconds = 0;
+	size_t lastUseful = 1;
+
+	for (size_t numThreads : threadCounts) {
+		CacheStats stats = numThreads == 1 ? tiledStats : simulateTiled(
+			mainPlan, numBatches, remHalfTs, numThreads
+		);
+
+		printf("%zu\t" "%.0f MBytes\t" "%.1f%%", numThreads,
+			   dramBytesOf(stats) / 1e6,
+			   100.0 * dramBytesOf(naiveStats) / dramBytesOf(stats));
+
+		if (!predict) {
+			printf("\n");
+			continue;
+		}
+
+		if (numThreads > 1) {
+			probes = runProbes(mainPlan, numThreads, false);
+		}
+		std::string bound;
+		double seconds = predictSeconds(
+			cellUpdates, probes.tiledKernelRate,
+			totalBytesTransferred, stats, probes, bound
+		);
+		printf("\t\t" "%.2f s\t\t" "%.0f\t\t" "%.1f%%\t\t" "%s\n",
+			   seconds, cellUpdates / seconds / 1e6,
+			   100.0 * naiveSeconds / seconds, bound.c_str());
+
+		if (bound != "compute" && saturation == 0) {
+			saturation = numThreads;
+			saturationBound = bound;
+		}
+
+		// more threads are only worth it if they're 10% faster
+		if (lastSeconds == 0 || seconds < lastSeconds * 0.9) {
+			lastUseful = numThreads;
+		}
+		lastSeconds = seconds;
+	}
+
+	if (!predict) {
+		return 0;
+	}
+
+	if (saturation > 0) {
+		printf("saturated at\t" "%zu threads (%s-bound)\n",
+			   saturation, saturationBound.c_str());
+	}
+	else {
+		printf("saturated at\t" "none, compute-bound up to %zu threads\n",
+			   maxThreads);
+	}
+	printf("useful threads\t" "%zu\n", lastUseful);
+	return 0;
 }
 
 void parseArgs(int argc, char** argv)
@@ -75,6 +285,11 @@ void parseArgs(int argc, char** argv)
 		{"tile-size",			required_argument, 0, 't'},
 		{"tile-height",			required_argument, 0, 'h'},
 		{"total-timesteps",		optional_argument, 0, 'n'},
+		{"plan-cache",			required_argument, 0, 'c'},
+		{"cache-sim",			no_argument,       0, 's'},
+		{"cache-model",			required_argument, 0, 'm'},
+		{"predict",				no_argument,       0, 'p'},
+		{"threads",				required_argument, 0, 'j'},
 	};
 
 	const char* progname = "speedup";
@@ -88,7 +303,7 @@ void parseArgs(int argc, char** argv)
 	char* tileArg = NULL;
 	int opt;
 
-	while ((opt = getopt_long(argc, argv, "wg:t:h:n:", longopts, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "wspm:j:c:g:t:h:n:", longopts, NULL)) != -1) {
 		switch (opt) {
 			case 'g':
 				gridArg = optarg;
@@ -99,9 +314,29 @@ void parseArgs(int argc, char** argv)
 			case 'h':
 				tileHalfTs = atoi(optarg);
 				break;
+			case 'n':
+				timesteps = atoi(optarg);
+				break;
+			case 'c':
+				planCache = PlanCache(optarg);
+				break;
 			case 'w':
 				parallelogramSlidingWindow = true;
 				break;
+			case 's':
+				cacheSimulation = true;
+				break;
+			case 'm':
+				cacheSimulation = true;
+				cacheConfig = CacheSim::parseConfig(optarg);
+				break;
+			case 'p':
+				predict = true;
+				break;
+			case 'j':
+				cacheSimulation = true;
+				maxThreads = atoi(optarg);
+				break;
 			default:
 				break;
 		}
@@ -111,19 +346,55 @@ void parseArgs(int argc, char** argv)
 		printf("%s: Calculate theoretical DRAM traffic saving.\n\n", progname);
 		printf("Usage: %s [OPTION]\n", progname);
 		printf("   --grid-size\t\t-g\ti,j,k\t\t\t(e.g: 400,400,400)\n");
-		printf("   --tile-size\t\t-t\tit,jt,kt/kp\t\t"
-			   "(e.g: 20t,20t,20t or 20t,20t,20p)\n");
+		printf("   --tile-size\t\t-t\tit/id,jt/jd,kt/kd/kp\t"
+			   "(e.g: 20t,20t,20t, 20t,20t,20p or 20d,20d,20p)\n");
+		printf("   \t\t\tid,jp,f\t\t\t(DiamondTorre, e.g: 20d,20p,f)\n");
+		printf("   \t\t\tic,jc,kc\t\t(DiamondCandy, e.g: 20c,20c,20c)\n");
 		printf("   --tile-height\t-h\thalfTimesteps\t\t(e.g: 18)\n");
 		printf("   --total-timesteps\t-n\ttimesteps\t\t(defafult: 1000)\n");
 		printf("   --sliding-window\t-w\tuse parallelogram sliding"
 			                                         "\t(default: no)\n");
+		printf("   --plan-cache\t-c\tdirectory\t\t(default: none)\n");
+		printf("   --cache-sim\t\t-s\treplay accesses through a cache "
+			   "model\t(default: no)\n");
+		printf("   --cache-model\t-m\tsize:ways,...\t\t"
+			   "(e.g: 48K:12,2M:16,32M:16, default: from sysfs)\n");
+		printf("   --predict\t\t-p\tpredict run time from measured "
+			   "bandwidth\t(default: no)\n");
+		printf("   --threads\t\t-j\tmodel 1, 2, 4... N threads\t"
+			   "(default: 1, implies -s)\n");
 		printf("\nNote: Parallelogram tiling uses suffix \"p\", "
-			   "trapezoid tiling uses suffix \"t\".\n");
+			   "trapezoid tiling uses suffix \"t\", "
+			   "diamond tiling uses suffix \"d\".\n");
+		printf("Note: DiamondTorre uses diamond tiling in dimension i, "
+			   "parallelogram tiling\n      in dimension j, and column "
+			   "tiling (suffix \"f\", not tiled) in dimension k.\n");
+		printf("Note: DiamondCandy uses diamond tiling in all dimensions, "
+			   "grouped into levels\n      of candies that can run "
+			   "concurrently.\n");
 		printf("Note: It assumes ideal data access patterns and infinitely-fast "
 			   "code and cache - actual speedup is much lower.\n");
+		printf("Note: The cache model replays each access of the kernels "
+			   "through an LRU cache\n      hierarchy, single-threaded, "
+			   "with 64-byte lines.\n");
+		printf("Note: The prediction runs bandwidth and kernel probes "
+			   "at startup, taking a few\n      seconds, and uses the cache "
+			   "model if enabled, otherwise the ideal model.\n");
 		std::exit(1);
 	}
 
+	if (maxThreads == 0) {
+		throw std::invalid_argument("number of threads must be at least 1");
+	}
+	if (cacheSimulation && cacheConfig.empty()) {
+		cacheConfig = CacheSim::readSysfsConfig();
+		if (cacheConfig.empty()) {
+			throw std::invalid_argument(
+				"no cache found in sysfs, use --cache-model"
+			);
+		}
+	}
+
 	gridSize[0] = atoi(strtok(gridArg, ","));
 	gridSize[1] = atoi(strtok(NULL, ","));
 	gridSize[2] = atoi(strtok(NULL, ","));
@@ -136,10 +407,13 @@ void parseArgs(int argc, char** argv)
 	for (size_t dim = 0; dim < 3; dim++) {
 		std::string& arg = tileArgString[dim];
 
-		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p') {
+		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p' &&
+			arg[arg.size() - 1] != 'd' && arg[arg.size() - 1] != 'f' &&
+			arg[arg.size() - 1] != 'c'
+		) {
 			throw std::invalid_argument(
-				std::format("tile suffix must be 't' or 'p', got {}",
-							arg[arg.size() - 1])
+				std::format("tile suffix must be 't', 'p', 'd', 'f' or 'c', "
+							"got {}", arg[arg.size() - 1])
 			);
 		}
 
@@ -148,34 +422,141 @@ void parseArgs(int argc, char** argv)
 		tileSize[dim] = atoi(arg.c_str());
 	}
 
-	if (tileType[0] != 't' || tileType[1] != 't') {
+	if (tileType[1] == 'p' || tileType[2] == 'f') {
+		// DiamondTorre
+		if (tileType[0] != 'd' || tileType[1] != 'p' || tileType[2] != 'f') {
+			throw std::invalid_argument(
+				"DiamondTorre must use diamond tiling (suffix d) in "
+				"dimension i, parallelogram tiling (suffix p) in dimension "
+				"j, and column tiling (suffix f) in dimension k"
+			);
+		}
+
+		// dimension k is not tiled
+		tileSize[2] = gridSize[2];
+	}
+	else {
+		if (tileType[0] != tileType[1] ||
+			(tileType[0] != 't' && tileType[0] != 'd' && tileType[0] != 'c')
+		) {
+			throw std::invalid_argument(
+				"dimension i and j only support trapezoid (suffix t), "
+				"diamond (suffix d) or DiamondCandy (suffix c) tiling"
+			);
+		}
+		if (tileType[2] != 'p' && tileType[2] != tileType[0]) {
+			throw std::invalid_argument(
+				"dimension k must use parallelogram tiling (suffix p), or "
+				"the same tiling as dimension i and j"
+			);
+		}
+		if (tileType[0] == 'c' && tileType[2] != 'c') {
+			throw std::invalid_argument(
+				"DiamondCandy (suffix c) must be used in all dimensions"
+			);
+		}
+	}
+	if ((tileType[0] == 'd' || tileType[0] == 'c') && tileHalfTs % 4 != 0) {
 		throw std::invalid_argument(
-			"dimension i and j only support trapezoid tiling (suffix t)"
+			"diamond tiling requires tile height to be a multiple of 4"
 		);
 	}
-	if (tileType[2] == 't' && parallelogramSlidingWindow) {
+	if (tileType[2] != 'p' && tileType[1] != 'p' &&
+		parallelogramSlidingWindow
+	) {
 		throw std::invalid_argument(
-			"dimension k uses trapezoid tilling, "
+			"dimension j or k doesn't use parallelogram tilling, "
 			"parallelogram sliding window is unsupported."
 		);
 	}
 }
 
-Plan3D makePlan(size_t tileHalfTs)
+// Plans are memoized, so the remainder plan reuses the 1D plans of
+// identical dimensions, and with --plan-cache, repeated runs load the
+// 3D plan from disk.
+const Plan3D& makePlan(size_t tileHalfTs)
+{
+	return planCache.plan3D(
+		gridSize, tileSize, tileType, tileHalfTs,
+		[=]() { return buildPlan(tileHalfTs); }
+	);
+}
+
+Plan3D buildPlan(size_t tileHalfTs)
 {
-	Plan1D i = computeTrapezoidTiles(gridSize[0], tileSize[0], tileHalfTs);
-	Plan1D j = computeTrapezoidTiles(gridSize[1], tileSize[1], tileHalfTs);
+	if (tileType[2] == 'f') {
+		// DiamondTorre, the remainder batch may be too short for diamond
+		// tiling, in this case, fall back to trapezoid tiling.
+		const Plan1D& i = tileHalfTs % 4 == 0 ?
+			planCache.plan1D('d', gridSize[0], tileSize[0], tileHalfTs) :
+			planCache.plan1D('t', gridSize[0], tileSize[0], tileHalfTs);
+		const Plan1D& j = planCache.plan1D(
+			'p', gridSize[1], tileSize[1], tileHalfTs
+		);
+		const Plan1D& k = planCache.plan1D(
+			'f', gridSize[2], tileSize[2], tileHalfTs
+		);
+		Plan3D plan = combineTilesDiamondTorre(i, j, k);
+		return plan;
+	}
+
+	if (tileType[0] == 'c' && tileHalfTs % 4 == 0) {
+		const Plan1D& i = planCache.plan1D(
+			'd', gridSize[0], tileSize[0], tileHalfTs
+		);
+		const Plan1D& j = planCache.plan1D(
+			'd', gridSize[1], tileSize[1], tileHalfTs
+		);
+		const Plan1D& k = planCache.plan1D(
+			'd', gridSize[2], tileSize[2], tileHalfTs
+		);
+		Plan3D plan = combineTilesDiamondCandy(i, j, k);
+		return plan;
+	}
+
+	if (tileType[0] == 'd' && tileHalfTs % 4 == 0) {
+		const Plan1D& i = planCache.plan1D(
+			'd', gridSize[0], tileSize[0], tileHalfTs
+		);
+		const Plan1D& j = planCache.plan1D(
+			'd', gridSize[1], tileSize[1], tileHalfTs
+		);
+
+		if (tileType[2] == 'p') {
+			const Plan1D& k = planCache.plan1D(
+				'p', gridSize[2], tileSize[2], tileHalfTs
+			);
+			Plan3D plan = combineTilesDDP(i, j, k);
+			return plan;
+		}
+		else {
+			const Plan1D& k = planCache.plan1D(
+				'd', gridSize[2], tileSize[2], tileHalfTs
+			);
+			Plan3D plan = combineTilesDDD(i, j, k);
+			return plan;
+		}
+	}
+
+	// The remainder batch may be too short for diamond tiling, in this
+	// case, fall back to trapezoid tiling.
+	const Plan1D& i = planCache.plan1D(
+		't', gridSize[0], tileSize[0], tileHalfTs
+	);
+	const Plan1D& j = planCache.plan1D(
+		't', gridSize[1], tileSize[1], tileHalfTs
+	);
 
 	if (tileType[2] == 'p') {
-		Plan1D k = computeParallelogramTiles(
-			gridSize[2], tileSize[2], tileHalfTs
+		const Plan1D& k = planCache.plan1D(
+			'p', gridSize[2], tileSize[2], tileHalfTs
 		);
 		Plan3D plan = combineTilesTTP(i, j, k);
 		return plan;
 	}
-	else if (tileType[2] == 't') {
-		Plan1D k = computeTrapezoidTiles(
-			gridSize[2], tileSize[2], tileHalfTs
+	else if (tileType[2] == 't' || tileType[2] == 'd' || tileType[2] == 'c') {
+		const Plan1D& k = planCache.plan1D(
+			't', gridSize[2], tileSize[2], tileHalfTs
 		);
 		Plan3D plan = combineTilesTTT(i, j, k);
 		return plan;
@@ -188,41 +569,529 @@ Plan3D makePlan(size_t tileHalfTs)
 	}
 }
 
-size_t simulate(Plan3D plan)
+size_t simulate(const Plan3D& plan)
+{
+	if (!parallelogramSlidingWindow) {
+		return estimateTraffic(plan);
+	}
+
+	// Subtiles are executed in serial along the parallelogram dimension,
+	// which is k in TTP/DDP, or j in DiamondTorre.
+	size_t slidingDim = tileType[1] == 'p' ? 1 : 2;
+	return estimateTraffic(plan, slidingDim);
+}
+
+// Only the first batch starts with a cold cache, the 2nd batch is
+// simulated as the steady state of all other main batches, instead
+// of replaying all of them.
+CacheStats simulateTiled(
+	const Plan3D& mainPlan, size_t numBatches, size_t remHalfTs,
+	size_t numThreads
+)
+{
+	CacheSim::Cache cache(cacheConfig, lineSize, numThreads);
+	CacheStats stats(cacheConfig.size());
+
+	replayPlan(mainPlan, cache, numThreads);
+	addStats(stats, cache, 1);
+	if (numBatches > 1) {
+		replayPlan(mainPlan, cache, numThreads);
+		addStats(stats, cache, numBatches - 1);
+	}
+	if (remHalfTs > 0) {
+		replayPlan(makePlan(remHalfTs), cache, numThreads);
+		addStats(stats, cache, 1);
+	}
+	cache.flush();
+	addStats(stats, cache, 1);
+
+	return stats;
+}
+
+// same as above, with a single timestep per batch
+CacheStats simulateNaive(void)
+{
+	CacheSim::Cache cache(cacheConfig, lineSize);
+	CacheStats stats(cacheConfig.size());
+
+	replayNaive(cache);
+	addStats(stats, cache, 1);
+	if (timesteps > 1) {
+		replayNaive(cache);
+		addStats(stats, cache, timesteps - 1);
+	}
+	cache.flush();
+	addStats(stats, cache, 1);
+
+	return stats;
+}
+
+// Tiles of a stage are handed out to the threads in order, as the
+// thread pool does. Threads are assumed to run at the same speed, so
+// their accesses are interleaved one pair of volt and curr ranges at
+// a time.
+void replayPlan(
+	const Plan3D& plan, CacheSim::Cache& cache, size_t numThreads
+)
+{
+	struct Thread
+	{
+		const Tile3D* tile = NULL;
+		size_t subtile = 0;
+		size_t halfTs = 0;
+	};
+
+	for (const TileList3D& tileList : plan) {
+		std::vector<Thread> threads(numThreads);
+		size_t nextTile = 0;
+		size_t active = 0;
+
+		for (Thread& thread : threads) {
+			if (nextTile < tileList.size()) {
+				thread.tile = &tileList[nextTile++];
+				active++;
+			}
+		}
+
+		while (active > 0) {
+			for (size_t core = 0; core < numThreads; core++) {
+				Thread& thread = threads[core];
+				if (!thread.tile) {
+					continue;
+				}
+
+				if (thread.subtile < thread.tile->size()) {
+					const Subtile3D& subtile = (*thread.tile)[thread.subtile];
+					if (thread.halfTs < subtile.size()) {
+						const Range3D<size_t>& voltRange =
+							subtile[thread.halfTs];
+						const Range3D<size_t>& currRange =
+							subtile[thread.halfTs + 1];
+
+						replayVoltageRange(
+							cache, core, voltRange.first, voltRange.last
+						);
+						replayCurrentRange(
+							cache, core, currRange.first, currRange.last
+						);
+						thread.halfTs += 2;
+					}
+					if (thread.halfTs >= subtile.size()) {
+						thread.subtile++;
+						thread.halfTs = 0;
+					}
+				}
+
+				if (thread.subtile >= thread.tile->size()) {
+					thread = Thread();
+					if (nextTile < tileList.size()) {
+						thread.tile = &tileList[nextTile++];
+					}
+					else {
+						active--;
+					}
+				}
+			}
+		}
+	}
+}
+
+void replayNaive(CacheSim::Cache& cache)
+{
+	replayVoltageRange(
+		cache, 0,
+		{0, 0, 0},
+		{gridSize[0] - 1, gridSize[1] - 1, gridSize[2] - 1}
+	);
+	replayCurrentRange(
+		cache, 0,
+		{0, 0, 0},
+		{gridSize[0] - 2, gridSize[1] - 2, gridSize[2] - 2}
+	);
+}
+
+static inline uint64_t addrOf(Array array, size_t i, size_t j, size_t k, size_t n)
 {
-	size_t totalBytesTransferred = 0;
+	size_t paddedK = (gridSize[2] + blockK - 1) / blockK * blockK;
+
+	size_t idx = (i * gridSize[1] + j) * paddedK * 3;
+	idx += (k / blockK) * blockK * 3 + n * blockK + k % blockK;
+	return arrayBase[array] + idx * sizeof(float);
+}
 
-	size_t stage = 0;
+// Same accesses in the same order as updateVoltageKernel() and
+// updateCurrentKernel() in engine/kernel.cpp.
+void replayVoltageRange(
+	CacheSim::Cache& cache, size_t core,
+	std::array<size_t, 3> first, std::array<size_t, 3> last
+)
+{
+	for (size_t i = first[0]; i <= last[0]; i++) {
+		for (size_t j = first[1]; j <= last[1]; j++) {
+			for (size_t k = first[2]; k <= last[2]; k++) {
+				size_t prev_i = i > 0 ? i - 1 : 0;
+				size_t prev_j = j > 0 ? j - 1 : 0;
+				size_t prev_k = k > 0 ? k - 1 : 0;
+
+				for (Array array : {VOLT, VV, VI, CURR}) {
+					for (size_t n = 0; n < 3; n++) {
+						cache.access(addrOf(array, i, j, k, n), false, core);
+					}
+				}
+				cache.access(addrOf(CURR, i, j, prev_k, 0), false, core);
+				cache.access(addrOf(CURR, i, j, prev_k, 1), false, core);
+				cache.access(addrOf(CURR, i, prev_j, k, 0), false, core);
+				cache.access(addrOf(CURR, i, prev_j, k, 2), false, core);
+				cache.access(addrOf(CURR, prev_i, j, k, 1), false, core);
+				cache.access(addrOf(CURR, prev_i, j, k, 2), false, core);
+
+				for (size_t n = 0; n < 3; n++) {
+					cache.access(addrOf(VOLT, i, j, k, n), true, core);
+				}
+			}
+		}
+	}
+}
+
+void replayCurrentRange(
+	CacheSim::Cache& cache, size_t core,
+	std::array<size_t, 3> first, std::array<size_t, 3> last
+)
+{
+	for (size_t i = first[0]; i <= last[0]; i++) {
+		for (size_t j = first[1]; j <= last[1]; j++) {
+			for (size_t k = first[2]; k <= last[2]; k++) {
+				for (Array array : {CURR, II, IV, VOLT}) {
+					for (size_t n = 0; n < 3; n++) {
+						cache.access(addrOf(array, i, j, k, n), false, core);
+					}
+				}
+				cache.access(addrOf(VOLT, i, j, k + 1, 0), false, core);
+				cache.access(addrOf(VOLT, i, j, k + 1, 1), false, core);
+				cache.access(addrOf(VOLT, i, j + 1, k, 0), false, core);
+				cache.access(addrOf(VOLT, i, j + 1, k, 2), false, core);
+				cache.access(addrOf(VOLT, i + 1, j, k, 1), false, core);
+				cache.access(addrOf(VOLT, i + 1, j, k, 2), false, core);
+
+				for (size_t n = 0; n < 3; n++) {
+					cache.access(addrOf(CURR, i, j, k, n), true, core);
+				}
+			}
+		}
+	}
+}
+
+// Add the statistics since the last call, counted the given number of
+// times, then reset them.
+void addStats(CacheStats& total, CacheSim::Cache& cache, size_t times)
+{
+	for (size_t level = 0; level < cache.levels(); level++) {
+		CacheSim::LevelStats stats = cache.stats(level);
+		total[level].accesses += stats.accesses * times;
+		total[level].misses += stats.misses * times;
+		total[level].writebacks += stats.writebacks * times;
+	}
+	cache.resetStats();
+}
+
+void printStats(const char* name, const CacheStats& stats)
+{
+	for (size_t level = 0; level < stats.size(); level++) {
+		const CacheSim::LevelStats& s = stats[level];
+		printf("%s L%zu\t" "%zu accesses, %zu misses (%.2f%%), "
+			   "%.0f MBytes in, %.0f MBytes out\n",
+			   name, level + 1, s.accesses, s.misses,
+			   s.accesses ? 100.0 * s.misses / s.accesses : 0.0,
+			   s.misses * lineSize / 1e6, s.writebacks * lineSize / 1e6);
+	}
+
+	printf("%s DRAM\t" "%.0f MBytes (%.0f read, %.0f written)\n", name,
+		   dramBytesOf(stats) / 1e6,
+		   stats.back().misses * lineSize / 1e6,
+		   stats.back().writebacks * lineSize / 1e6);
+}
+
+size_t dramBytesOf(const CacheStats& stats)
+{
+	return (stats.back().misses + stats.back().writebacks) * lineSize;
+}
+
+// Run a probe on each thread concurrently, and sum up their results.
+template <typename Probe>
+static double runConcurrently(size_t numThreads, Probe probe)
+{
+	std::vector<double> results(numThreads, 0);
+	std::vector<std::thread> threads;
+	for (size_t thread = 0; thread < numThreads; thread++) {
+		threads.emplace_back([&, thread]() { results[thread] = probe(); });
+	}
+
+	double sum = 0;
+	for (size_t thread = 0; thread < numThreads; thread++) {
+		threads[thread].join();
+		sum += results[thread];
+	}
+	return sum;
+}
+
+// Measure the bandwidth of each cache level with a working set of half
+// its size, DRAM with a working set of 4x the last level, and the
+// throughput of the engine kernel. The naive kernel throughput is
+// measured with a grid that fits in L2, the tiled one with the largest
+// subtile of the plan, which includes the overhead of its shorter loops.
+//
+// All probes run on numThreads threads concurrently, the working set of
+// the last level and DRAM is split between them, since they're shared.
+Probes runProbes(const Plan3D& plan, size_t numThreads, bool print)
+{
+	std::vector<CacheSim::LevelConfig> levels = CacheSim::readSysfsConfig();
+	if (levels.empty()) {
+		levels = cacheConfig;
+	}
+	if (levels.empty()) {
+		throw std::invalid_argument(
+			"no cache found in sysfs, use --cache-model"
+		);
+	}
+
+	Probes probes;
+	for (size_t level = 0; level < levels.size(); level++) {
+		size_t bytes = levels[level].bytes / 2;
+		if (level + 1 == levels.size()) {
+			bytes /= numThreads;
+		}
+
+		probes.cacheBandwidth.push_back(runConcurrently(numThreads,
+			[=]() { return probeBandwidth(bytes); }
+		));
+		if (print) {
+			printf("probe L%zu\t" "%.1f GB/s (%zu KiB)\n", level + 1,
+				   probes.cacheBandwidth[level] / 1e9, bytes / 1024);
+		}
+	}
+
+	size_t dramBytes = levels.back().bytes * 4;
+	dramBytes = std::clamp<size_t>(dramBytes, 64 << 20, 1024 << 20);
+	probes.dramBandwidth = runConcurrently(numThreads,
+		[=]() { return probeBandwidth(dramBytes / numThreads); }
+	);
+	if (print) {
+		printf("probe DRAM\t" "%.1f GB/s (%zu MiB)\n",
+			   probes.dramBandwidth / 1e9, dramBytes >> 20);
+	}
+
+	size_t l2Bytes = levels.size() > 1 ? levels[1].bytes : levels[0].bytes;
+	size_t size = std::max<size_t>(8, std::cbrt(l2Bytes / 2 / 72));
+	probes.naiveKernelRate = runConcurrently(numThreads,
+		[=]() { return probeKernel(size); }
+	);
+	if (print) {
+		printf("probe naive\t" "%.0f Mcells/s (%zu x %zu x %zu grid)\n",
+			   probes.naiveKernelRate / 1e6, size, size, size);
+	}
+
+	const Subtile3D* largest = NULL;
+	size_t largestCells = 0;
 	for (const TileList3D& tileList : plan) {
 		for (const Tile3D& tile : tileList) {
-			size_t subtileId = 0;
-
 			for (const Subtile3D& subtile : tile) {
-				size_t i = subtile.last[0] - subtile.first[0];
-				size_t j = subtile.last[1] - subtile.first[1];
-
-				size_t k;
-				if (subtileId == 0 || !parallelogramSlidingWindow) {
-					k = subtile.last[2] - subtile.first[2];
+				size_t cells = 0;
+				for (const Range3D<size_t>& range : subtile) {
+					if (!range.empty()) {
+						cells += (range.last[0] - range.first[0] + 1) *
+								 (range.last[1] - range.first[1] + 1) *
+								 (range.last[2] - range.first[2] + 1);
+					}
 				}
-				else {
-					size_t lastK = tile[subtileId - 1].last[2];
-					size_t currK = subtile.last[2];
-					k = currK - lastK;
+				if (cells > largestCells) {
+					largest = &subtile;
+					largestCells = cells;
 				}
+			}
+		}
+	}
+	if (!largest) {
+		throw std::invalid_argument("plan has no cells to update");
+	}
+
+	probes.tiledKernelRate = runConcurrently(numThreads,
+		[=]() { return probeSubtile(*largest); }
+	);
+	if (print) {
+		printf("probe tiled\t" "%.0f Mcells/s (%zu x %zu x %zu subtile)\n",
+			   probes.tiledKernelRate / 1e6,
+			   largest->last[0] - largest->first[0] + 1,
+			   largest->last[1] - largest->first[1] + 1,
+			   largest->last[2] - largest->first[2] + 1);
+	}
+
+	return probes;
+}
+
+// Compiler barrier: the memory at ptr may be read here, so the stores of
+// a probe can't be optimized away, without any code of its own.
+void keepAlive(const void* ptr)
+{
+	asm volatile("" : : "g"(ptr) : "memory");
+}
+
+// STREAM triad over 3 arrays of the given total size, in bytes per
+// second, best of 3 runs of at least 50 ms each.
+double probeBandwidth(size_t bytes)
+{
+	size_t elems = std::max<size_t>(bytes / 3 / sizeof(float), 16);
+	std::vector<float> a(elems, 0.0f), b(elems, 1.0f), c(elems, 2.0f);
+	float scalar = 3.0f;
+
+	double best = 0;
+	for (size_t run = 0; run < 3; run++) {
+		size_t reps = 0;
+		auto start = std::chrono::steady_clock::now();
+		std::chrono::duration<double> time;
+		do {
+			for (size_t i = 0; i < elems; i++) {
+				a[i] = b[i] + scalar * c[i];
+			}
+			keepAlive(a.data());
+			std::swap(a, b);
+			reps++;
+			time = std::chrono::steady_clock::now() - start;
+		} while (time.count() < 0.05);
+
+		best = std::max(best, 3 * sizeof(float) * elems * reps / time.count());
+	}
+	return best;
+}
+
+// Cell updates (both volt and curr) per second of the engine kernel,
+// best of 3 runs of at least 100 ms each.
+double probeKernel(size_t size)
+{
+	std::array<size_t, 3> gridSize = {size, size, size};
+	NArray3D<float> volt(gridSize), curr(gridSize);
+	NArray3D<float> vv(gridSize), vi(gridSize), ii(gridSize), iv(gridSize);
+
+	std::array<size_t, 3> first = {0, 0, 0};
+	std::array<size_t, 3> voltLast = {size - 1, size - 1, size - 1};
+	std::array<size_t, 3> currLast = {size - 2, size - 2, size - 2};
+
+	double best = 0;
+	for (size_t run = 0; run < 3; run++) {
+		size_t reps = 0;
+		auto start = std::chrono::steady_clock::now();
+		std::chrono::duration<double> time;
+		do {
+			updateVoltageRange(volt, curr, vv, vi, first, voltLast);
+			updateCurrentRange(curr, volt, ii, iv, first, currLast);
+			keepAlive(volt.data());
+			keepAlive(curr.data());
+			reps++;
+			time = std::chrono::steady_clock::now() - start;
+		} while (time.count() < 0.1);
+
+		best = std::max(best, size * size * size * reps / time.count());
+	}
+	return best;
+}
+
+// Cell updates per second of a subtile, moved to the origin of a grid
+// just large enough to hold it and its neighbors, so it stays in cache.
+// Best of 3 runs of at least 100 ms each.
+double probeSubtile(const Subtile3D& subtile)
+{
+	std::array<size_t, 3> origin, gridSize;
+	for (size_t n = 0; n < 3; n++) {
+		origin[n] = subtile.first[n] > 0 ? subtile.first[n] - 1 : 0;
+		gridSize[n] = subtile.last[n] - origin[n] + 2;
+	}
+
+	NArray3D<float> volt(gridSize), curr(gridSize);
+	NArray3D<float> vv(gridSize), vi(gridSize), ii(gridSize), iv(gridSize);
 
-				size_t tileBytesTransferred = i * j * k;
-				tileBytesTransferred *= 3;  // vec3
-				tileBytesTransferred *= 4;  // sizeof(float)
-				tileBytesTransferred *= 8;  // volt r/w, curr r/w,
-											// vv r, vi r, ii r, iv r
-				totalBytesTransferred += tileBytesTransferred;
+	std::vector<Range3D<size_t>> ranges;
+	size_t cells = 0;
+	for (Range3D<size_t> range : subtile) {
+		if (!range.empty()) {
+			for (size_t n = 0; n < 3; n++) {
+				range.first[n] -= origin[n];
+				range.last[n] -= origin[n];
+			}
+		}
+		ranges.push_back(range);
+	}
+	for (size_t halfTs = 0; halfTs < ranges.size(); halfTs += 2) {
+		const Range3D<size_t>& range = ranges[halfTs];
+		if (!range.empty()) {
+			cells += (range.last[0] - range.first[0] + 1) *
+					 (range.last[1] - range.first[1] + 1) *
+					 (range.last[2] - range.first[2] + 1);
+		}
+	}
+
+	double best = 0;
+	for (size_t run = 0; run < 3; run++) {
+		size_t reps = 0;
+		auto start = std::chrono::steady_clock::now();
+		std::chrono::duration<double> time;
+		do {
+			for (size_t halfTs = 0; halfTs < ranges.size(); halfTs += 2) {
+				const Range3D<size_t>& voltRange = ranges[halfTs];
+				const Range3D<size_t>& currRange = ranges[halfTs + 1];
 
-				subtileId++;
+				updateVoltageRange(
+					volt, curr, vv, vi, voltRange.first, voltRange.last
+				);
+				updateCurrentRange(
+					curr, volt, ii, iv, currRange.first, currRange.last
+				);
 			}
+			keepAlive(volt.data());
+			keepAlive(curr.data());
+			reps++;
+			time = std::chrono::steady_clock::now() - start;
+		} while (time.count() < 0.1);
+
+		best = std::max(best, cells * reps / time.count());
+	}
+	return best;
+}
+
+// Roofline-style prediction: the run time is the longest of the compute
+// time and the transfer time of each cache level and DRAM, assuming they
+// overlap perfectly. Without the cache model, only DRAM traffic of the
+// ideal model is known.
+double predictSeconds(
+	size_t cellUpdates, double kernelRate, size_t idealDramBytes,
+	const CacheStats& stats, const Probes& probes, std::string& bound
+)
+{
+	double seconds = cellUpdates / kernelRate;
+	bound = "compute";
+
+	if (stats.empty()) {
+		double dramSeconds = idealDramBytes / probes.dramBandwidth;
+		if (dramSeconds > seconds) {
+			seconds = dramSeconds;
+			bound = "DRAM";
 		}
-		stage++;
+		return seconds;
 	}
 
-	return totalBytesTransferred;
+	// traffic between level n and n + 1 is limited by the bandwidth of
+	// level n + 1, or DRAM after the last level
+	for (size_t level = 0; level < stats.size(); level++) {
+		size_t bytes = (stats[level].misses + stats[level].writebacks);
+		bytes *= lineSize;
+
+		bool dram = level + 1 >= stats.size() ||
+					level + 1 >= probes.cacheBandwidth.size();
+		double bandwidth = dram ?
+			probes.dramBandwidth : probes.cacheBandwidth[level + 1];
+		double levelSeconds = bytes / bandwidth;
+		if (levelSeconds > seconds) {
+			seconds = levelSeconds;
+			bound = dram ? "DRAM" : std::format("L{}", level + 2);
+		}
+	}
+	return seconds;
 }
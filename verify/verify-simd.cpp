@@ -16,6 +16,7 @@ std::array<char, 3>   tileType     = {'-', '-', '-'};
 size_t tileHalfTs = SIZE_MAX;
 size_t timesteps = SIZE_MAX;
 bool debug = false;
+std::vector<std::array<size_t, 3>> innerTileSizes;
 
 void parseArgs(int argc, char** argv);
 
@@ -54,7 +55,7 @@ void tiled(
 );
 
 void tiledBody(
-	Plan3D plan,
+	const Plan3D& plan,
 	NArray3D<Simd<GiNaC::ex, 4>>& volt,
 	NArray3D<Simd<GiNaC::ex, 4>>& curr,
 	NArray3D<Simd<GiNaC::ex, 4>>& vv,
@@ -70,6 +71,7 @@ void parseArgs(int argc, char** argv)
 		{"tile-size",			required_argument, 0, 't'},
 		{"tile-height",			required_argument, 0, 'h'},
 		{"total-timesteps",		optional_argument, 0, 'n'},
+		{"refine",				required_argument, 0, 'r'},
 	};
 
 	const char* progname = "verify";
@@ -83,7 +85,7 @@ void parseArgs(int argc, char** argv)
 	char* tileArg = NULL;
 	int opt;
 
-	while ((opt = getopt_long(argc, argv, "dg:t:h:n:", longopts, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "dr:g:t:h:n:", longopts, NULL)) != -1) {
 		switch (opt) {
 			case 'g':
 				gridArg = optarg;
@@ -97,6 +99,13 @@ void parseArgs(int argc, char** argv)
 			case 'n':
 				timesteps = atoi(optarg);
 				break;
+			case 'r':
+				innerTileSizes.push_back({
+					(size_t) atoi(strtok(optarg, ",")),
+					(size_t) atoi(strtok(NULL, ",")),
+					(size_t) atoi(strtok(NULL, ","))
+				});
+				break;
 			case 'd':
 				debug = true;
 				break;
@@ -111,13 +120,28 @@ void parseArgs(int argc, char** argv)
 		printf("%s: Symbolic Verification of Tiling Correctness\n\n", progname);
 		printf("Usage: %s [OPTION]\n", progname);
 		printf("   --grid-size\t\t-g\ti,j,k\t\t\t(e.g: 400,400,400)\n");
-		printf("   --tile-size\t\t-t\tit,jt,kt/kp\t\t"
-			   "(e.g: 20t,20t,20t or 20t,20t,20p)\n");
+		printf("   --tile-size\t\t-t\tit/id,jt/jd,kt/kd/kp\t"
+			   "(e.g: 20t,20t,20t, 20t,20t,20p or 20d,20d,20p)\n");
+		printf("   \t\t\tid,jp,f\t\t\t(DiamondTorre, e.g: 20d,20p,f)\n");
+		printf("   \t\t\tic,jc,kc\t\t(DiamondCandy, e.g: 20c,20c,20c)\n");
+		printf("   \t\t\tir,jr,kr\t\t(recursive, e.g: 16r,16r,64r)\n");
 		printf("   --tile-height\t-h\thalfTimesteps\t\t(e.g: 18)\n");
 		printf("   --total-timesteps\t-n\ttimesteps\t\t(defafult: 100)\n");
 		printf("   --dump\t\t-d\tdump traces for debugging\t(default: no)\n");
+		printf("   --refine\t\t-r\ti,j,k\t\t\t(e.g: 8,8,8, repeat for "
+			   "each cache level)\n");
 		printf("\nNote: Parallelogram tiling uses suffix \"p\", "
-			   "trapezoid tiling uses suffix \"t\".\n");
+			   "trapezoid tiling uses suffix \"t\", "
+			   "diamond tiling uses suffix \"d\".\n");
+		printf("Note: DiamondTorre uses diamond tiling in dimension i, "
+			   "parallelogram tiling\n      in dimension j, and column "
+			   "tiling (suffix \"f\", not tiled) in dimension k.\n");
+		printf("Note: DiamondCandy uses diamond tiling in all dimensions, "
+			   "grouped into levels\n      of candies that can run "
+			   "concurrently.\n");
+		printf("Note: Recursive tiling cuts the whole grid in space and time "
+			   "until the pieces\n      are no larger than the given base "
+			   "size, without tuning for cache size.\n");
 		printf("Note: Symbolic verification requires extreme memory usage. "
 			   "64 GiB PC is\nrequired for a 70,70,70 grid with timestep "
 			   "size of 20, don't even think\nabout trying more timesteps "
@@ -137,10 +161,13 @@ void parseArgs(int argc, char** argv)
 	for (size_t dim = 0; dim < 3; dim++) {
 		std::string& arg = tileArgString[dim];
 
-		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p') {
+		if (arg[arg.size() - 1] != 't' && arg[arg.size() - 1] != 'p' &&
+			arg[arg.size() - 1] != 'd' && arg[arg.size() - 1] != 'f' &&
+			arg[arg.size() - 1] != 'c' && arg[arg.size() - 1] != 'r'
+		) {
 			throw std::invalid_argument(
-				std::format("tile suffix must be 't' or 'p', got {}",
-							arg[arg.size() - 1])
+				std::format("tile suffix must be 't', 'p', 'd', 'f', 'c' or "
+							"'r', got {}", arg[arg.size() - 1])
 			);
 		}
 
@@ -149,9 +176,50 @@ void parseArgs(int argc, char** argv)
 		tileSize[dim] = atoi(arg.c_str());
 	}
 
-	if (tileType[0] != 't' || tileType[1] != 't') {
+	if (tileType[0] == 'r' || tileType[1] == 'r' || tileType[2] == 'r') {
+		if (tileType[0] != 'r' || tileType[1] != 'r' || tileType[2] != 'r') {
+			throw std::invalid_argument(
+				"recursive tiling (suffix r) must be used in all dimensions"
+			);
+		}
+	}
+	else if (tileType[1] == 'p' || tileType[2] == 'f') {
+		// DiamondTorre
+		if (tileType[0] != 'd' || tileType[1] != 'p' || tileType[2] != 'f') {
+			throw std::invalid_argument(
+				"DiamondTorre must use diamond tiling (suffix d) in "
+				"dimension i, parallelogram tiling (suffix p) in dimension "
+				"j, and column tiling (suffix f) in dimension k"
+			);
+		}
+
+		// dimension k is not tiled
+		tileSize[2] = gridSize[2];
+	}
+	else {
+		if (tileType[0] != tileType[1] ||
+			(tileType[0] != 't' && tileType[0] != 'd' && tileType[0] != 'c')
+		) {
+			throw std::invalid_argument(
+				"dimension i and j only support trapezoid (suffix t), "
+				"diamond (suffix d) or DiamondCandy (suffix c) tiling"
+			);
+		}
+		if (tileType[2] != 'p' && tileType[2] != tileType[0]) {
+			throw std::invalid_argument(
+				"dimension k must use parallelogram tiling (suffix p), or "
+				"the same tiling as dimension i and j"
+			);
+		}
+		if (tileType[0] == 'c' && tileType[2] != 'c') {
+			throw std::invalid_argument(
+				"DiamondCandy (suffix c) must be used in all dimensions"
+			);
+		}
+	}
+	if ((tileType[0] == 'd' || tileType[0] == 'c') && tileHalfTs % 4 != 0) {
 		throw std::invalid_argument(
-			"dimension i and j only support trapezoid tiling (suffix t)"
+			"diamond tiling requires tile height to be a multiple of 4"
 		);
 	}
 
@@ -330,6 +398,58 @@ void ref(
 
 Plan3D makePlan(size_t tileHalfTs)
 {
+	if (tileType[0] == 'r') {
+		return computeRecursiveTiles(gridSize, tileSize, tileHalfTs);
+	}
+
+	if (tileType[2] == 'f') {
+		// DiamondTorre, the remainder batch may be too short for diamond
+		// tiling, in this case, fall back to trapezoid tiling.
+		Plan1D i;
+		if (tileHalfTs % 4 == 0) {
+			i = computeDiamondTiles(gridSize[0], tileSize[0], tileHalfTs);
+		}
+		else {
+			i = computeTrapezoidTiles(gridSize[0], tileSize[0], tileHalfTs);
+		}
+		Plan1D j = computeParallelogramTiles(
+			gridSize[1], tileSize[1], tileHalfTs
+		);
+		Plan1D k = computeColumnTiles(gridSize[2], tileHalfTs);
+		Plan3D plan = combineTilesDiamondTorre(i, j, k);
+		return plan;
+	}
+
+	if (tileType[0] == 'c' && tileHalfTs % 4 == 0) {
+		Plan1D i = computeDiamondTiles(gridSize[0], tileSize[0], tileHalfTs);
+		Plan1D j = computeDiamondTiles(gridSize[1], tileSize[1], tileHalfTs);
+		Plan1D k = computeDiamondTiles(gridSize[2], tileSize[2], tileHalfTs);
+		Plan3D plan = combineTilesDiamondCandy(i, j, k);
+		return plan;
+	}
+
+	if (tileType[0] == 'd' && tileHalfTs % 4 == 0) {
+		Plan1D i = computeDiamondTiles(gridSize[0], tileSize[0], tileHalfTs);
+		Plan1D j = computeDiamondTiles(gridSize[1], tileSize[1], tileHalfTs);
+
+		if (tileType[2] == 'p') {
+			Plan1D k = computeParallelogramTiles(
+				gridSize[2], tileSize[2], tileHalfTs
+			);
+			Plan3D plan = combineTilesDDP(i, j, k);
+			return plan;
+		}
+		else {
+			Plan1D k = computeDiamondTiles(
+				gridSize[2], tileSize[2], tileHalfTs
+			);
+			Plan3D plan = combineTilesDDD(i, j, k);
+			return plan;
+		}
+	}
+
+	// The remainder batch may be too short for diamond tiling, in this
+	// case, fall back to trapezoid tiling.
 	Plan1D i = computeTrapezoidTiles(gridSize[0], tileSize[0], tileHalfTs);
 	Plan1D j = computeTrapezoidTiles(gridSize[1], tileSize[1], tileHalfTs);
 
@@ -340,7 +460,7 @@ Plan3D makePlan(size_t tileHalfTs)
 		Plan3D plan = combineTilesTTP(i, j, k);
 		return plan;
 	}
-	else if (tileType[2] == 't') {
+	else if (tileType[2] == 't' || tileType[2] == 'd' || tileType[2] == 'c') {
 		Plan1D k = computeTrapezoidTiles(
 			gridSize[2], tileSize[2], tileHalfTs
 		);
@@ -380,19 +500,19 @@ void tiled(
 		fprintf(stderr, "rem batch\t" "0000 x 0000 = 0000 timesteps\n");
 	}
 
-	Plan3D mainPlan = makePlan(tileHalfTs);
+	Plan3D mainPlan = refineTiles(makePlan(tileHalfTs), innerTileSizes);
 	for (size_t batchId = 0; batchId < numBatches; batchId++) {
 		tiledBody(mainPlan, volt, curr, vv, vi, ii, iv);
 	}
 
 	if (remHalfTs > 0) {
-		Plan3D remPlan = makePlan(remHalfTs);
+		Plan3D remPlan = refineTiles(makePlan(remHalfTs), innerTileSizes);
 		tiledBody(remPlan, volt, curr, vv, vi, ii, iv);
 	}
 }
 
 void tiledBody(
-	Plan3D plan,
+	const Plan3D& plan,
 	NArray3D<Simd<GiNaC::ex, 4>>& volt,
 	NArray3D<Simd<GiNaC::ex, 4>>& curr,
 	NArray3D<Simd<GiNaC::ex, 4>>& vv,